@@ -0,0 +1,32 @@
+#include <bareio.h>
+#include <barelib.h>
+#include <malloc.h>
+
+
+/*
+ * 'builtin_meminfo' prints a summary of the heap usage.  When called as
+ * "meminfo walk" it also prints every block on the heap.
+ */
+byte builtin_meminfo(char* arg) {
+  heapstat_t stats;
+  int i = 7;
+  heap_stats(&stats);
+  printf("Heap size:     %d bytes\n", stats.size);
+  printf("In use:        %d bytes in %d allocations\n", stats.used, stats.allocs);
+  printf("Peak in use:   %d bytes\n", stats.peak);
+  printf("Kernel owned:  %d bytes\n", stats.kernel);
+  printf("Free:          %d bytes in %d blocks\n", stats.free, stats.freeblocks);
+  printf("Largest free:  %d bytes\n", stats.largest);
+  printf("Fragmentation: %d%%\n", stats.frag);
+
+  while(arg[i] == ' ')
+    i++;
+  if(arg[i] == 'w' && arg[i+1] == 'a' && arg[i+2] == 'l' && arg[i+3] == 'k'){
+    heap_print_map();
+  }
+  else if(arg[i] != '\0'){
+    printf("Usage: meminfo [walk]\n");
+    return 1;
+  }
+  return 0;
+}
@@ -4,15 +4,32 @@
 #include <thread.h>
 #include <queue.h>
 #include <syscall.h>
+#include <fs.h>
+#include <lfs.h>
 #define PROMPT "bareOS$ "  /*  Prompt printed by the shell to the user  */
 
+/*
+ * 'is_command' returns 1 if 'command' is exactly the builtin name 'name'.
+ */
+static byte is_command(const char* command, const char* name) {
+  while(*name != '\0' && *command == *name){
+    command++;
+    name++;
+  }
+  return *command == '\0' && *name == '\0';
+}
+
 
 /*
  * 'shell' loops forever, prompting the user for input, then calling a function based
- * on the text read in from the user.
+ * on the text read in from the user.  The shell also starts the threads that
+ * periodically write dirty file system metadata back to the block device and clean
+ * the segments of a log-structured file system.
  */
 byte shell(char* arg) {
   unsigned char ret = '0';
+  resume_thread(create_thread(&fs_flusher, NULL, 0));
+  resume_thread(create_thread(&lfs_cleaner, NULL, 0));
   while(1){
     printf("%s", PROMPT);
     int i = 0;
@@ -109,6 +126,10 @@ byte shell(char* arg) {
       ret = join_thread(tid);
 
     }
+    else if(is_command(command, "meminfo")){
+      uint32 tid = resume_thread(create_thread(&builtin_meminfo, inputBuff, inputBuffLength));
+      ret = join_thread(tid);
+    }
     else{
       printf("Unknown command\n");
     }
@@ -0,0 +1,87 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <bench.h>
+
+/*
+ *  Benchmark runner used by `make bench`.  The shell is replaced with
+ *  '__wrap_shell' (see the Makefile) which runs each suite in turn and
+ *  prints its results to the UART.
+ *
+ *  Timing uses the free running 'mtime' counter of the CLINT which QEMU
+ *  virt clocks at 10MHz (100ns per tick).  Once every suite has run the
+ *  machine is powered off through the virt test device so that several
+ *  runs can be chained (see 'bench-rvv' in the Makefile).
+ */
+
+#define CLINT_MTIME_ADDR 0x200bff8   /*  Address of the 64-bit 'mtime' register  */
+#define MTIME_NS_PER_TICK 100        /*  QEMU virt runs 'mtime' at 10MHz         */
+#define VIRT_TEST_ADDR 0x100000      /*  QEMU virt 'sifive_test' finisher        */
+#define VIRT_TEST_PASS 0x5555        /*  Value that powers off the machine       */
+
+void b__malloc(void);
+void b__memory(void);
+void b__fsalloc(void);
+void b__fswrite(void);
+void b__bcache(void);
+void b__fsstream(void);
+void b__fslayout(void);
+void b__fsdir(void);
+void b__fsmount(void);
+void b__fsblock(void);
+void b__bsvec(void);
+void b__vdisk(void);
+void b__bsasync(void);
+void b__iosched(void);
+void b__journal(void);
+void b__lfs(void);
+void b__fssparse(void);
+void b__fsinline(void);
+void b__fsdelay(void);
+
+uint64 b__now(void) {
+  return *(volatile uint64*)CLINT_MTIME_ADDR;
+}
+
+/*  Print the cost of 'ops' operations that took 'ticks' 'mtime' ticks  */
+void b__report(const char* name, uint64 ops, uint64 ticks) {
+  printf("  %s: %d ops in %d us", name, ops, ticks * MTIME_NS_PER_TICK / 1000);
+  if (ops)
+    printf(" (%d ns/op)", ticks * MTIME_NS_PER_TICK / ops);
+  printf("\n");
+}
+
+/*  Print the throughput of moving 'bytes' bytes in 'ticks' 'mtime' ticks  */
+void b__report_bw(const char* name, uint64 bytes, uint64 ticks) {
+  printf("  %s: %d bytes in %d us", name, bytes, ticks * MTIME_NS_PER_TICK / 1000);
+  if (ticks)
+    printf(" (%d KiB/s)", (bytes * (1000000000 / MTIME_NS_PER_TICK) / ticks) / 1024);
+  printf("\n");
+}
+
+byte __wrap_shell(char* arg) {
+  printf("\n    bareOS benchmarks\n");
+  printf("Memory routines: %s\n", mem_has_vector() ? "vector (RVV)" : "scalar");
+  b__malloc();
+  b__memory();
+  b__fsalloc();
+  b__fswrite();
+  b__bcache();
+  b__fsstream();
+  b__fslayout();
+  b__fsdir();
+  b__fsmount();
+  b__fsblock();
+  b__bsvec();
+  b__vdisk();
+  b__bsasync();
+  b__iosched();
+  b__journal();
+  b__lfs();
+  b__fssparse();
+  b__fsinline();
+  b__fsdelay();
+  printf("\nBenchmarks complete\n");
+  *(volatile uint32*)VIRT_TEST_ADDR = VIRT_TEST_PASS;
+  while (1);
+  return 0;
+}
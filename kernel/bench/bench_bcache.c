@@ -0,0 +1,41 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bcache.h>
+#include <bench.h>
+
+#define READ_SPAN   4096   /*  Bytes of the test file read per pass  */
+#define READ_SZ     64     /*  Size of each read                     */
+#define READ_PASSES 32     /*  Passes over the span                  */
+
+/*  Time small reads of a file through 'fs_read' and print how the  *
+ *  block cache counters moved while doing so.                      */
+void b__bcache(void) {
+  char buff[READ_SPAN];
+  bcstat_t before, after;
+  uint64 start, bytes = 0;
+  int32 fd;
+
+  if (fs_create("b__cache") == -1 || (fd = fs_open("b__cache")) == -1) {
+    printf("\nBlock cache: could not create the test file\n");
+    return;
+  }
+  memset(buff, 'c', READ_SPAN);
+  fs_write(fd, buff, READ_SPAN);
+  fs_sync();
+
+  printf("\nBlock cache (%d byte reads over %d bytes x %d)\n", READ_SZ, READ_SPAN, READ_PASSES);
+  before = bc_stats();
+  start = b__now();
+  for (int p=0; p<READ_PASSES; p++) {
+    oft[fd].head = 0;
+    for (uint32 off=0; off<READ_SPAN; off+=READ_SZ, bytes+=READ_SZ)
+      fs_read(fd, buff, READ_SZ);
+  }
+  b__report_bw("fs_read", bytes, b__now() - start);
+  after = bc_stats();
+  printf("  hits: %d  misses: %d  evictions: %d  writebacks: %d\n",
+         after.hits - before.hits, after.misses - before.misses,
+         after.evictions - before.evictions, after.writebacks - before.writebacks);
+  fs_close(fd);
+}
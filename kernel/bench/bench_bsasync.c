@@ -0,0 +1,93 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <virtio.h>
+#include <bench.h>
+
+#define AIO_BLOCKSZ 4096              /*  Block size of both devices                    */
+#define AIO_BLOCKS  2048              /*  Blocks in each device (8 MiB)                 */
+#define AIO_OPS     2048              /*  Reads timed at each queue depth               */
+#define AIO_MAXQD   32                /*  Deepest queue tried                           */
+
+static uint64 issued[AIO_MAXQD];      /*  'mtime' at which each slot's read was submitted  */
+static uint64 latency, worst;         /*  Sum and maximum of the completed reads' latency  */
+static uint32 seed;
+
+static uint32 next_block(void) {
+  seed = seed * 1103515245 + 12345;
+  return AIO_BLOCKS / 2 + (seed >> 8) % (AIO_BLOCKS / 2);
+}
+
+/*  Completion callback, runs from the disk's interrupt handler  */
+static void completed(bsreq_t* req) {
+  uint64 ticks = b__now() - *(uint64*)req->arg;
+  latency += ticks;
+  if (ticks > worst)
+    worst = ticks;
+}
+
+/*  Issue 'AIO_OPS' random one block reads keeping 'depth' of them in  *
+ *  flight: each slot is waited for in turn and immediately reused.    */
+static void bench_depth(bsreq_t* reqs, char* buf, uint32 depth) {
+  uint64 start, ticks;
+  uint32 sent = 0;
+
+  latency = worst = 0;
+  seed = 1;
+  start = b__now();
+  for (; sent<depth; sent++) {
+    reqs[sent].seg.block = next_block();
+    issued[sent] = b__now();
+    bs_submit(&reqs[sent]);
+  }
+  for (uint32 done=0; done<AIO_OPS; done++) {
+    bsreq_t* req = &reqs[done % depth];
+    bs_wait(req);
+    if (sent < AIO_OPS) {
+      req->seg.block = next_block();
+      issued[done % depth] = b__now();
+      bs_submit(req);
+      sent++;
+    }
+  }
+  ticks = b__now() - start;
+  printf("  QD %d: %d IOPS, latency %d us mean, %d us max\n", depth,
+         ticks ? (uint64)AIO_OPS * 10000000 / ticks : 0,
+         latency / AIO_OPS / 10, worst / 10);
+}
+
+static void run(const char* name, bsreq_t* reqs, char* buf) {
+  uint32 depths[] = { 1, 4, 16, 32 };
+  printf(" %s\n", name);
+  for (uint32 i=0; i<AIO_MAXQD; i++) {
+    reqs[i].seg.offset = 0;
+    reqs[i].seg.buf = buf + i * AIO_BLOCKSZ;
+    reqs[i].seg.len = AIO_BLOCKSZ;
+    reqs[i].write = 0;
+    reqs[i].callback = completed;
+    reqs[i].arg = &issued[i];
+  }
+  for (uint32 i=0; i<sizeof(depths)/sizeof(uint32); i++)
+    bench_depth(reqs, buf, depths[i]);
+}
+
+void b__bsasync(void) {
+  bsreq_t* reqs = malloc(AIO_MAXQD * sizeof(bsreq_t));
+  char* buf = malloc(AIO_MAXQD * AIO_BLOCKSZ);
+  printf("\nAsynchronous block reads (%d random %d byte reads per queue depth)\n", AIO_OPS, AIO_BLOCKSZ);
+  if (reqs == NULL || buf == NULL)
+    printf("  could not allocate the requests\n");
+  else {
+    if (b__remake_fs_bs(AIO_BLOCKSZ, AIO_BLOCKS) == 0)
+      run("ramdisk", reqs, buf);
+    if (vblk_init() == 0 && vblk_capacity() * VBLK_SECTOR_SIZE >= (uint64)AIO_BLOCKS * AIO_BLOCKSZ &&
+        b__remake_vdisk(AIO_BLOCKSZ) == 0)
+      run("virtio disk", reqs, buf);
+    else
+      printf(" virtio disk: none attached (or smaller than %d blocks)\n", AIO_BLOCKS);
+  }
+  free(reqs);
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
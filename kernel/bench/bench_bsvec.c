@@ -0,0 +1,90 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bench.h>
+
+#define VEC_BLOCKS  2048   /*  Blocks in the ramdisk used for the test             */
+#define VEC_SEGS    256    /*  Scattered blocks moved per pass                     */
+#define VEC_PASSES  16     /*  Passes timed for each variant                       */
+#define VEC_FRAG    (256 * 1024)   /*  Size of each of the two interleaved files   */
+#define VEC_APPEND  512    /*  Bytes appended to a file before switching           */
+
+/*  Move 'VEC_SEGS' blocks that are two blocks apart on the device,  *
+ *  one 'bs_read'/'bs_write' call per block or as lists of 'per_req'  *
+ *  segments passed to 'bs_readv'/'bs_writev'.                        */
+static void bench_scatter(const char* name, char* buf, bsvec_t* vec, uint32 per_req, byte write) {
+  uint32 blocksz = bs_stats().blocksz;
+  uint64 start;
+  for (uint32 i=0; i<VEC_SEGS; i++) {
+    vec[i].block = 2 + 2 * i;
+    vec[i].offset = 0;
+    vec[i].buf = buf + i * blocksz;
+    vec[i].len = blocksz;
+  }
+  start = b__now();
+  for (int p=0; p<VEC_PASSES; p++) {
+    for (uint32 i=0; i<VEC_SEGS; i+=per_req) {
+      if (per_req == 1 && write)
+        bs_write(vec[i].block, 0, vec[i].buf, blocksz);
+      else if (per_req == 1)
+        bs_read(vec[i].block, 0, vec[i].buf, blocksz);
+      else if (write)
+        bs_writev(vec + i, per_req);
+      else
+        bs_readv(vec + i, per_req);
+    }
+  }
+  b__report_bw(name, (uint64)VEC_PASSES * VEC_SEGS * blocksz, b__now() - start);
+}
+
+/*  Build two files from alternating 'VEC_APPEND' byte appends with the  *
+ *  allocation window off, so each file is scattered block by block,     *
+ *  then read one back in one 'fs_read'.                                 */
+static void bench_fragmented(char* buf) {
+  uint32 window = fs_alloc_window;
+  uint64 start;
+  int32 fd[2];
+  fs_alloc_window = 0;
+  if (b__remake_fs(VEC_BLOCKS) != 0 || fs_create("b__vec0") == -1 || fs_create("b__vec1") == -1 ||
+      (fd[0] = fs_open("b__vec0")) == -1 || (fd[1] = fs_open("b__vec1")) == -1) {
+    printf("  could not set up the fragmented files\n");
+    fs_alloc_window = window;
+    return;
+  }
+  for (uint32 off=0; off<VEC_FRAG; off+=VEC_APPEND) {
+    fs_write(fd[0], buf, VEC_APPEND);
+    fs_write(fd[1], buf, VEC_APPEND);
+  }
+  fs_sync();
+  start = b__now();
+  for (int p=0; p<VEC_PASSES; p++) {
+    oft[fd[0]].head = 0;
+    fs_read(fd[0], buf, VEC_FRAG);
+  }
+  b__report_bw("fs_read, scattered file ", (uint64)VEC_PASSES * VEC_FRAG, b__now() - start);
+  fs_close(fd[0]);
+  fs_close(fd[1]);
+  fs_alloc_window = window;
+}
+
+void b__bsvec(void) {
+  char* buf = malloc(VEC_FRAG);
+  bsvec_t* vec = malloc(VEC_SEGS * sizeof(bsvec_t));
+  printf("\nVectored block I/O (%d scattered blocks, %d passes)\n", VEC_SEGS, VEC_PASSES);
+  if (buf == NULL || vec == NULL || b__remake_fs(VEC_BLOCKS) != 0) {
+    printf("  could not set up the test\n");
+  }
+  else {
+    bench_scatter("bs_read per block       ", buf, vec, 1, 0);
+    bench_scatter("bs_readv, 16 per request", buf, vec, FS_IOV_MAX, 0);
+    bench_scatter("bs_readv, all in one    ", buf, vec, VEC_SEGS, 0);
+    bench_scatter("bs_write per block      ", buf, vec, 1, 1);
+    bench_scatter("bs_writev, 16 per req.  ", buf, vec, FS_IOV_MAX, 1);
+    bench_scatter("bs_writev, all in one   ", buf, vec, VEC_SEGS, 1);
+    bench_fragmented(buf);
+  }
+  free(buf);
+  free(vec);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
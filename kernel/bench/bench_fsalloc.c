@@ -0,0 +1,67 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bench.h>
+
+#define RUN_LEN 8          /*  Blocks requested per call in the run allocation test  */
+
+/*  The allocation loop 'fs_create' and 'fs_write' used before, one bit  *
+ *  at a time from block 0, kept as the baseline.                        */
+static int32 scan_alloc(void) {
+  for (uint32 i=0; i<fsd->device.nblocks; i++) {
+    if (fs_getmaskbit(i) == 0) {
+      fs_setmaskbit(i);
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*  Release every block but the super block and bitmask  */
+static void release_all(void) {
+  for (uint32 i=2; i<fsd->device.nblocks; i++)
+    fs_clearmaskbit(i);
+}
+
+/*  Time allocating single blocks with 'alloc' until the disk is full  */
+static void bench_fill(const char* name, int32 (*alloc)(void)) {
+  uint64 start, ops = 0;
+  release_all();
+  start = b__now();
+  while (alloc() != -1)
+    ops++;
+  b__report(name, ops, b__now() - start);
+}
+
+/*  Time filling the disk with runs of 'RUN_LEN' contiguous blocks  */
+static void bench_runs(const char* name) {
+  uint64 start, ops = 0;
+  release_all();
+  start = b__now();
+  while (fs_alloc_run(RUN_LEN) != -1)
+    ops++;
+  b__report(name, ops, b__now() - start);
+}
+
+/*  Free every other block of a full disk and time refilling the holes  */
+static void bench_holes(const char* name, int32 (*alloc)(void)) {
+  uint64 start, ops = 0;
+  release_all();
+  while (fs_alloc_block() != -1);
+  for (uint32 i=2; i<fsd->device.nblocks; i+=2)
+    fs_clearmaskbit(i);
+  start = b__now();
+  while (alloc() != -1)
+    ops++;
+  b__report(name, ops, b__now() - start);
+}
+
+void b__fsalloc(void) {
+  printf("\nFS block allocation (%d blocks)\n", fsd->device.nblocks);
+  bench_fill("fill, bit scan from 0  ", scan_alloc);
+  bench_fill("fill, word scan next-fit", fs_alloc_block);
+  bench_runs("fill, runs of 8         ");
+  bench_holes("holes, bit scan from 0  ", scan_alloc);
+  bench_holes("holes, word scan next-fit", fs_alloc_block);
+  release_all();
+}
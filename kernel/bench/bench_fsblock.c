@@ -0,0 +1,77 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bench.h>
+
+#define SWEEP_DEVICE (4 * 1024 * 1024)    /*  Size of the ramdisk at every block size        */
+#define SWEEP_FILE   (2 * 1024 * 1024)    /*  Size of the streamed file                      */
+#define SWEEP_CHUNK  (64 * 1024)          /*  Bytes per 'fs_read'/'fs_write' when streaming  */
+#define SWEEP_SMALL  16                   /*  Small files created at every block size        */
+#define SWEEP_SMALL_SZ 100                /*  Bytes written to each small file               */
+
+/*  Stream a 'SWEEP_FILE' byte file in and out of a fresh file  *
+ *  system with 'blocksz' byte blocks.                          */
+static void sweep_stream(uint32 blocksz, char* chunk) {
+  uint64 start;
+  int32 fd;
+  if (b__remake_fs_bs(blocksz, SWEEP_DEVICE / blocksz) != 0 || fs_create("b__sweep") == -1 || (fd = fs_open("b__sweep")) == -1) {
+    printf("  could not set up a file system with %d byte blocks\n", blocksz);
+    return;
+  }
+  start = b__now();
+  for (uint32 off=0; off<SWEEP_FILE; off+=SWEEP_CHUNK)
+    fs_write(fd, chunk, SWEEP_CHUNK);
+  fs_sync();
+  b__report_bw("stream write  ", SWEEP_FILE, b__now() - start);
+  oft[fd].head = 0;
+  start = b__now();
+  for (uint32 off=0; off<SWEEP_FILE; off+=SWEEP_CHUNK)
+    fs_read(fd, chunk, SWEEP_CHUNK);
+  b__report_bw("stream read   ", SWEEP_FILE, b__now() - start);
+  fs_close(fd);
+}
+
+/*  Create 'SWEEP_SMALL' files of 'SWEEP_SMALL_SZ' bytes and report  *
+ *  how much of the device they take up.                             */
+static void sweep_small(uint32 blocksz, char* chunk) {
+  char name[] = "b__small_a";
+  uint32 before;
+  uint64 start;
+  int32 fd;
+  if (b__remake_fs_bs(blocksz, SWEEP_DEVICE / blocksz) != 0) {
+    printf("  could not set up a file system with %d byte blocks\n", blocksz);
+    return;
+  }
+  before = fsd->freeblocks;
+  start = b__now();
+  for (int i=0; i<SWEEP_SMALL; i++) {
+    name[fs_strlen(name) - 1] = 'a' + i;
+    fs_create(name);
+    fd = fs_open(name);
+    fs_write(fd, chunk, SWEEP_SMALL_SZ);
+    fs_close(fd);
+  }
+  b__report("small files   ", SWEEP_SMALL, b__now() - start);
+  printf("  %d bytes of data took %d bytes of the device\n", SWEEP_SMALL * SWEEP_SMALL_SZ,
+         (before - fsd->freeblocks) * blocksz);
+}
+
+void b__fsblock(void) {
+  static const uint32 sizes[] = { 512, 1024, 4096, 16384, 65536 };
+  char* chunk = malloc(SWEEP_CHUNK);
+  printf("\nFS block size sweep (%d KiB device, %d KiB file, %d small files)\n",
+         SWEEP_DEVICE / 1024, SWEEP_FILE / 1024, SWEEP_SMALL);
+  if (chunk == NULL) {
+    printf("  could not allocate the transfer buffer\n");
+    return;
+  }
+  memset(chunk, 'b', SWEEP_CHUNK);
+  for (int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++) {
+    printf(" %d byte blocks:\n", sizes[i]);
+    sweep_stream(sizes[i], chunk);
+    sweep_small(sizes[i], chunk);
+  }
+  free(chunk);
+  b__remake_fs_bs(MDEV_BLOCK_SIZE, MDEV_NUM_BLOCKS);
+}
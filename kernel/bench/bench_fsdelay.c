@@ -0,0 +1,125 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <virtio.h>
+#include <bench.h>
+
+#define DB_BLOCKS  4096               /*  Blocks in each device (2 MiB)                        */
+#define DB_STREAMS 4                  /*  Files appended to side by side                       */
+#define DB_APPEND  16                 /*  Bytes per 'fs_write' call                            */
+#define DB_SIZE    (64 * 1024)        /*  Bytes appended to each file                          */
+#define DB_READ    4096               /*  Bytes per 'fs_read' call when reading them back      */
+
+/*  Number of runs of contiguous device blocks the file is in  */
+static uint32 extents(inode_t* inode) {
+  uint32 n = 0, prev = EMPTY, block;
+  for (uint32 i=0; i * FS_BLOCK_SIZE < inode->size; i++) {
+    block = fs_bmap(inode, i, BMAP_LOOKUP, NULL);
+    if (block != EMPTY && block != prev + 1)
+      n++;
+    prev = block;
+  }
+  return n;
+}
+
+/*  Byte 'off' of file 'i', each append has a value of its own  */
+static char pattern(uint32 i, uint32 off) {
+  return 'a' + (i * 7 + off / DB_APPEND) % 26;
+}
+
+/*  Append to 'DB_STREAMS' files in turn, 'DB_APPEND' bytes at a  *
+ *  time, and sync.  Then mount again and read each file back in  *
+ *  'DB_READ' byte calls from a cold cache, and once more         *
+ *  (untimed) to check it holds what was appended.                */
+static void bench_append(const char* name, char* buf, byte vdisk) {
+  char file[] = "b__dly0";
+  int32 fd[DB_STREAMS];
+  uint32 runs = 0;
+  uint64 start, reqs;
+  byte bad = 0;
+
+  printf("  %s\n", name);
+  for (uint32 i=0; i<DB_STREAMS; i++) {
+    file[6] = '0' + i;
+    if (fs_create(file) == -1 || (fd[i] = fs_open(file)) == -1) {
+      printf("   could not create the files\n");
+      return;
+    }
+  }
+  start = b__now();
+  for (uint32 off=0; off<DB_SIZE; off+=DB_APPEND)
+    for (uint32 i=0; i<DB_STREAMS; i++) {
+      memset(buf, pattern(i, off), DB_APPEND);
+      fs_write(fd[i], buf, DB_APPEND);
+    }
+  fs_sync();
+  b__report_bw(" append", DB_SIZE * DB_STREAMS, b__now() - start);
+  for (uint32 i=0; i<DB_STREAMS; i++) {
+    runs += extents(&oft[fd[i]].inode);
+    fs_close(fd[i]);
+  }
+  printf("   %d runs of blocks for %d files (%d blocks each)\n", runs, DB_STREAMS, DB_SIZE / FS_BLOCK_SIZE);
+
+  fs_umount();
+  fs_mount();
+  reqs = vblk_stats().dispatched;
+  start = b__now();
+  for (uint32 i=0; i<DB_STREAMS; i++) {
+    file[6] = '0' + i;
+    if ((fd[i] = fs_open(file)) == -1)
+      continue;
+    for (uint32 off=0; off<DB_SIZE; off+=DB_READ)
+      fs_read(fd[i], buf, DB_READ);
+    fs_close(fd[i]);
+  }
+  b__report_bw(" read  ", DB_SIZE * DB_STREAMS, b__now() - start);
+  if (vdisk)
+    printf("   %d device requests\n", vblk_stats().dispatched - reqs);
+
+  for (uint32 i=0; i<DB_STREAMS && !bad; i++) {
+    file[6] = '0' + i;
+    if ((fd[i] = fs_open(file)) == -1 || oft[fd[i]].inode.size != DB_SIZE)
+      bad = 1;
+    for (uint32 off=0; off<DB_SIZE && !bad; off+=DB_READ) {
+      if (fs_read(fd[i], buf, DB_READ) != DB_READ)
+        bad = 1;
+      for (uint32 k=0; k<DB_READ && !bad; k++)
+        if (buf[k] != pattern(i, off + k))
+          bad = 1;
+    }
+    if (fd[i] != -1)
+      fs_close(fd[i]);
+  }
+  printf("   read back %s\n", bad ? "does not match what was written" : "matches");
+}
+
+static void run(const char* name, char* buf, byte vdisk) {
+  printf(" %s\n", name);
+  for (uint32 pass=0; pass<3; pass++) {
+    fs_alloc_window = (pass == 0 ? 0 : FS_ALLOC_WINDOW);
+    fs_delay_alloc = (pass == 2);
+    if ((vdisk ? b__remake_vdisk(MDEV_BLOCK_SIZE) : b__remake_fs_bs(MDEV_BLOCK_SIZE, DB_BLOCKS)) != 0)
+      printf("  could not set up the device\n");
+    else
+      bench_append(pass == 0 ? "placed when written (next-fit)" :
+                   pass == 1 ? "placed when written (allocation window)" : "delayed allocation", buf, vdisk);
+  }
+  fs_alloc_window = FS_ALLOC_WINDOW;
+  fs_delay_alloc = 0;
+}
+
+void b__fsdelay(void) {
+  char* buf = malloc(DB_READ);
+  if (buf == NULL)
+    return;
+
+  printf("\nDelayed allocation (%d files appended %d bytes at a time)\n", DB_STREAMS, DB_APPEND);
+  run("ramdisk", buf, 0);
+  if (vblk_init() == 0)
+    run("virtio disk", buf, 1);
+  else
+    printf(" virtio disk: none attached\n");
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
@@ -0,0 +1,143 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bench.h>
+
+#define DIR_OPENS  1000    /*  Opens timed for each directory size           */
+#define DIR_BLOCKS 8192    /*  Blocks in the ramdisk, room for 4096 inodes   */
+#define TREE_DEPTH 16      /*  Deepest directory tree timed                  */
+
+/*  The scan 'fs_open' and 'fs_create' did before the name index,  *
+ *  kept as the baseline.                                          */
+static int32 scan_lookup(const char* name) {
+  dirent_t entry;
+  for (int32 i=0; i<fsd->root_dir.numentries; i++)
+    if (fs_dir_get(&fsd->root_dir.inode, i, &entry) == 0 && fs_strcmp(entry.name, name) == 0)
+      return i;
+  return -1;
+}
+
+static int32 cached_lookup(const char* name) {
+  dirent_t entry;
+  return fs_lookup(ROOT_DIR, name, &entry);
+}
+
+/*  Write "b__dir<n>" to 'name'  */
+static void dir_name(char* name, uint32 n) {
+  char digits[10];
+  int i = 0, len = 0;
+  fs_strcpy(name, "b__dir");
+  len = fs_strlen(name);
+  do {
+    digits[i++] = '0' + n % 10;
+    n /= 10;
+  } while (n);
+  while (i > 0)
+    name[len++] = digits[--i];
+  name[len] = '\0';
+}
+
+static void bench_lookup(const char* label, const char* name, int32 (*lookup)(const char*)) {
+  uint64 start = b__now();
+  for (int i=0; i<DIR_OPENS; i++)
+    lookup(name);
+  b__report(label, DIR_OPENS, b__now() - start);
+}
+
+/*  Time filling a fresh root directory with 'nfiles' files and      *
+ *  opening the last one, then lookups of that name and of a missing  *
+ *  name through the index and through a plain scan.                  */
+static void bench_dir(uint32 nfiles) {
+  char name[FILENAME_LEN];
+  dirstat_t before, after;
+  uint64 start;
+  int32 fd;
+
+  if (b__remake_fs(DIR_BLOCKS) != 0) {
+    printf("  could not set up a %d block file system\n", DIR_BLOCKS);
+    return;
+  }
+  printf(" %d files:\n", nfiles);
+  start = b__now();
+  for (uint32 i=0; i<nfiles; i++) {
+    dir_name(name, i);
+    fs_create(name);
+  }
+  b__report("fs_create          ", nfiles, b__now() - start);
+  printf("  directory: %d entries in %d blocks\n", fsd->root_dir.numentries, fsd->root_dir.inode.size / FS_BLOCK_SIZE);
+
+  start = b__now();
+  for (int i=0; i<DIR_OPENS; i++) {
+    fd = fs_open(name);
+    fs_close(fd);
+  }
+  b__report("fs_open+fs_close   ", DIR_OPENS, b__now() - start);
+
+  bench_lookup("indexed lookup     ", name, cached_lookup);
+  bench_lookup("scanned lookup     ", name, scan_lookup);
+  before = fs_dir_stats();
+  bench_lookup("indexed, missing   ", "b__missing", cached_lookup);
+  after = fs_dir_stats();
+  bench_lookup("scanned, missing   ", "b__missing", scan_lookup);
+  printf("  negative cache answered %d of %d missing lookups\n", after.neghits - before.neghits, DIR_OPENS);
+}
+
+/*  Time opening a file 'depth' directories down ("d/d/.../f"),  *
+ *  first right after a remount, with an empty dentry cache and  *
+ *  block cache, then with the path already cached.              */
+static void bench_tree(uint32 depth) {
+  char path[TREE_DEPTH * 2 + 2];
+  dirstat_t before, after;
+  uint64 start;
+  int32 fd;
+  int len = 0;
+
+  b__remake_fs(DIR_BLOCKS);
+  for (uint32 i=0; i<depth; i++) {
+    path[len++] = 'd';
+    path[len] = '\0';
+    fs_mkdir(path);
+    path[len++] = '/';
+  }
+  path[len++] = 'f';
+  path[len] = '\0';
+  if (fs_create(path) == -1) {
+    printf("  could not create a file %d directories down\n", depth);
+    return;
+  }
+  printf(" depth %d:\n", depth);
+
+  fs_umount();
+  fs_mount();
+  before = fs_dir_stats();
+  start = b__now();
+  fd = fs_open(path);
+  fs_close(fd);
+  b__report("cold fs_open+close ", 1, b__now() - start);
+  after = fs_dir_stats();
+  printf("  cold: %d hits, %d misses, %d directory blocks read\n",
+         after.hits - before.hits, after.misses - before.misses, after.dirblocks - before.dirblocks);
+
+  before = after;
+  start = b__now();
+  for (int i=0; i<DIR_OPENS; i++) {
+    fd = fs_open(path);
+    fs_close(fd);
+  }
+  b__report("warm fs_open+close ", DIR_OPENS, b__now() - start);
+  after = fs_dir_stats();
+  printf("  warm: %d hits, %d misses, %d directory blocks read\n",
+         after.hits - before.hits, after.misses - before.misses, after.dirblocks - before.dirblocks);
+}
+
+void b__fsdir(void) {
+  static const uint32 sizes[] = { 16, 256, 1024, 4096 };
+  static const uint32 depths[] = { 1, 4, 8, TREE_DEPTH };
+  printf("\nFS directory lookups (%d per test)\n", DIR_OPENS);
+  for (int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+    bench_dir(sizes[i]);
+  printf("\nFS path lookups through nested directories\n");
+  for (int i=0; i<sizeof(depths)/sizeof(depths[0]); i++)
+    bench_tree(depths[i]);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
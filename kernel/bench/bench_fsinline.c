@@ -0,0 +1,98 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bcache.h>
+#include <virtio.h>
+#include <bench.h>
+
+#define IB_BLOCKS 4096                /*  Blocks in each device (2 MiB)                       */
+#define IB_FILES  200                 /*  Files created by each pass                          */
+#define IB_WRITE  100                 /*  Bytes written to each of them                       */
+
+static void name_of(char* file, uint32 i) {
+  file[5] = '0' + i / 100;
+  file[6] = '0' + i / 10 % 10;
+  file[7] = '0' + i % 10;
+}
+
+/*  Create 'IB_FILES' files of 'IB_WRITE' bytes and sync, then mount  *
+ *  again and read them all back from a cold cache.  Prints the time  *
+ *  taken, the blocks the files took and the blocks moved to and from *
+ *  the device (and the virtio disk's requests when on it), and       *
+ *  whether every file read back what was written.                    */
+static void bench_small(const char* name, byte vdisk) {
+  char file[] = "b__in000", data[IB_WRITE];
+  uint32 before = fsd->freeblocks;
+  uint64 start, reqs = vblk_stats().dispatched;
+  uint32 bad = 0;
+  bcstat_t bc;
+  int32 fd;
+
+  start = b__now();
+  for (uint32 i=0; i<IB_FILES; i++) {
+    name_of(file, i);
+    if (fs_create(file) == -1 || (fd = fs_open(file)) == -1) {
+      printf("  could not create the files\n");
+      return;
+    }
+    memset(data, 'a' + i % 26, IB_WRITE);
+    fs_write(fd, data, IB_WRITE);
+    fs_close(fd);
+  }
+  fs_sync();
+  bc = bc_stats();
+  printf("  %s: create %d us, %d blocks, %d blocks written", name, (b__now() - start) / 10,
+         before - fsd->freeblocks, bc.writebacks);
+  if (vdisk)
+    printf(", %d device requests", vblk_stats().dispatched - reqs);
+  printf("\n");
+
+  fs_umount();
+  fs_mount();
+  reqs = vblk_stats().dispatched;
+  start = b__now();
+  for (uint32 i=0; i<IB_FILES; i++) {
+    name_of(file, i);
+    if ((fd = fs_open(file)) == -1) {
+      bad++;
+      continue;
+    }
+    if (fs_read(fd, data, IB_WRITE) != IB_WRITE)
+      bad++;
+    else
+      for (uint32 k=0; k<IB_WRITE; k++)
+        if (data[k] != 'a' + i % 26) {
+          bad++;
+          break;
+        }
+    fs_close(fd);
+  }
+  bc = bc_stats();
+  printf("  %s: read   %d us, %d blocks read", name, (b__now() - start) / 10, bc.misses);
+  if (vdisk)
+    printf(", %d device requests", vblk_stats().dispatched - reqs);
+  printf("\n");
+  printf("  %s: read back %s\n", name, bad ? "does not match what was written" : "matches");
+}
+
+static void run(const char* name, byte vdisk) {
+  printf(" %s\n", name);
+  for (uint32 inlined=0; inlined<2; inlined++) {
+    fs_inline_max = (inlined ? FS_INLINE_MAX : 0);
+    if ((vdisk ? b__remake_vdisk(MDEV_BLOCK_SIZE) : b__remake_fs_bs(MDEV_BLOCK_SIZE, IB_BLOCKS)) != 0)
+      printf("  could not set up the device\n");
+    else
+      bench_small(inlined ? "inline  " : "in block", vdisk);
+  }
+  fs_inline_max = 0;
+}
+
+void b__fsinline(void) {
+  printf("\nInline small files (%d files of %d bytes, then fs_sync)\n", IB_FILES, IB_WRITE);
+  run("ramdisk", 0);
+  if (vblk_init() == 0)
+    run("virtio disk", 1);
+  else
+    printf(" virtio disk: none attached\n");
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
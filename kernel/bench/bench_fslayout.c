@@ -0,0 +1,87 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bench.h>
+
+#define LAYOUT_SIZE   (2 * 1024 * 1024)   /*  Final size of each of the two files            */
+#define LAYOUT_APPEND 1024                /*  Bytes appended to a file before switching      */
+#define LAYOUT_READ   (64 * 1024)         /*  Bytes per 'fs_read' call when reading back     */
+#define LAYOUT_BLOCKS 10240               /*  Blocks in the ramdisk used for the test        */
+
+/*  Number of runs of contiguous device blocks the file is made of  */
+static uint32 count_runs(inode_t* inode) {
+  uint32 runs = 0, prev = EMPTY - 1, block;
+  for (uint32 i=0; i<(inode->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE; i++) {
+    block = fs_bmap(inode, i, 0, NULL);
+    runs += (block != prev + 1);
+    prev = block;
+  }
+  return runs;
+}
+
+/*  Bytes of mapping metadata the file needs: the inode plus its  *
+ *  indirect blocks.                                              */
+static uint32 map_bytes(inode_t* inode) {
+  uint32 blocks = (inode->size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE, meta = 0;
+  if (blocks > INODE_BLOCKS)
+    meta++;
+  if (blocks > INODE_BLOCKS + INODE_PTRS)
+    meta += 1 + (blocks - INODE_BLOCKS - INODE_PTRS + INODE_PTRS - 1) / INODE_PTRS;
+  return sizeof(inode_t) + meta * FS_BLOCK_SIZE;
+}
+
+/*  Grow two files side by side in 'LAYOUT_APPEND' byte appends, then  *
+ *  read the first one back sequentially.  'window' is the allocation  *
+ *  window used (0 is the plain next-fit allocator).                   */
+static void bench_layout(uint32 window, char* buf) {
+  uint64 start, ticks;
+  int32 fd[2];
+  uint32 runs;
+
+  if (b__remake_fs(LAYOUT_BLOCKS) != 0 || fs_create("b__a") == -1 || fs_create("b__b") == -1 ||
+      (fd[0] = fs_open("b__a")) == -1 || (fd[1] = fs_open("b__b")) == -1) {
+    printf("  could not set up a %d block file system\n", LAYOUT_BLOCKS);
+    return;
+  }
+  fs_alloc_window = window;
+  printf(" allocation window %d blocks:\n", window);
+
+  memset(buf, 'l', LAYOUT_APPEND);
+  start = b__now();
+  for (uint32 off=0; off<LAYOUT_SIZE; off+=LAYOUT_APPEND) {
+    fs_write(fd[0], buf, LAYOUT_APPEND);
+    fs_write(fd[1], buf, LAYOUT_APPEND);
+  }
+  fs_sync();
+  b__report_bw("interleaved append", 2 * LAYOUT_SIZE, b__now() - start);
+
+  oft[fd[0]].head = 0;
+  start = b__now();
+  for (uint32 off=0; off<LAYOUT_SIZE; off+=LAYOUT_READ)
+    fs_read(fd[0], buf, LAYOUT_READ);
+  ticks = b__now() - start;
+  b__report_bw("sequential read   ", LAYOUT_SIZE, ticks);
+
+  runs = count_runs(&oft[fd[0]].inode);
+  printf("  %d blocks in %d contiguous runs, block map %d bytes (as extents %d bytes)\n",
+         LAYOUT_SIZE / FS_BLOCK_SIZE, runs, map_bytes(&oft[fd[0]].inode), runs * 2 * sizeof(uint32));
+  fs_close(fd[0]);
+  fs_close(fd[1]);
+}
+
+void b__fslayout(void) {
+  char* buf = malloc(LAYOUT_READ);
+  uint32 window = fs_alloc_window;
+
+  printf("\nFS layout (two %d byte files grown together, %d byte appends)\n", LAYOUT_SIZE, LAYOUT_APPEND);
+  if (buf == NULL) {
+    printf("  out of memory\n");
+    return;
+  }
+  bench_layout(0, buf);
+  bench_layout(FS_ALLOC_WINDOW, buf);
+  fs_alloc_window = window;
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
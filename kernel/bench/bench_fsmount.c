@@ -0,0 +1,58 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bench.h>
+
+#define MOUNT_ROUNDS 16    /*  Mounts timed for each device size and mode  */
+
+/*  Number of free bitmask blocks read from the device so far  */
+static uint32 mask_loaded(void) {
+  uint32 n = 0;
+  for (uint32 b=0; b<fsd->maskblocks; b++)
+    n += (fsd->maskstate[b] & MASK_LOADED) != 0;
+  return n;
+}
+
+/*  Time 'MOUNT_ROUNDS' unmount/mount pairs reading the bitmask on  *
+ *  demand ('lazy') or all of it on mount.                          */
+static void bench_mounts(const char* name, byte lazy) {
+  uint64 start;
+  fs_mask_lazy = lazy;
+  start = b__now();
+  for (int i=0; i<MOUNT_ROUNDS; i++) {
+    fs_umount();
+    fs_mount();
+  }
+  b__report(name, MOUNT_ROUNDS, b__now() - start);
+  fs_mask_lazy = 1;
+}
+
+/*  Build a file system of 'nblocks' blocks and time mounting it with  *
+ *  both modes, then use the first and the last block of the device.   */
+static void bench_size(uint32 nblocks) {
+  int32 fd, last;
+
+  if (b__remake_fs(nblocks) != 0) {
+    printf("  could not set up a %d block file system\n", nblocks);
+    return;
+  }
+  printf(" %d blocks (%d MiB), bitmask of %d blocks:\n", nblocks, nblocks / (1024 * 1024 / FS_BLOCK_SIZE), fsd->maskblocks);
+  bench_mounts("eager mount      ", 0);
+  bench_mounts("lazy mount       ", 1);
+
+  fs_create("b__mount");
+  fd = fs_open("b__mount");
+  fs_write(fd, "x", 1);
+  fs_close(fd);
+  printf("  bitmask blocks read after a create and a write: %d\n", mask_loaded());
+  last = fs_alloc_high();
+  printf("  highest block allocated: %d, bitmask blocks read: %d, free blocks: %d\n", last, mask_loaded(), fsd->freeblocks);
+}
+
+void b__fsmount(void) {
+  static const uint32 sizes[] = { 4096, 8192, 16384 };
+  printf("\nFS mount with a multi-block free bitmask (%d mounts per test)\n", MOUNT_ROUNDS);
+  for (int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+    bench_size(sizes[i]);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
@@ -0,0 +1,71 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bench.h>
+
+#define SPARSE_SIZE   (4 * 1024 * 1024)   /*  Size of each file                              */
+#define SPARSE_CHUNK  (64 * 1024)         /*  Bytes per 'fs_read'/'fs_write' call            */
+#define SPARSE_BLOCKS 10240               /*  Blocks in the ramdisk used for the test        */
+
+/*  Make a file of 'SPARSE_SIZE' bytes, either by writing all of it  *
+ *  or by seeking to its last byte and writing only that, then read  *
+ *  it back.  Reports the blocks the file took and both times, and   *
+ *  checks (untimed) that the holes read back as zeros.              */
+static void bench_sparse(char* name, byte sparse, char* buf) {
+  uint32 before = fsd->freeblocks;
+  uint64 start;
+  int32 fd;
+  byte bad = 0;
+
+  if (fs_create(name) == -1 || (fd = fs_open(name)) == -1) {
+    printf("  could not create the file\n");
+    return;
+  }
+  printf(" %s:\n", sparse ? "sparse (seek to the end, write 1 byte)" : "dense (every byte written)");
+  memset(buf, 'd', SPARSE_CHUNK);
+  start = b__now();
+  if (sparse) {
+    fs_seek(fd, SPARSE_SIZE - 1, SEEK_START);
+    fs_write(fd, buf, 1);
+  }
+  else
+    for (uint32 off=0; off<SPARSE_SIZE; off+=SPARSE_CHUNK)
+      fs_write(fd, buf, SPARSE_CHUNK);
+  fs_sync();
+  b__report_bw("make", SPARSE_SIZE, b__now() - start);
+  printf("  %d bytes in %d blocks\n", oft[fd].inode.size, before - fsd->freeblocks);
+
+  fs_seek(fd, 0, SEEK_START);
+  start = b__now();
+  for (uint32 off=0; off<SPARSE_SIZE; off+=SPARSE_CHUNK)
+    fs_read(fd, buf, SPARSE_CHUNK);
+  b__report_bw("read", SPARSE_SIZE, b__now() - start);
+
+  fs_seek(fd, 0, SEEK_START);
+  for (uint32 off=0; off<SPARSE_SIZE && !bad; off+=SPARSE_CHUNK) {
+    if (fs_read(fd, buf, SPARSE_CHUNK) != SPARSE_CHUNK)
+      bad = 1;
+    for (uint32 i=0; i<SPARSE_CHUNK && !bad; i++)
+      if (buf[i] != (!sparse || off + i == SPARSE_SIZE - 1 ? 'd' : 0))
+        bad = 1;
+  }
+  printf("  read back %s\n", bad ? "does not match what was written" : "matches");
+  fs_close(fd);
+}
+
+void b__fssparse(void) {
+  char* buf = malloc(SPARSE_CHUNK);
+  if (buf == NULL)
+    return;
+
+  printf("\nSparse files (%d byte file, %d byte calls)\n", SPARSE_SIZE, SPARSE_CHUNK);
+  if (b__remake_fs(SPARSE_BLOCKS) != 0)
+    printf("  could not set up a %d block file system\n", SPARSE_BLOCKS);
+  else {
+    bench_sparse("b__dense", 0, buf);
+    bench_sparse("b__sparse", 1, buf);
+  }
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
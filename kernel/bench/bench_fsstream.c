@@ -0,0 +1,64 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bench.h>
+
+#define STREAM_SIZE   (4 * 1024 * 1024)   /*  Size of the streamed file (4MiB)                  */
+#define STREAM_CHUNK  4096                /*  Bytes moved per 'fs_read'/'fs_write' call        */
+#define STREAM_STEP   (1024 * 1024)       /*  Throughput is reported for every MiB of the file */
+#define STREAM_BLOCKS 10240               /*  Blocks in the ramdisk used for the test          */
+
+/*  Replace the mounted file system with a fresh one on a ramdisk  *
+ *  of 'nblocks' blocks of 'blocksz' bytes.                        */
+int32 b__remake_fs_bs(uint32 blocksz, uint32 nblocks) {
+  fs_umount();
+  bs_free_ramdisk();
+  if (bs_mk_ramdisk(blocksz, nblocks) != 0)
+    return -1;
+  fs_mkfs();
+  return fs_mount();
+}
+
+/*  Same with the default block size  */
+int32 b__remake_fs(uint32 nblocks) {
+  return b__remake_fs_bs(MDEV_BLOCK_SIZE, nblocks);
+}
+
+/*  Move the file one MiB at a time in 'STREAM_CHUNK' calls, printing  *
+ *  the throughput of each MiB so a slowdown deep in the file (behind  *
+ *  the indirect blocks) shows up.                                     */
+static void stream(int32 fd, char* chunk, byte write) {
+  uint64 start;
+  oft[fd].head = 0;
+  for (uint32 mib=0; mib<STREAM_SIZE/STREAM_STEP; mib++) {
+    start = b__now();
+    for (uint32 off=0; off<STREAM_STEP; off+=STREAM_CHUNK) {
+      if (write)
+        fs_write(fd, chunk, STREAM_CHUNK);
+      else
+        fs_read(fd, chunk, STREAM_CHUNK);
+    }
+    if (write && mib == STREAM_SIZE/STREAM_STEP - 1)
+      fs_sync();
+    printf("  MiB %d", mib);
+    b__report_bw(write ? "write" : "read ", STREAM_STEP, b__now() - start);
+  }
+}
+
+void b__fsstream(void) {
+  char chunk[STREAM_CHUNK];
+  int32 fd;
+
+  printf("\nFS streaming (%d byte file, %d byte calls)\n", STREAM_SIZE, STREAM_CHUNK);
+  if (b__remake_fs(STREAM_BLOCKS) != 0 || fs_create("b__stream") == -1 || (fd = fs_open("b__stream")) == -1) {
+    printf("  could not set up a %d block file system\n", STREAM_BLOCKS);
+  }
+  else {
+    memset(chunk, 's', STREAM_CHUNK);
+    stream(fd, chunk, 1);
+    printf("  file size: %d bytes, free blocks left: %d\n", oft[fd].inode.size, fsd->freeblocks);
+    stream(fd, chunk, 0);
+    fs_close(fd);
+  }
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
@@ -0,0 +1,45 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <bench.h>
+
+#define WRITE_SPAN   4096   /*  Bytes written per pass (stays within the direct blocks)  */
+#define WRITE_PASSES 8      /*  Passes over the span for each write size                 */
+
+/*  Time 'WRITE_PASSES' passes of 'sz' byte writes over the first    *
+ *  'WRITE_SPAN' bytes of 'fd'.  With 'through' set the inode and     *
+ *  bitmask are written back after every call, as 'fs_write' used to  *
+ *  do before metadata was tracked as dirty.                          */
+static void bench_writes(const char* name, int32 fd, uint32 sz, byte through) {
+  char buff[512];
+  uint64 start, bytes = 0;
+  memset(buff, 'x', sz);
+  start = b__now();
+  for (int p=0; p<WRITE_PASSES; p++) {
+    oft[fd].head = 0;
+    for (uint32 off=0; off+sz<=WRITE_SPAN; off+=sz, bytes+=sz) {
+      fs_write(fd, buff, sz);
+      if (through) {
+        bs_write(oft[fd].inode.id, 0, &oft[fd].inode, sizeof(inode_t));
+        bs_write(BM_BIT, 0, fsd->freemask, fsd->freemasksz);
+      }
+    }
+  }
+  fs_sync();
+  b__report_bw(name, bytes, b__now() - start);
+}
+
+void b__fswrite(void) {
+  uint32 sizes[] = { 1, 64, 512 };
+  int32 fd;
+  if (fs_create("b__write") == -1 || (fd = fs_open("b__write")) == -1) {
+    printf("\nFS write loops: could not create the test file\n");
+    return;
+  }
+  for (int i=0; i<3; i++) {
+    printf("\nFS write loop (%d byte writes, %d bytes x %d)\n", sizes[i], WRITE_SPAN, WRITE_PASSES);
+    bench_writes("write-through", fd, sizes[i], 1);
+    bench_writes("write-back   ", fd, sizes[i], 0);
+  }
+  fs_close(fd);
+}
@@ -0,0 +1,100 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <virtio.h>
+#include <bench.h>
+
+#define IOS_BLOCKSZ 1024              /*  Block size of the file system on the disk           */
+#define IOS_FILES   4                 /*  Files appended to by the small write pass           */
+#define IOS_WRITE   100               /*  Bytes per 'fs_write' call                           */
+#define IOS_SIZE    6000              /*  Bytes appended to each file                         */
+#define IOS_RAW     256               /*  Blocks written by the scattered write pass          */
+
+static vblkstat_t vbase;
+static elvstat_t ebase;
+
+static void mark(void) {
+  vbase = vblk_stats();
+  ebase = elv_stats();
+}
+
+/*  Print the requests the driver was given and sent since 'mark'  */
+static void report(const char* name, uint64 ticks) {
+  vblkstat_t v = vblk_stats();
+  elvstat_t e = elv_stats();
+  printf("  %s: %d requests, %d sent to the device (%d back / %d front merges, %d expired) in %d us\n", name,
+         v.submitted - vbase.submitted, v.dispatched - vbase.dispatched,
+         e.backmerges - ebase.backmerges, e.frontmerges - ebase.frontmerges,
+         e.expired - ebase.expired, ticks / 10);
+}
+
+/*  Append 'IOS_WRITE' bytes at a time to 'IOS_FILES' files in turn  *
+ *  until each holds 'IOS_SIZE' bytes, then sync.  The data sits in   *
+ *  the block cache until 'fs_sync' writes it back.                   */
+static void bench_small(char* buf) {
+  char name[] = "b__ios0";
+  int32 fd[IOS_FILES];
+  uint64 start;
+
+  for (uint32 i=0; i<IOS_FILES; i++) {
+    name[6] = '0' + i;
+    if (fs_create(name) == -1 || (fd[i] = fs_open(name)) == -1) {
+      printf("  could not create the files\n");
+      return;
+    }
+  }
+  fs_sync();
+  mark();
+  start = b__now();
+  for (uint32 off=0; off<IOS_SIZE; off+=IOS_WRITE)
+    for (uint32 i=0; i<IOS_FILES; i++)
+      fs_write(fd[i], buf, IOS_WRITE);
+  fs_sync();
+  report("small appends + fs_sync", b__now() - start);
+  for (uint32 i=0; i<IOS_FILES; i++)
+    fs_close(fd[i]);
+}
+
+/*  Write 'IOS_RAW' single blocks past the metadata under a plug, going  *
+ *  up eight blocks at a time but through each group of eight backwards  */
+static void bench_raw(char* buf) {
+  uint32 first = bs_stats().nblocks / 2;
+  uint64 start;
+
+  mark();
+  start = b__now();
+  bs_plug();
+  for (uint32 i=0; i<IOS_RAW; i++)
+    bs_write(first + (i ^ 7), 0, buf, IOS_BLOCKSZ);
+  bs_unplug();
+  report("scattered block writes ", b__now() - start);
+}
+
+static void run(const char* name, char* buf, byte enabled) {
+  printf(" %s\n", name);
+  elv_enabled = enabled;
+  if (b__remake_vdisk(IOS_BLOCKSZ) != 0)
+    printf("  could not set up the device\n");
+  else {
+    bench_small(buf);
+    bench_raw(buf);
+  }
+  elv_enabled = 1;
+}
+
+void b__iosched(void) {
+  char* buf = malloc(IOS_BLOCKSZ);
+  printf("\nI/O scheduler on the virtio disk (%d byte blocks)\n", IOS_BLOCKSZ);
+  if (buf == NULL)
+    printf("  could not allocate the buffer\n");
+  else if (vblk_init() != 0)
+    printf(" virtio disk: none attached\n");
+  else {
+    memset(buf, 'i', IOS_BLOCKSZ);
+    run("elevator off (FIFO)", buf, 0);
+    run("elevator on", buf, 1);
+  }
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
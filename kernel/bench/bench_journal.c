@@ -0,0 +1,63 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <fs.h>
+#include <virtio.h>
+#include <journal.h>
+#include <bench.h>
+
+#define JB_BLOCKS 4096                /*  Blocks in each device (2 MiB)                       */
+#define JB_FILES  64                  /*  Files created by each pass                          */
+#define JB_WRITE  64                  /*  Bytes written to each of them                       */
+
+/*  Create 'JB_FILES' files holding 'JB_WRITE' bytes each and sync,  *
+ *  printing the time taken, the requests the virtio disk was given  *
+ *  (on the virtio disk) and what the journal committed.             */
+static void bench_create(const char* name, byte vdisk) {
+  char file[] = "b__jnl00", data[JB_WRITE];
+  uint64 start, reqs = vblk_stats().submitted;
+  jnlstat_t jnl;
+  int32 fd;
+
+  memset(data, 'j', JB_WRITE);
+  start = b__now();
+  for (uint32 i=0; i<JB_FILES; i++) {
+    file[6] = '0' + i / 10;
+    file[7] = '0' + i % 10;
+    if (fs_create(file) == -1 || (fd = fs_open(file)) == -1) {
+      printf("  could not create the files\n");
+      return;
+    }
+    fs_write(fd, data, JB_WRITE);
+    fs_close(fd);
+  }
+  fs_sync();
+  printf("  %s: %d creates in %d us", name, JB_FILES, (b__now() - start) / 10);
+  if (vdisk)
+    printf(", %d device requests", vblk_stats().submitted - reqs);
+  jnl = jnl_stats();
+  if (jnl.commits)
+    printf(", %d commits of %d blocks (%d ops each)", jnl.commits, jnl.logged, jnl.ops / jnl.commits);
+  printf("\n");
+}
+
+static void run(const char* name, byte vdisk) {
+  printf(" %s\n", name);
+  for (uint32 journal=0; journal<2; journal++) {
+    fs_journal_blocks = (journal ? FS_JOURNAL_BLOCKS : 0);
+    if ((vdisk ? b__remake_vdisk(MDEV_BLOCK_SIZE) : b__remake_fs_bs(MDEV_BLOCK_SIZE, JB_BLOCKS)) != 0)
+      printf("  could not set up the device\n");
+    else
+      bench_create(journal ? "journal " : "in place", vdisk);
+  }
+  fs_journal_blocks = 0;
+}
+
+void b__journal(void) {
+  printf("\nMetadata journal (%d files of %d bytes, then fs_sync)\n", JB_FILES, JB_WRITE);
+  run("ramdisk", 0);
+  if (vblk_init() == 0)
+    run("virtio disk", 1);
+  else
+    printf(" virtio disk: none attached\n");
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
@@ -0,0 +1,127 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <virtio.h>
+#include <lfs.h>
+#include <bench.h>
+
+#define LB_BLOCKSZ 1024               /*  Block size of the file systems                       */
+#define LB_STREAMS 4                  /*  Files appended to side by side                       */
+#define LB_APPEND  4096               /*  Bytes per 'fs_write' call when appending             */
+#define LB_SIZE    (512 * 1024)       /*  Bytes appended to each file                          */
+#define LB_SYNC    (256 * 1024)       /*  Bytes appended in all between two calls to 'fs_sync' */
+#define LB_BLOCKS  4096               /*  Blocks in the ramdisk the cleaner is measured on     */
+#define LB_CHURN   2                  /*  Rewrites of the whole log by the cleaner pass        */
+
+/*  Append to 'LB_STREAMS' files in turn, 'LB_APPEND' bytes at a  *
+ *  time, syncing every 'LB_SYNC' bytes, then read them back one  *
+ *  after the other.                                              */
+static void bench_append(char* buf) {
+  char name[] = "b__lfs0";
+  int32 fd[LB_STREAMS];
+  uint64 start, reqs;
+
+  for (uint32 i=0; i<LB_STREAMS; i++) {
+    name[6] = '0' + i;
+    if (fs_create(name) == -1 || (fd[i] = fs_open(name)) == -1) {
+      printf("  could not create the files\n");
+      return;
+    }
+  }
+  reqs = vblk_stats().dispatched;
+  start = b__now();
+  for (uint32 off=0; off<LB_SIZE; off+=LB_APPEND) {
+    for (uint32 i=0; i<LB_STREAMS; i++)
+      fs_write(fd[i], buf, LB_APPEND);
+    if ((off + LB_APPEND) * LB_STREAMS % LB_SYNC == 0)
+      fs_sync();
+  }
+  b__report_bw("append", LB_SIZE * LB_STREAMS, b__now() - start);
+  printf("  %d device requests\n", vblk_stats().dispatched - reqs);
+
+  reqs = vblk_stats().dispatched;
+  start = b__now();
+  for (uint32 i=0; i<LB_STREAMS; i++) {
+    oft[fd[i]].head = 0;
+    for (uint32 off=0; off<LB_SIZE; off+=LB_APPEND)
+      fs_read(fd[i], buf, LB_APPEND);
+    fs_close(fd[i]);
+  }
+  b__report_bw("read  ", LB_SIZE * LB_STREAMS, b__now() - start);
+  printf("  %d device requests\n", vblk_stats().dispatched - reqs);
+}
+
+/*  Fill 'percent' of the log with a single file, then rewrite  *
+ *  single blocks of it at random until 'LB_CHURN' times the     *
+ *  log has been written.  Reports how many blocks the cleaner   *
+ *  copied for each block written.                               */
+static void bench_cleaner(char* buf, uint32 percent) {
+  uint32 nblocks, writes, seed = 1;
+  uint64 start, elapsed;
+  lfsstat_t s, e;
+  int32 fd;
+
+  fs_log_segblocks = FS_LOG_SEGBLOCKS;
+  if (b__remake_fs_bs(LB_BLOCKSZ, LB_BLOCKS) != 0 || !lfs_active() ||
+      fs_create("b__clean") == -1 || (fd = fs_open("b__clean")) == -1) {
+    printf("  could not set up the log\n");
+    fs_log_segblocks = 0;
+    return;
+  }
+  nblocks = fsd->nsegs * (fsd->segblocks - 1) * percent / 100;
+  for (uint32 i=0; i<nblocks; i++)
+    fs_write(fd, buf, LB_BLOCKSZ);
+  fs_sync();
+
+  s = lfs_stats();
+  writes = fsd->nsegs * fsd->segblocks * LB_CHURN;
+  start = b__now();
+  for (uint32 i=0; i<writes; i++) {
+    seed = seed * 1103515245 + 12345;
+    oft[fd].head = (seed >> 8) % nblocks * LB_BLOCKSZ;
+    if (fs_write(fd, buf, LB_BLOCKSZ) != LB_BLOCKSZ) {
+      printf("  the log filled up\n");
+      break;
+    }
+    if (i % 256 == 255)
+      fs_sync();
+  }
+  fs_close(fd);
+  fs_sync();
+  elapsed = b__now() - start;
+  e = lfs_stats();
+  printf("  %d%% full: %d writes in %d us", percent, writes, elapsed / 10);
+  printf(", %d segments cleaned, %d blocks copied (%d per 100 written)\n",
+         e.cleaned - s.cleaned, e.moved - s.moved,
+         (e.written > s.written ? (e.moved - s.moved) * 100 / (e.written - s.written) : 0));
+  fs_log_segblocks = 0;
+}
+
+void b__lfs(void) {
+  char* buf = malloc(LB_APPEND);
+  if (buf == NULL)
+    return;
+  memset(buf, 'l', LB_APPEND);
+
+  printf("\nLog-structured layout (%d files appended %d bytes at a time)\n", LB_STREAMS, LB_APPEND);
+  if (vblk_init() == 0) {
+    for (uint32 log=0; log<2; log++) {
+      fs_log_segblocks = (log ? FS_LOG_SEGBLOCKS : 0);
+      printf(" %s\n", log ? "log" : "in place");
+      if (b__remake_vdisk(LB_BLOCKSZ) != 0)
+        printf("  could not set up the device\n");
+      else
+        bench_append(buf);
+    }
+    fs_log_segblocks = 0;
+  }
+  else
+    printf(" virtio disk: none attached\n");
+
+  printf(" cleaner, random block rewrites on a %d block ramdisk\n", LB_BLOCKS);
+  bench_cleaner(buf, 50);
+  bench_cleaner(buf, 70);
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
@@ -0,0 +1,51 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <bench.h>
+
+#define GROW_STEP  16      /*  Bytes added to the buffer on every growth step  */
+#define GROW_LIMIT 16384   /*  Final size of the grown buffer                  */
+#define GROW_ROUNDS 8      /*  Number of times each growth pattern is repeated */
+
+/*  Time 'GROW_ROUNDS' buffer growths that use 'realloc'.  The   *
+ *  buffer is the last allocation on the heap so each step grows  *
+ *  in place into the free space that follows it.                 */
+static void bench_realloc(const char* name) {
+  uint64 start, ticks = 0, ops = 0;
+  char* buff;
+  for (int r=0; r<GROW_ROUNDS; r++) {
+    buff = malloc(GROW_STEP);
+    start = b__now();
+    for (uint64 sz=GROW_STEP*2; sz<=GROW_LIMIT; sz+=GROW_STEP, ops++)
+      buff = realloc(buff, sz);
+    ticks += b__now() - start;
+    free(buff);
+  }
+  b__report(name, ops, ticks);
+}
+
+/*  Time the same growth pattern done by allocating a new buffer,  *
+ *  copying the old contents and freeing the old buffer.           */
+static void bench_copy(const char* name) {
+  uint64 start, ticks = 0, ops = 0;
+  char *buff, *next;
+  for (int r=0; r<GROW_ROUNDS; r++) {
+    buff = malloc(GROW_STEP);
+    start = b__now();
+    for (uint64 sz=GROW_STEP*2; sz<=GROW_LIMIT; sz+=GROW_STEP, ops++) {
+      next = malloc(sz);
+      memcpy(next, buff, sz - GROW_STEP);
+      free(buff);
+      buff = next;
+    }
+    ticks += b__now() - start;
+    free(buff);
+  }
+  b__report(name, ops, ticks);
+}
+
+void b__malloc(void) {
+  printf("\nmalloc growth (%d -> %d bytes, step %d)\n", GROW_STEP, GROW_LIMIT, GROW_STEP);
+  bench_realloc("realloc in place");
+  bench_copy("malloc+copy+free");
+}
@@ -0,0 +1,82 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bench.h>
+
+#define MEM_MIN     1          /*  Smallest buffer size measured                  */
+#define MEM_MAX     65536      /*  Largest buffer size measured (64KiB)           */
+#define MEM_VOLUME  1048576    /*  Bytes moved per measurement (1MiB)             */
+#define STR_LEN     255        /*  Length of the strings used by the string tests */
+#define MAP_BITS    4096       /*  Bits in the bitmap searched by 'bitmap_scan'   */
+
+/*  The byte-at-a-time loops the library used before, kept as the baseline  */
+static void* byte_memcpy(void* dst, const void* src, int n) {
+  while (--n >= 0) ((char*)dst)[n] = ((char*)src)[n];
+  return dst;
+}
+
+static void* byte_memset(void* s, int c, int n) {
+  while (--n >= 0) ((char*)s)[n] = (char)c;
+  return s;
+}
+
+static int byte_strlen(const char* str) {
+  int length = 0;
+  while (str[length] != '\0')
+    length++;
+  return length;
+}
+
+/*  Repeat 'call' on 'sz' bytes until 'MEM_VOLUME' bytes were moved  */
+#define b__time(name, sz, call) do {                       \
+    uint64 _n = MEM_VOLUME / (sz), _start = b__now();      \
+    for (uint64 _i=0; _i<_n; _i++)                         \
+      call;                                                \
+    b__report_bw(name, _n * (sz), b__now() - _start);      \
+  } while (0)
+
+void b__memory(void) {
+  char *src = aligned_alloc(8, MEM_MAX + 8);
+  char *dst = aligned_alloc(8, MEM_MAX + 8);
+  char *str1 = malloc(STR_LEN + 1), *str2 = malloc(STR_LEN + 1);
+  uint64 start, ops = MEM_VOLUME / STR_LEN;
+
+  memset(src, 0x5a, MEM_MAX + 8);
+  for (uint64 sz=MEM_MIN; sz<=MEM_MAX; sz*=4) {
+    printf("\nmemory routines (%d bytes)\n", sz);
+    b__time("memcpy  byte loop", sz, byte_memcpy(dst, src, sz));
+    b__time("memcpy  aligned  ", sz, memcpy(dst, src, sz));
+    b__time("memcpy  unaligned", sz, memcpy(dst, src + 3, sz));
+    b__time("memmove overlap  ", sz, memmove(src + 5, src, sz));
+    b__time("memset  byte loop", sz, byte_memset(dst, 0, sz));
+    b__time("memset           ", sz, memset(dst, 0, sz));
+    memcpy(dst, src, sz);
+    b__time("memcmp  equal    ", sz, memcmp(dst, src, sz));
+    b__time("checksum         ", sz, checksum(src, sz));
+  }
+
+  memset(dst, 0xff, MAP_BITS / 8);
+  dst[MAP_BITS / 8 - 1] = 0x7f;
+  printf("\nbitmap scan (%d bits, last bit clear)\n", MAP_BITS);
+  b__time("bitmap_scan      ", MAP_BITS / 8, bitmap_scan((byte*)dst, 0, MAP_BITS, 0));
+
+  memset(str1, 'a', STR_LEN);
+  memset(str2, 'a', STR_LEN);
+  str1[STR_LEN] = str2[STR_LEN] = '\0';
+  printf("\nstring routines (%d bytes)\n", STR_LEN);
+  start = b__now();
+  for (uint64 i=0; i<ops; i++) byte_strlen(str1);
+  b__report("strlen byte loop", ops, b__now() - start);
+  start = b__now();
+  for (uint64 i=0; i<ops; i++) fs_strlen(str1);
+  b__report("fs_strlen       ", ops, b__now() - start);
+  start = b__now();
+  for (uint64 i=0; i<ops; i++) fs_strcmp(str1, str2);
+  b__report("fs_strcmp equal ", ops, b__now() - start);
+
+  free(str1);
+  free(str2);
+  free(src);
+  free(dst);
+}
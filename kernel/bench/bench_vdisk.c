@@ -0,0 +1,104 @@
+#include <barelib.h>
+#include <bareio.h>
+#include <malloc.h>
+#include <fs.h>
+#include <virtio.h>
+#include <bench.h>
+
+#define VD_BLOCKSZ  4096              /*  Block size of both devices                          */
+#define VD_BLOCKS   2048              /*  Blocks in each device (8 MiB)                       */
+#define VD_SPAN     512               /*  Blocks moved by each raw pass (2 MiB)               */
+#define VD_FILE     (2 * 1024 * 1024) /*  Size of the streamed file                           */
+#define VD_CHUNK    (64 * 1024)       /*  Bytes per 'fs_read'/'fs_write' call                 */
+
+/*  Replace the mounted file system with a fresh one on the virtio  *
+ *  disk, in blocks of 'blocksz' bytes.                             */
+int32 b__remake_vdisk(uint32 blocksz) {
+  fs_umount();
+  bs_free_ramdisk();
+  if (bs_mk_vdisk(blocksz) != 0)
+    return -1;
+  fs_mkfs();
+  return fs_mount();
+}
+
+/*  Move 'VD_SPAN' blocks past the metadata one block per call (a single  *
+ *  request in flight) and then FS_IOV_MAX blocks per 'bs_readv' or        *
+ *  'bs_writev' call (that many requests in flight on the virtio disk).    */
+static void bench_raw(char* buf, byte write) {
+  bsvec_t vec[FS_IOV_MAX];
+  uint32 first = VD_BLOCKS / 2;
+  uint64 start;
+
+  start = b__now();
+  for (uint32 i=0; i<VD_SPAN; i++) {
+    if (write)
+      bs_write(first + i, 0, buf + (i % FS_IOV_MAX) * VD_BLOCKSZ, VD_BLOCKSZ);
+    else
+      bs_read(first + i, 0, buf + (i % FS_IOV_MAX) * VD_BLOCKSZ, VD_BLOCKSZ);
+  }
+  b__report_bw(write ? "bs_write per block    " : "bs_read per block     ", (uint64)VD_SPAN * VD_BLOCKSZ, b__now() - start);
+
+  start = b__now();
+  for (uint32 i=0; i<VD_SPAN; i+=FS_IOV_MAX) {
+    for (uint32 j=0; j<FS_IOV_MAX; j++) {
+      vec[j].block = first + i + j;
+      vec[j].offset = 0;
+      vec[j].buf = buf + j * VD_BLOCKSZ;
+      vec[j].len = VD_BLOCKSZ;
+    }
+    if (write)
+      bs_writev(vec, FS_IOV_MAX);
+    else
+      bs_readv(vec, FS_IOV_MAX);
+  }
+  b__report_bw(write ? "bs_writev, 16 in flight" : "bs_readv, 16 in flight ", (uint64)VD_SPAN * VD_BLOCKSZ, b__now() - start);
+}
+
+/*  Write a 'VD_FILE' byte file in 'VD_CHUNK' calls, sync it and read it back  */
+static void bench_file(char* buf) {
+  uint64 start;
+  int32 fd;
+  if (fs_create("b__vdisk") == -1 || (fd = fs_open("b__vdisk")) == -1) {
+    printf("  could not create the file\n");
+    return;
+  }
+  start = b__now();
+  for (uint32 off=0; off<VD_FILE; off+=VD_CHUNK)
+    fs_write(fd, buf, VD_CHUNK);
+  fs_sync();
+  b__report_bw("fs_write + fs_sync     ", VD_FILE, b__now() - start);
+  oft[fd].head = 0;
+  start = b__now();
+  for (uint32 off=0; off<VD_FILE; off+=VD_CHUNK)
+    fs_read(fd, buf, VD_CHUNK);
+  b__report_bw("fs_read                ", VD_FILE, b__now() - start);
+  fs_close(fd);
+}
+
+static void run(const char* name, char* buf, byte vdisk) {
+  printf(" %s\n", name);
+  if ((vdisk ? b__remake_vdisk(VD_BLOCKSZ) : b__remake_fs_bs(VD_BLOCKSZ, VD_BLOCKS)) != 0) {
+    printf("  could not set up the device\n");
+    return;
+  }
+  bench_raw(buf, 1);
+  bench_raw(buf, 0);
+  bench_file(buf);
+}
+
+void b__vdisk(void) {
+  char* buf = malloc(VD_CHUNK);
+  printf("\nVirtio disk against the ramdisk (%d byte blocks)\n", VD_BLOCKSZ);
+  if (buf == NULL)
+    printf("  could not allocate the buffer\n");
+  else {
+    run("ramdisk", buf, 0);
+    if (vblk_init() != 0 || vblk_capacity() * VBLK_SECTOR_SIZE < (uint64)VD_BLOCKS * VD_BLOCKSZ)
+      printf(" virtio disk: none attached (or smaller than %d blocks)\n", VD_BLOCKS);
+    else
+      run("virtio disk", buf, 1);
+  }
+  free(buf);
+  b__remake_fs(MDEV_NUM_BLOCKS);
+}
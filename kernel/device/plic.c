@@ -7,10 +7,12 @@
 
 #include <barelib.h>
 #include <interrupts.h>
+#include <virtio.h>
 
 #define TRAP_EXTERNAL_ENABLE 0x800
-#define EXTERNAL_PENDING_ADDR 0xc001000
 #define EXTERNAL_THRESH_ADDR  0xc200000
+#define EXTERNAL_CLAIM_ADDR   0xc200004   /*  Claim/complete register of hart 0 in Machine mode  */
+#define UART_IRQ              10          /*  PLIC source of the NS16550 UART                    */
 
 extern void uart_handler(void);
 
@@ -28,11 +30,18 @@ void plic_init(void) {
 /* 
  * This function is automatically triggered whenver an external 
  * event occurs.  (see '__traps' in bootstrap.s)
+ * Every source waiting on the PLIC is claimed, handed to its
+ * device's handler and then marked complete.
  */
 interrupt handle_plic(void) {
-  uint32* plic_pending_addr = (uint32*)EXTERNAL_PENDING_ADDR;
-  if (*plic_pending_addr == 0x400)
+  volatile uint32* plic_claim_addr = (uint32*)EXTERNAL_CLAIM_ADDR;
+  uint32 source;
+  while ((source = *plic_claim_addr) != 0) {
+    if (source == UART_IRQ)
       uart_handler();
-  *plic_pending_addr = 0x0;
+    else if (vblk_present() && source == vblk_irq())
+      vblk_handler();
+    *plic_claim_addr = source;
+  }
 }
 
@@ -0,0 +1,444 @@
+/*
+ *  This file contains the driver for the virtio block device that QEMU's
+ *  'virt' machine offers on its virtio-mmio transports
+ *     (-drive if=none,id=x0,... -device virtio-blk-device,drive=x0).
+ *  Requests are placed on a single split virtqueue of VBLK_QSIZE
+ *  descriptors, a header, the data and a status byte per request, so that
+ *  many requests can be in flight at once.  Requests wait in the elevator
+ *  (see system/elevator.c) until there are descriptors for them, and while
+ *  the queue is plugged, which is where contiguous requests are merged.
+ *  Completions are reported through the PLIC (see 'handle_plic') and
+ *  'vblk_handler' completes the finished requests, running their
+ *  callbacks, and starts the waiting ones.
+ */
+
+#include <barelib.h>
+#include <interrupts.h>
+#include <malloc.h>
+#include <syscall.h>
+#include <virtio.h>
+
+#define VIRTIO_MMIO_BASE  0x10001000  /*  First of the virtio-mmio transports on 'virt'   */
+#define VIRTIO_MMIO_SIZE  0x1000      /*  Distance between two transports                 */
+#define VIRTIO_MMIO_COUNT 8           /*  Number of transports                            */
+#define VIRTIO_IRQ_BASE   1           /*  PLIC source of the first transport              */
+
+#define PLIC_PRIO_ADDR    0xc000000   /*  Priority of each PLIC source, one word each     */
+#define PLIC_ENABLE_ADDR  0xc002000   /*  Enable bits of hart 0 in Machine mode           */
+
+#define VIRTIO_MAGIC      0x74726976  /*  "virt"                                          */
+#define VIRTIO_DEV_BLOCK  2           /*  Device ID of a block device                     */
+
+#define R_MAGIC           0x000       /*                                                  */
+#define R_VERSION         0x004       /*                                                  */
+#define R_DEVICE_ID       0x008       /*                                                  */
+#define R_DEV_FEATURES    0x010       /*  Offsets of the registers of a virtio-mmio       */
+#define R_DEV_FEAT_SEL    0x014       /*  transport (version 2, the "modern" layout)      */
+#define R_DRV_FEATURES    0x020       /*                                                  */
+#define R_DRV_FEAT_SEL    0x024       /*                                                  */
+#define R_QUEUE_SEL       0x030       /*                                                  */
+#define R_QUEUE_NUM_MAX   0x034       /*                                                  */
+#define R_QUEUE_NUM       0x038       /*                                                  */
+#define R_QUEUE_READY     0x044       /*                                                  */
+#define R_QUEUE_NOTIFY    0x050       /*                                                  */
+#define R_INT_STATUS      0x060       /*                                                  */
+#define R_INT_ACK         0x064       /*                                                  */
+#define R_STATUS          0x070       /*                                                  */
+#define R_DESC_LOW        0x080       /*                                                  */
+#define R_DESC_HIGH       0x084       /*                                                  */
+#define R_AVAIL_LOW       0x090       /*                                                  */
+#define R_AVAIL_HIGH      0x094       /*                                                  */
+#define R_USED_LOW        0x0a0       /*                                                  */
+#define R_USED_HIGH       0x0a4       /*                                                  */
+#define R_CAPACITY        0x100       /*  Block device config: size in sectors (64-bit)   */
+
+#define S_ACKNOWLEDGE     0x1         /*                                                  */
+#define S_DRIVER          0x2         /*  Bits of the device status register              */
+#define S_DRIVER_OK       0x4         /*                                                  */
+#define S_FEATURES_OK     0x8         /*                                                  */
+
+#define F_BLK_RO          (1 << 5)    /*                                                  */
+#define F_BLK_SCSI        (1 << 7)    /*  Features this driver does not implement and     */
+#define F_BLK_WCE         (1 << 11)   /*  turns off                                       */
+#define F_BLK_MQ          (1 << 12)   /*                                                  */
+#define F_ANY_LAYOUT      (1 << 27)   /*                                                  */
+#define F_INDIRECT_DESC   (1 << 28)   /*                                                  */
+#define F_EVENT_IDX       (1 << 29)   /*                                                  */
+#define F_VERSION_1       0x1         /*  Bit 32, found in the second feature word        */
+
+#define D_NEXT            0x1         /*  Descriptor flags: chained to 'next'             */
+#define D_WRITE           0x2         /*                    written by the device          */
+
+typedef struct vqdesc {
+  uint64 addr;
+  uint32 len;
+  uint16 flags;
+  uint16 next;
+} vqdesc_t;
+
+typedef struct vqavail {
+  uint16 flags;
+  uint16 idx;
+  uint16 ring[VBLK_QSIZE];
+  uint16 unused;
+} vqavail_t;
+
+typedef struct vqused {
+  uint16 flags;
+  uint16 idx;
+  struct {
+    uint32 id;
+    uint32 len;
+  } ring[VBLK_QSIZE];
+  uint16 unused;
+} vqused_t;
+
+static volatile uint32* regs = NULL;        /*  Registers of the transport the disk is on       */
+static uint32 irq;                          /*  PLIC source of that transport                   */
+static uint64 capacity;                     /*  Size of the disk in sectors                     */
+static vqdesc_t* desc;                      /*  The three parts of the virtqueue, shared with   */
+static vqavail_t* avail;                    /*  the device                                      */
+static vqused_t* used;                      /*                                                  */
+static vblkreq_t* owner[VBLK_QSIZE];        /*  Request each head descriptor belongs to         */
+static uint16 freelist[VBLK_QSIZE];         /*  Stack of descriptors not in use                 */
+static uint32 nfree;                        /*                                                  */
+static uint16 lastused;                     /*  Next entry of 'used' to complete                */
+static uint32 plugged = 0;                  /*  Depth of 'vblk_plug' calls                      */
+static volatile uint32 busy = 0;            /*  Depth of 'enter' calls, see 'enter'             */
+static volatile byte deferred = 0;          /*  An interrupt was held back by 'busy'            */
+static vblkstat_t stats;                    /*  Counters reported by 'vblk_stats'               */
+
+static void reap(void);
+
+#define reg(r) (regs[(r) / sizeof(uint32)])
+#define barrier() __sync_synchronize()
+
+
+/*  Returns the registers of the first transport with a block device  *
+ *  attached, or NULL.  'irq' is set to the matching PLIC source.      */
+static volatile uint32* probe(void) {
+  volatile uint32* r;
+  for (uint32 i=0; i<VIRTIO_MMIO_COUNT; i++) {
+    r = (volatile uint32*)(uint64)(VIRTIO_MMIO_BASE + i * VIRTIO_MMIO_SIZE);
+    if (r[R_MAGIC / 4] == VIRTIO_MAGIC && r[R_VERSION / 4] == 2 && r[R_DEVICE_ID / 4] == VIRTIO_DEV_BLOCK) {
+      irq = VIRTIO_IRQ_BASE + i;
+      return r;
+    }
+  }
+  return NULL;
+}
+
+
+/*  Accept the features the device offers that this driver can do  *
+ *  without, returns -1 if the device does not agree to them.       */
+static int32 negotiate(void) {
+  uint32 features;
+
+  reg(R_DEV_FEAT_SEL) = 0;
+  features = reg(R_DEV_FEATURES);
+  features &= ~(F_BLK_RO | F_BLK_SCSI | F_BLK_WCE | F_BLK_MQ | F_ANY_LAYOUT | F_INDIRECT_DESC | F_EVENT_IDX);
+  reg(R_DRV_FEAT_SEL) = 0;
+  reg(R_DRV_FEATURES) = features;
+  reg(R_DEV_FEAT_SEL) = 1;
+  features = reg(R_DEV_FEATURES) & F_VERSION_1;
+  reg(R_DRV_FEAT_SEL) = 1;
+  reg(R_DRV_FEATURES) = features;
+  reg(R_STATUS) = S_ACKNOWLEDGE | S_DRIVER | S_FEATURES_OK;
+  return (reg(R_STATUS) & S_FEATURES_OK) ? 0 : -1;
+}
+
+
+/*  Allocate the three parts of the request queue and hand them to  *
+ *  the device.                                                     */
+static int32 setup_queue(void) {
+  char mask;
+
+  reg(R_QUEUE_SEL) = 0;
+  if (reg(R_QUEUE_READY) || reg(R_QUEUE_NUM_MAX) < VBLK_QSIZE)
+    return -1;
+  mask = disable_interrupts();                                 /*                                  */
+  desc = aligned_alloc(16, VBLK_QSIZE * sizeof(vqdesc_t));     /*  Descriptors must be 16 byte     */
+  avail = aligned_alloc(16, sizeof(vqavail_t));                /*  aligned, the rings less so      */
+  used = aligned_alloc(16, sizeof(vqused_t));                  /*                                  */
+  if (desc == NULL || avail == NULL || used == NULL) {         /*                                  */
+    free(desc);                                                /*                                  */
+    free(avail);                                               /*                                  */
+    free(used);                                                /*                                  */
+    restore_interrupts(mask);                                  /*                                  */
+    return -1;                                                 /*                                  */
+  }                                                            /*                                  */
+  heap_transfer(desc, M_KERNEL);                               /*  The queue is owned by the       */
+  heap_transfer(avail, M_KERNEL);                              /*  kernel                          */
+  heap_transfer(used, M_KERNEL);                               /*                                  */
+  restore_interrupts(mask);                                    /*                                  */
+
+  memset(desc, 0, VBLK_QSIZE * sizeof(vqdesc_t));
+  memset(avail, 0, sizeof(vqavail_t));
+  memset(used, 0, sizeof(vqused_t));
+  for (nfree=0; nfree<VBLK_QSIZE; nfree++)
+    freelist[nfree] = VBLK_QSIZE - 1 - nfree;
+  lastused = 0;
+  elv_init();
+
+  reg(R_QUEUE_NUM) = VBLK_QSIZE;
+  reg(R_DESC_LOW) = (uint64)desc;
+  reg(R_DESC_HIGH) = (uint64)desc >> 32;
+  reg(R_AVAIL_LOW) = (uint64)avail;
+  reg(R_AVAIL_HIGH) = (uint64)avail >> 32;
+  reg(R_USED_LOW) = (uint64)used;
+  reg(R_USED_HIGH) = (uint64)used >> 32;
+  reg(R_QUEUE_READY) = 1;
+  return 0;
+}
+
+
+/*
+ *  Brings up the block device following the virtio initialization sequence:
+ *  reset, negotiate features, hand the device the virtqueue and enable its
+ *  interrupt on the PLIC.  Must be called after 'uart_init' since both share
+ *  the PLIC enable word.
+ */
+int32 vblk_init(void) {
+  if (regs != NULL)
+    return 0;
+  if ((regs = probe()) == NULL)
+    return -1;
+
+  reg(R_STATUS) = 0;                                              /*  Reset the device and tell it  */
+  reg(R_STATUS) = S_ACKNOWLEDGE;                                  /*  it has been found and has a   */
+  reg(R_STATUS) = S_ACKNOWLEDGE | S_DRIVER;                       /*  driver                        */
+  if (negotiate() != 0 || setup_queue() != 0) {
+    reg(R_STATUS) = 0;
+    regs = NULL;
+    return -1;
+  }
+  capacity = reg(R_CAPACITY) | ((uint64)reg(R_CAPACITY + 4) << 32);
+
+  ((volatile uint32*)PLIC_PRIO_ADDR)[irq] = 1;                         /*  Enable the disk's      */
+  ((volatile uint32*)PLIC_ENABLE_ADDR)[irq / 32] |= 1 << (irq % 32);   /*  interrupt on the PLIC  */
+  reg(R_STATUS) = S_ACKNOWLEDGE | S_DRIVER | S_FEATURES_OK | S_DRIVER_OK;
+  return 0;
+}
+
+byte vblk_present(void) {
+  return regs != NULL;
+}
+
+uint64 vblk_capacity(void) {
+  return capacity;
+}
+
+uint32 vblk_irq(void) {
+  return irq;
+}
+
+
+/*  The queue is shared by the thread that submits and 'vblk_handler',  *
+ *  which runs in Machine mode and so is not held off by                *
+ *  'disable_interrupts'.  Code that changes the queue raises 'busy'    *
+ *  instead, an interrupt that arrives meanwhile only sets 'deferred'   *
+ *  and its work is done by 'leave' on the way out.                     */
+static void enter(void) {
+  busy++;
+  barrier();
+}
+
+static void leave(void) {
+  barrier();
+  while (--busy == 0 && deferred) {
+    busy++;
+    deferred = 0;
+    barrier();
+    reap();
+    barrier();
+  }
+}
+
+
+/*  Take requests out of the elevator while there are descriptors  *
+ *  for them, chain a header, one descriptor per merged segment and   *
+ *  the status byte for each, publish the chains on the available     *
+ *  ring and notify the device.  While the queue is plugged nothing   *
+ *  is started unless 'force' is set or the elevator is full.  Called *
+ *  inside 'enter'.                                                   */
+static void kick(byte force) {
+  vblkreq_t *req, *seg;
+  uint16 d, prev;
+  uint32 started = 0;
+
+  if (plugged && !force && elv_count() < VBLK_PLUG_MAX)
+    return;
+  while (nfree >= VBLK_MAX_SEGS + 2 && (req = elv_next()) != NULL) {
+    d = freelist[--nfree];
+    req->head = d;
+    owner[d] = req;
+    desc[d].addr = (uint64)&req->hdr;
+    desc[d].len = sizeof(req->hdr);
+    desc[d].flags = D_NEXT;
+    for (seg = req; seg != NULL; seg = seg->merged) {
+      prev = d;
+      d = freelist[--nfree];
+      desc[prev].next = d;
+      desc[d].addr = (uint64)seg->buf;
+      desc[d].len = seg->len;
+      desc[d].flags = D_NEXT | (req->hdr.type == VBLK_T_IN ? D_WRITE : 0);
+    }
+    prev = d;
+    d = freelist[--nfree];
+    desc[prev].next = d;
+    desc[d].addr = (uint64)&req->status;
+    desc[d].len = 1;
+    desc[d].flags = D_WRITE;
+    desc[d].next = 0;
+
+    avail->ring[(avail->idx + started++) % VBLK_QSIZE] = req->head;
+    stats.dispatched++;
+  }
+  if (started > 0) {
+    barrier();                                   /*  The entries must be visible before the index  */
+    avail->idx += started;
+    barrier();
+    reg(R_QUEUE_NOTIFY) = 0;
+    stats.kicks++;
+  }
+}
+
+
+/*  Complete every request the device has added to the used ring:  *
+ *  its descriptors are freed and it, and every request merged      *
+ *  into it, is marked done and has its callback run.  The freed    *
+ *  descriptors go to requests still waiting.                       */
+static void reap(void) {
+  vblkreq_t *req, *next;
+  uint16 d;
+  byte status;
+
+  while (lastused != used->idx) {
+    barrier();
+    d = used->ring[lastused % VBLK_QSIZE].id;
+    lastused++;
+    if ((req = owner[d]) == NULL)
+      continue;
+    owner[d] = NULL;
+    while (desc[d].flags & D_NEXT) {
+      freelist[nfree++] = d;
+      d = desc[d].next;
+    }
+    freelist[nfree++] = d;
+    status = req->status;
+    for (; req != NULL; req = next) {
+      next = req->merged;                        /*  The callback may submit 'req' again  */
+      req->status = status;
+      stats.completed++;
+      req->done = 1;
+      if (req->callback != NULL)
+        req->callback(req);
+    }
+  }
+  kick(0);
+}
+
+
+/*  Queue 'req' for the device.  It is started right away if the ring has  *
+ *  room, otherwise when earlier requests complete.  'req' must stay in    *
+ *  place until it is done.  Returns -1 if the request is not valid.       */
+int32 vblk_submit(vblkreq_t* req) {
+  if (regs == NULL || req->len == 0 || req->len % VBLK_SECTOR_SIZE != 0 ||
+      req->hdr.sector + req->len / VBLK_SECTOR_SIZE > capacity)
+    return -1;
+  req->hdr.reserved = 0;
+  req->status = 0xff;
+  req->done = 0;
+
+  enter();
+  elv_add(req);
+  stats.submitted++;
+  kick(0);
+  leave();
+  return 0;
+}
+
+
+/*  While plugged, submitted requests stay in the elevator where the  *
+ *  contiguous ones are merged.  They are started by the matching      *
+ *  'vblk_unplug', by waiting for one of them, or once VBLK_PLUG_MAX   *
+ *  of them are waiting.                                               */
+void vblk_plug(void) {
+  enter();
+  plugged++;
+  leave();
+}
+
+void vblk_unplug(void) {
+  enter();
+  if (plugged > 0)
+    plugged--;
+  kick(0);
+  leave();
+}
+
+
+/*  Wait for 'req' to complete and return 0 if the device reported  *
+ *  success.  The Machine mode interrupt is taken even while the     *
+ *  caller has interrupts disabled, so this may be used inside a     *
+ *  critical section.  Otherwise the processor is given to other     *
+ *  threads while waiting.                                           */
+int32 vblk_wait(vblkreq_t* req) {
+  if (!req->done && regs != NULL) {              /*  It may still be held back by a plug  */
+    enter();
+    kick(1);
+    leave();
+  }
+  while (!req->done) {
+    if (is_interrupting())
+      raise_syscall(RESCHED);
+  }
+  return req->status == 0 ? 0 : -1;
+}
+
+
+/*  Queue the 'n' requests of 'reqs' and wait for all of them.  They  *
+ *  are queued under a plug so the contiguous ones are merged, and the *
+ *  device has as many in flight as its queue has room for.  Returns   *
+ *  -1 if any of them failed.                                          */
+int32 vblk_rw(vblkreq_t* reqs, uint32 n) {
+  uint32 sent;
+  int32 result = 0;
+
+  vblk_plug();
+  for (sent=0; sent<n; sent++) {
+    reqs[sent].callback = NULL;
+    if (vblk_submit(&reqs[sent]) != 0) {
+      result = -1;
+      break;
+    }
+  }
+  vblk_unplug();
+  for (uint32 i=0; i<sent; i++)
+    if (vblk_wait(&reqs[i]) != 0)
+      result = -1;
+  return result;
+}
+
+
+vblkstat_t vblk_stats(void) {
+  return stats;
+}
+
+
+/*
+ *  Called by 'handle_plic' when the disk raises its interrupt.  Requests
+ *  are completed from here unless the interrupted code is changing the
+ *  queue, see 'enter'.
+ */
+void vblk_handler(void) {
+  reg(R_INT_ACK) = reg(R_INT_STATUS) & 0x3;
+  stats.interrupts++;
+  if (busy) {
+    deferred = 1;
+    return;
+  }
+  enter();
+  reap();
+  leave();
+}
@@ -0,0 +1,33 @@
+#ifndef H_ARENA
+#define H_ARENA
+
+#include <barelib.h>
+#include <malloc.h>
+
+#define ARENA_CHUNK_SZ 4096  /*  Default number of usable bytes in each arena chunk  */
+#define ARENA_ALIGN    8     /*  Alignment of every pointer returned by 'arena_alloc'  */
+
+/*  An arena is a list of 'malloc'ed chunks that are handed out with  *
+ *  a bump pointer.  Individual allocations are never freed, instead  *
+ *  the whole arena is rewound with 'arena_reset' (chunks are kept    *
+ *  for reuse) or released with 'arena_destroy'.                      */
+typedef struct _arena_chunk {
+  struct _arena_chunk* next;   /*  The next chunk in the arena (NULL if last)      */
+  uint64 size;                 /*  The number of usable bytes following the chunk  */
+} arena_chunk_t;
+
+typedef struct _arena {
+  arena_chunk_t* head;   /*  The first chunk in the arena                      */
+  arena_chunk_t* curr;   /*  The chunk allocations are currently taken from    */
+  uint64 used;           /*  The number of bytes already consumed in 'curr'    */
+  uint64 chunksz;        /*  The minimum size of newly allocated chunks        */
+} arena_t;
+
+
+/*  arena related prototypes  */
+void  arena_init(arena_t*, uint64);     /*  Prepare an empty arena (no memory is allocated)  */
+void* arena_alloc(arena_t*, uint64);    /*  Bump allocate from the arena                     */
+void  arena_reset(arena_t*);            /*  Release every allocation, keep the chunks        */
+void  arena_destroy(arena_t*);          /*  Return every chunk to the heap                   */
+
+#endif
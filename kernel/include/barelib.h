@@ -21,6 +21,17 @@ typedef __builtin_va_list va_list;    /*
 
 int32 raise_syscall(uint32);          /*  Ask the operating system to run a low level system function  */
 
+void* memset(void*, int, int);                 /*                                             */
+void* memcpy(void*, const void*, int);         /*  Word-at-a-time memory routines, see        */
+void* memmove(void*, const void*, int);        /*  'lib/barelib.c'                            */
+int32 memcmp(const void*, const void*, int);   /*                                             */
+uint32 checksum(const void*, int);             /*  32-bit sum of a buffer's words             */
+int32 bitmap_scan(const byte*, int32, int32, byte);  /*  Index of the first bit set/clear or -1  */
+uint32 ctz64(uint64);                          /*  Count trailing zero bits                   */
+void mem_init(uint64);                         /*  Pick scalar or vector routines from 'misa' */
+byte mem_has_vector(void);                     /*  Returns 1 if the vector routines are used  */
+
 void uart_init(void);
 
 extern uint32 boot_complete;
+extern uint64 boot_misa;              /*  Value of 'misa' read by the bootstrap in Machine mode  */
@@ -0,0 +1,52 @@
+#ifndef H_BCACHE
+#define H_BCACHE
+
+#include <barelib.h>
+#include <fs.h>
+
+#define BC_NBUFS  32            /* Number of block buffers in the cache                        */
+#define BC_HASHSZ 64            /* Number of hash buckets used to look buffers up by block     */
+
+/* A 'bcbuf_t' holds the contents of one block of the block device.  Buffers with a non-zero  *
+ * 'refcount' are in use and are never evicted.  'referenced' is the second-chance bit of the  *
+ * CLOCK replacement policy.  A 'pinned' buffer is part of a journal transaction that has not   *
+ * committed yet (see system/journal.c) and is not written back until it is unpinned.          */
+typedef struct bcbuf {
+  uint32 block;                 /* Index of the block held in 'data' (EMPTY if unused)            */
+  uint32 refcount;              /* Number of callers currently holding the buffer                 */
+  char valid;                   /* Set once 'data' matches (or supersedes) the block device       */
+  char dirty;                   /* Set when 'data' has changes not yet written to the device      */
+  char referenced;              /* Set on every access, cleared as the CLOCK hand passes          */
+  char pinned;                  /* Held back from write back by the running journal transaction  */
+  struct bcbuf* hnext;          /* Next buffer in the same hash bucket                            */
+  char* data;                   /* 'blocksz' bytes of block contents                              */
+} bcbuf_t;
+
+/* 'bcstat_t' is a snapshot of the cache counters filled in by 'bc_stats'  */
+typedef struct bcstat {
+  uint64 hits;                  /* Lookups satisfied from the cache                         */
+  uint64 misses;                /* Lookups that had to claim a buffer                       */
+  uint64 evictions;             /* Valid buffers reused for a different block               */
+  uint64 writebacks;            /* Dirty buffers written to the block device                */
+  uint32 nbufs;                 /* Number of buffers in the cache                           */
+  uint32 dirty;                 /* Number of buffers currently dirty                        */
+} bcstat_t;
+
+int32 bc_init(uint32);                          /* Allocate the buffers and clear the cache        */
+void bc_destroy(void);                          /* Write back and release every buffer             */
+bcbuf_t* bc_get(uint32, byte);                  /* Hold the buffer for a block, reading it if asked */
+void bc_put(bcbuf_t*, byte);                    /* Release a held buffer, optionally marking dirty */
+void bc_pin(bcbuf_t*, byte);                    /* Hold a buffer back from write back, or release it */
+void bc_discard(uint32);                        /* Drop a freed block without writing it back      */
+int32 bc_read(uint32, uint32, void*, uint32);   /* Read part of a block through the cache          */
+int32 bc_write(uint32, uint32, void*, uint32);  /* Write part of a block into the cache            */
+int32 bc_fill(uint32, byte);                    /* Set every byte of a block, without reading it   */
+int32 bc_read_blocks(uint32, uint32, void*);   /* Read a run of whole blocks, bypassing the cache */
+int32 bc_write_blocks(uint32, uint32, void*);  /* Write a run of whole blocks past the cache      */
+int32 bc_readv(bsvec_t*, uint32);              /* Read a list of segments in one request          */
+int32 bc_writev(bsvec_t*, uint32);             /* Write a list of segments in one request         */
+int32 bc_sync_block(uint32);                    /* Write a single block back if it is dirty        */
+int32 bc_flush(void);                           /* Write every dirty buffer back                   */
+bcstat_t bc_stats(void);                        /* Get the cache counters                          */
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef H_BENCH
+#define H_BENCH
+
+#include <barelib.h>
+
+/* Helpers shared by the benchmark suites in kernel/bench ('make bench') */
+
+uint64 b__now(void);                             /* Current 'mtime' tick                                  */
+void  b__report(const char*, uint64, uint64);    /* Print the cost of a number of operations              */
+void  b__report_bw(const char*, uint64, uint64); /* Print the throughput of a transfer                    */
+int32 b__remake_fs(uint32);                      /* Mount a fresh FS on a ramdisk of a number of blocks   */
+int32 b__remake_fs_bs(uint32, uint32);           /* Same with a given block size                          */
+int32 b__remake_vdisk(uint32);                   /* Mount a fresh FS on the virtio disk                   */
+
+#endif
@@ -2,18 +2,35 @@
 #define H_FS
 
 #include <barelib.h>
+#include <virtio.h>
 
 #define EMPTY     -1            /* Used in FS whenever a field's state is undefined or unused */
+#define INLINE_DATA -2          /* 'blocks[0]' of a file whose data is kept in its inode block */
 
 #define SB_BIT 0                /* Alias for the super block index                            */
 #define BM_BIT 1                /* Alias for the bitmask block index                          */
+#define ROOT_DIR SB_BIT         /* "Inode block" of the root directory, kept in the super block */
 
 #define FILENAME_LEN 16         /* Maximum length of a filename in the FS                     */
-#define DIR_SIZE     16         /* Maximum number of files referenced in the root direcotry   */
+#define DIR_HASH_MIN 32         /* Smallest directory name index (a power of 2)               */
+#define DIR_NEG_CACHE 8         /* Names remembered as missing from a directory               */
 
-#define INODE_BLOCKS    12      /* Maximum number of blocks associated with each file inode   */
-#define MDEV_BLOCK_SIZE 512     /* Size of each block in bytes                                */
+#define DT_FILE 0               /* 'dirent_t' type of a regular file                          */
+#define DT_DIR  1               /* 'dirent_t' type of a directory                             */
+
+#define INODE_BLOCKS    12      /* Number of direct block pointers in each file inode         */
+#define MDEV_BLOCK_SIZE 512     /* Default size of each block in bytes                        */
 #define MDEV_NUM_BLOCKS 512     /* Number of blocks in the block device                       */
+#define MIN_BLOCK_SIZE  512     /* Smallest block size a block device can be made with        */
+#define MAX_BLOCK_SIZE  65536   /* Largest block size (block sizes are powers of 2)           */
+
+/* The block size is chosen when the block device is made and recorded in the super block, the  *
+ * sizes below follow it at run time and are only valid while a file system is mounted.         */
+#define FS_BLOCK_SIZE (fsd->device.blocksz)                                    /* Block size of the FS        */
+#define INODE_PTRS (FS_BLOCK_SIZE / sizeof(uint32))                           /* Pointers per indirect block */
+#define INODE_MAX_BLOCKS (INODE_BLOCKS + INODE_PTRS + INODE_PTRS * INODE_PTRS)  /* Largest file in blocks  */
+#define DIR_PER_BLOCK (FS_BLOCK_SIZE / sizeof(dirent_t))                       /* Entries per directory block */
+#define DIR_SIZE (DIR_PER_BLOCK * INODE_MAX_BLOCKS)                            /* Most files in the root dir  */
 
 #define FSTATE_CLOSED 0         /* Used when opening and closing files to indicate the state  */
 #define FSTATE_OPEN   1         /*     of the slot in the open file table.                    */
@@ -23,29 +40,56 @@
 #define SEEK_END   1            /* Used in `fs_seek`, count down from the end of the file     */
 #define SEEK_HEAD  2            /* Used in `fs_seek`, move head relative to the current head  */
 
+#define FS_FLUSH_TICKS 100      /* Timer ticks between two runs of the metadata flusher       */
+#define FS_ALLOC_WINDOW 32      /* Free blocks a file looks for when it has to start a new run */
+#define FS_JOURNAL_BLOCKS 128   /* Size of the metadata journal 'fs_mkfs' makes when asked to   */
+#define FS_LOG_SEGBLOCKS 32     /* Segment size of the log 'fs_mkfs' makes when asked to        */
+#define FS_INLINE_MAX 448       /* Largest file 'fs_mkfs' keeps in its inode block when asked to */
+#define FS_DELAY_BLOCKS 64      /* File blocks an open file holds back with 'fs_delay_alloc' set */
+
+#define BMAP_LOOKUP 0           /* 'fs_bmap' only looks up blocks that are already mapped     */
+#define BMAP_ALLOC  1           /* 'fs_bmap' allocates missing blocks after the previous one  */
+#define BMAP_META   2           /* 'fs_bmap' allocates missing blocks from the device's top   */
+#define BMAP_LOG    3           /* 'fs_bmap' moves the block to the head of the log            */
+#define FS_IOV_MAX  16          /* Segments 'fs_read' and 'fs_write' gather into one request  */
+
+#define MASK_LOADED 0x1         /* 'maskstate': the bitmask block has been read from the device */
+#define MASK_DIRTY  0x2         /* 'maskstate': the bitmask block has changes not yet written   */
+
 
 /* 'inode_t' are stored in the block device and contain all of the information needed by the             *
- * file system to read and write to/from a given file.  Each file has a single 'inode'.                  */
+ * file system to read and write to/from a given file.  Each file has a single 'inode'.  The first        *
+ * INODE_BLOCKS blocks of a file are listed in the inode itself, the next INODE_PTRS in the 'indirect'    *
+ * block and the rest in the blocks listed by the 'dindirect' block (see lib/fs_bmap.c).  A file of     *
+ * at most 'inlinemax' bytes may instead keep its data in the rest of the inode block, right after the    *
+ * 'inode_t', with INLINE_DATA in 'blocks[0]' (see lib/fs_inline.c).                                      */
 typedef struct inode {
   uint32 id;                      /* Unique 'id' of the inode, corresponds with the block index          */
   uint32 size;                    /* The size of the file in bytes                                       */
   uint32 blocks[INODE_BLOCKS];    /* An array containing the indices of the blocks allocated to the file */
+  uint32 indirect;                /* Block holding the next INODE_PTRS block indices (or EMPTY)          */
+  uint32 dindirect;               /* Block holding indices of further indirect blocks (or EMPTY)         */
 } inode_t;
 
 
-/* The root directory contains DIR_SIZE directory entries.  This 'dirent_t' contains the metadata  *
- * necessary for mapping filenames to file inodes.                                                 */
+/* A directory holds up to DIR_SIZE directory entries.  This 'dirent_t' contains the metadata     *
+ * necessary for mapping filenames to file (or subdirectory) inodes.  Unused entries have an EMPTY *
+ * 'inode_block'.                                                                                  */
 typedef struct dirent {
   uint32 inode_block;            /* The index of the block containing the inode for this file */
   char name[FILENAME_LEN];       /* The name associated with this file in a directory         */
+  byte type;                     /* DT_FILE or DT_DIR                                         */
 } dirent_t;
 
 
-/* The root directory is represented as a 'directory_t' structure in the file system.  It contains *
- * the list of entries in the direcotory.                                                          */
+/* The root directory is represented as a 'directory_t' structure in the file system.  Its entries *
+ * are kept DIR_PER_BLOCK to a block in the blocks of 'inode', which are allocated as the directory *
+ * grows (see lib/fs_dir.c).  Entries are only ever appended, entry 'i' is in directory block      *
+ * 'i / DIR_PER_BLOCK'.  Subdirectories are laid out the same way, but their inode has a block of  *
+ * its own like the inode of a file.                                                               */
 typedef struct directory {
-  uint32 numentries;             /* The number of entries used in the directory   */
-  dirent_t entry[DIR_SIZE];      /* An array of 'dirent_t' containing the entries */
+  uint32 numentries;             /* The number of entries used in the directory (recounted on mount) */
+  inode_t inode;                 /* Maps the directory blocks, 'size' covers every allocated block   */
 } directory_t;
 
 
@@ -55,6 +99,29 @@ typedef struct bdev {
   uint32 blocksz;                /* The size of each block in bytes                */
 } bdev_t;
 
+/* A 'bsvec_t' is one segment of a vectored transfer ('bs_readv' and 'bs_writev').  The segment    *
+ * covers 'len' bytes starting 'offset' bytes into 'block' and may run on into the blocks after it. */
+typedef struct bsvec {
+  uint32 block;                  /* First block of the segment                     */
+  uint32 offset;                 /* Byte offset into 'block' the segment starts at  */
+  void* buf;                     /* Memory the segment is read into or written from */
+  uint32 len;                    /* Number of bytes in the segment                 */
+} bsvec_t;
+
+
+/* A 'bsreq_t' is one asynchronous transfer of a segment (see 'bs_submit').  The caller fills in   *
+ * 'seg', 'write' and 'callback' and owns the request again once 'done' is set.  On the virtio     *
+ * disk 'callback' runs from the interrupt handler and has the same limits as a 'vblkreq_t' one.  */
+typedef struct bsreq {
+  bsvec_t seg;                   /* The segment to move                            */
+  byte write;                    /* 1 to write 'seg' to the device, 0 to read it    */
+  void (*callback)(struct bsreq*);  /* Run when the request completes (or NULL)    */
+  void* arg;                     /* Left for the owner of the request              */
+  volatile byte done;            /* Set once the transfer has finished             */
+  int32 result;                  /* 0 if the transfer succeeded, -1 otherwise      */
+  vblkreq_t io;                  /* Request passed to the virtio disk              */
+} bsreq_t;
+
 
 /* The 'fsystem_t' is the master record that directly or indirectly contains all of the information *
  * about the file system.  In bareOS, there is one 'fsystem_t' instance called 'fsd'                *
@@ -62,7 +129,22 @@ typedef struct bdev {
 typedef struct fsystem {
   bdev_t device;                 /* The 'bdev_t' the describes the FS's block device                  */
   uint32 freemasksz;             /* The size of the bitmask storing the free/used bits for each block */
+  uint32 maskblock;              /* First of the blocks holding the free bitmask on the device        */
+  uint32 maskblocks;             /* Number of blocks the free bitmask takes on the device             */
+  uint32 journal;                /* First block of the metadata journal (see system/journal.c)        */
+  uint32 jblocks;                /* Number of blocks in the journal, 0 if the FS has none             */
+  uint32 imap;                   /* First block of the inode map of a log-structured FS (see lfs.c)   */
+  uint32 imapblocks;             /* Number of blocks in the inode map, 0 if files are kept in place   */
+  uint32 log;                    /* First block of the first segment of the log                       */
+  uint32 nsegs;                  /* Number of segments in the log                                     */
+  uint32 segblocks;              /* Blocks in each segment, its summary block included                */
+  uint32 loghead;                /* Block the log carries on at, as of the last checkpoint            */
+  uint32 inlinemax;              /* Largest file kept in its inode block, 0 if files never are        */
   char* freemask;                /* A pointer to the free bitmask, each bit corresponds to a block    */
+  byte* maskstate;               /* MASK_LOADED and MASK_DIRTY for each block of the free bitmask     */
+  uint32 freeblocks;             /* Number of clear bits in the free bitmask (saved with the bitmask) */
+  uint32 nextfit;                /* Block at which the next allocation starts searching               */
+  char maskdirty;                /* Set when 'freemask' has changes not yet written to the device     */
   directory_t root_dir;          /* The 'directory_t' that stores the root directory information      */
 } fsystem_t;
 
@@ -71,21 +153,60 @@ typedef struct fsystem {
  * Each entry is associated with a file when it is opened and removed with it is closed.              */
 typedef struct filetable {
   char state;                    /* The current state of the entry, either FSTATE_OPEN or FSTATE_CLOSED */
+  char dirty;                    /* Set when 'inode' has changes not yet written to the block device    */
   uint32 head;                   /* The byte in the file at which the next operation is performed       */
   uint32 direntry;               /* A reference to the directory entry where the file came from (index) */
+  uint32 parent;                 /* Inode block of the directory holding that entry (or ROOT_DIR)       */
   inode_t inode;                 /* A copy of the inode of the file (read from the block device)        */
+  char* held;                    /* Data of file blocks not given a device block yet, or NULL           */
+  uint32 hfirst;                 /* File block the first of them is for (see lib/fs_delay.c)            */
+  uint32 hcount;                 /* Number of file blocks held in 'held'                                */
 } filetable_t;
 
+/* 'dirstat_t' holds the counters of the dentry cache (see lib/fs_lookup.c)  */
+typedef struct dirstat {
+  uint64 lookups;                /* Calls to 'fs_lookup', one per path component               */
+  uint64 hits;                   /* Lookups answered without reading a directory block         */
+  uint64 misses;                 /* Lookups that had to read their directory into the cache    */
+  uint64 neghits;                /* Lookups answered by the negative cache                     */
+  uint64 probes;                 /* Cache slots examined by all lookups                        */
+  uint64 dirblocks;              /* Directory blocks read to fill the cache                    */
+  uint64 rebuilds;               /* Times the cache was dropped and started over               */
+} dirstat_t;
+
 /* Function prototypes used in the file system */
 bdev_t bs_stats(void);                          /* Get statistics about the block device       */
 uint32 bs_mk_ramdisk(uint32, uint32);           /* Build the block device                      */
+uint32 bs_mk_vdisk(uint32);                     /* Use the virtio disk as the block device      */
 uint32 bs_free_ramdisk(void);                   /* Free resources associated with block device */
 uint32 bs_read(uint32, uint32, void*, uint32);  /* Read a block from the block device          */
 uint32 bs_write(uint32, uint32, void*, uint32); /* Write a block to the block device           */
+uint32 bs_read_blocks(uint32, uint32, void*);   /* Read a run of whole blocks                  */
+uint32 bs_write_blocks(uint32, uint32, void*);  /* Write a run of whole blocks                 */
+uint32 bs_readv(bsvec_t*, uint32);              /* Read a list of segments in one request      */
+uint32 bs_writev(bsvec_t*, uint32);             /* Write a list of segments in one request     */
+uint32 bs_submit(bsreq_t*);                     /* Start a transfer without waiting for it     */
+int32  bs_wait(bsreq_t*);                       /* Wait for a submitted transfer to complete   */
+void   bs_plug(void);                           /* Hold writes back so they can be merged      */
+int32  bs_unplug(void);                         /* Send the held writes and wait for them      */
 
 void   fs_setmaskbit(uint32);                   /* Mark a block as used                        */
 void   fs_clearmaskbit(uint32);                 /* Mark a block as unused                      */
 uint32 fs_getmaskbit(uint32);                   /* Get the state of a block                    */
+int32  fs_alloc_block(void);                    /* Mark a free block as used and return it     */
+int32  fs_alloc_run(uint32);                    /* Same for a run of contiguous blocks         */
+int32  fs_alloc_goal(uint32);                   /* Allocate a block, preferring the given one  */
+int32  fs_alloc_extent(uint32, uint32, uint32*);  /* Allocate a run for data held back     */
+int32  fs_maskio(uint32, byte);                 /* Read or write a block of the free bitmask   */
+int32  fs_alloc_high(void);                     /* Allocate the highest free block             */
+uint32 fs_bmap(inode_t*, uint32, byte, char*);  /* Map a file block to a device block          */
+uint32 fs_bmap_run(inode_t*, uint32, uint32, byte, char*, uint32*);  /* Same for contiguous blocks */
+uint32 fs_bmap_place(inode_t*, uint32, uint32, char*);              /* Map a block already allocated */
+int32  fs_inline_write(inode_t*, uint32, char*, uint32, char*);     /* Write a small file in its inode */
+uint32 fs_inline_read(inode_t*, uint32, char*, uint32);             /* Read a file kept in its inode   */
+int32  fs_delay_write(uint32, uint32, char*, uint32);              /* Hold a write back from the device */
+int32  fs_delay_flush(uint32);                                     /* Place and write what a file holds */
+uint32 fs_delay_reserved(void);                                    /* Blocks set aside for what is held */
 
 void fs_mkfs(void);                             /* Save the super block and bitmask for the FS */
 uint32 fs_mount(void);                          /* Build the structures for the file system    */
@@ -97,9 +218,28 @@ void fs_print_oft(void);                        /* Print information contained i
 void fs_print_root(void);                       /* Print the contents of the root directory        */
 void fs_print_fd(int32 fd);                    /* Print information about a specific open file    */
 
+inode_t* fs_dir_inode(uint32, inode_t*);        /* Get the inode of a directory                  */
+int32 fs_dir_get(inode_t*, uint32, dirent_t*);  /* Read an entry of a directory                   */
+int32 fs_dir_put(inode_t*, uint32, dirent_t*);  /* Write an entry, growing the directory         */
+uint32 fs_dir_count(inode_t*);                  /* Count the entries stored in a directory       */
+int32 fs_lookup(uint32, const char*, dirent_t*); /* Find a name in a directory                   */
+int32 fs_dir_entries(uint32);                   /* Number of entries in a directory              */
+void  fs_dir_added(uint32, uint32, dirent_t*);  /* Add a new directory entry to the dentry cache  */
+void  fs_dir_init(void);                        /* Start with an empty dentry cache              */
+void  fs_dir_release(void);                     /* Free the dentry cache                         */
+dirstat_t fs_dir_stats(void);                   /* Get the dentry cache counters                 */
+int32 fs_walk(const char*, uint32*, char*);     /* Find the directory and last name of a path    */
+int32 fs_mknod(char*, byte);                    /* Create a file or directory at a path          */
 int32 fs_create(char*);                         /* Create a file and save it to the block device */
+int32 fs_mkdir(char*);                          /* Create a directory                            */
 int32 fs_open(char*);                           /* Open a file                                   */
 int32 fs_close(int32);                         /* Close a file                                  */
+uint32 fs_read(uint32, char*, uint32);         /* Read from an open file at its head            */
+uint32 fs_write(uint32, char*, uint32);        /* Write to an open file at its head             */
+uint32 fs_seek(uint32, uint32, uint32);        /* Move the head of an open file                 */
+int32 fs_sync(void);                           /* Write all dirty metadata to the block device  */
+int32 fs_flush_freemask(void);                 /* Write the free bitmask if it is dirty         */
+byte  fs_flusher(char*);                       /* Thread that periodically calls 'fs_sync'      */
 
 //added for filename operations
 int32 fs_strcmp(const char* str1, const char* str2);
@@ -108,6 +248,12 @@ int fs_strlen(const char* str);
 
 extern fsystem_t* fsd;
 extern filetable_t oft[NUM_FD];
+extern uint32 fs_alloc_window;
+extern uint32 fs_journal_blocks;
+extern uint32 fs_log_segblocks;
+extern uint32 fs_inline_max;
+extern byte fs_delay_alloc;
+extern byte fs_mask_lazy;
 
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef H_JOURNAL
+#define H_JOURNAL
+
+#include <barelib.h>
+#include <fs.h>
+
+#define JNL_MAGIC    0x4a4e4c48  /* 'magic' of the journal header block ("JNLH")                   */
+#define JNL_DESC     0x4a4e4c44  /* 'magic' of a transaction's descriptor block ("JNLD")           */
+#define JNL_TXN_MAX  16          /* Blocks one transaction logs before it is committed anyway      */
+#define JNL_OP_MAX   6           /* Blocks a single operation is expected to log                   */
+#define JNL_TXN_LIMIT (JNL_TXN_MAX + JNL_OP_MAX)  /* Most blocks of a transaction, operations ending   */
+                                                  /* it may take it past JNL_TXN_MAX                  */
+#define JNL_MIN      (2 * (JNL_TXN_MAX + 1) + 1)  /* Smallest journal 'fs_mkfs' makes              */
+
+/* The first block of the journal holds a 'jnlhdr_t'.  'sequence' is the number of the first   *
+ * transaction logged since the journal was last emptied, which is written right after it.     */
+typedef struct jnlhdr {
+  uint32 magic;                  /* JNL_MAGIC                                        */
+  uint32 sequence;               /* Transaction expected in the block after this one */
+} jnlhdr_t;
+
+/* A transaction is a 'jnldesc_t' block followed by 'count' block images.  'blocks' lists where   *
+ * each image belongs on the device and 'checksum' covers the images, a transaction whose images *
+ * do not add up was not written completely and ends the journal.                                */
+typedef struct jnldesc {
+  uint32 magic;                  /* JNL_DESC                                         */
+  uint32 sequence;               /* Number of the transaction                        */
+  uint32 count;                  /* Block images that follow the descriptor          */
+  uint32 checksum;               /* 'checksum' of the images added together          */
+  uint32 blocks[];               /* Home block of each image                         */
+} jnldesc_t;
+
+/* 'jnlstat_t' holds the counters of the journal (see 'jnl_stats')  */
+typedef struct jnlstat {
+  uint64 ops;                    /* Operations covered by the committed transactions */
+  uint64 commits;                /* Transactions written to the journal              */
+  uint64 logged;                 /* Block images written by those transactions       */
+  uint64 checkpoints;            /* Times the journal was emptied                    */
+  uint64 replayed;               /* Transactions replayed when mounting              */
+} jnlstat_t;
+
+void  jnl_format(uint32);                       /* Write an empty journal when making the FS      */
+int32 jnl_init(void);                           /* Replay the journal and start logging to it     */
+void  jnl_release(void);                        /* Commit, empty the journal and stop logging     */
+byte  jnl_active(void);                         /* Returns 1 while metadata goes through a journal */
+void  jnl_begin(void);                          /* Start an operation, which commits as a whole   */
+void  jnl_end(void);                            /* End it, committing if a commit is waiting      */
+int32 jnl_write(uint32, uint32, void*, uint32); /* Write metadata into the running transaction    */
+int32 jnl_commit(void);                         /* Write the running transaction to the journal   */
+jnlstat_t jnl_stats(void);                      /* Get the journal counters                       */
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef H_LFS
+#define H_LFS
+
+#include <barelib.h>
+#include <fs.h>
+
+#define LFS_MIN_SEGS     8           /* Fewest segments 'fs_mkfs' makes a log with                  */
+#define LFS_CLEAN_RESERVE 2          /* Clean segments kept for the cleaner to copy live blocks to  */
+#define LFS_CLEAN_BATCH  4           /* Segments cleaned past the reserve when the log runs short  */
+#define LFS_CLEAN_IDLE   4           /* The cleaner thread keeps 1/LFS_CLEAN_IDLE of the log clean */
+#define LFS_CLEAN_SLACK  (NUM_FD + 4)  /* Log blocks the cleaner leaves for the inodes it changed  */
+
+#define LFS_SUM_INODE 0xfffffffe     /* 'lfssum_t' index of an inode block                         */
+#define LFS_SUM_IND   0xfffffffd     /* 'lfssum_t' index of the 'indirect' block of the inode      */
+#define LFS_SUM_DIND  0xfffffffc     /* 'lfssum_t' index of the 'dindirect' block of the inode     */
+#define LFS_SUM_IND2  0x80000000     /* Plus the slot in 'dindirect' of a second level indirect    */
+
+/* The first block of each segment is its summary, one 'lfssum_t' for every block of the segment  *
+ * naming the file it was written for and what it held.  The cleaner checks the entry against the *
+ * file's current mapping to tell whether the block is still live.  Unused entries are all EMPTY. */
+typedef struct lfssum {
+  uint32 ino;                    /* Inode number of the owning file                  */
+  uint32 index;                  /* File block index, or one of LFS_SUM_*            */
+} lfssum_t;
+
+/* 'lfsstat_t' holds the counters of the log (see 'lfs_stats')  */
+typedef struct lfsstat {
+  uint64 written;                /* Blocks appended to the log for file data and indirect blocks */
+  uint64 inodes;                 /* Inode blocks appended to the log                 */
+  uint64 segments;               /* Segments the log moved on to                     */
+  uint64 cleaned;                /* Segments emptied by the cleaner                  */
+  uint64 moved;                  /* Live blocks the cleaner copied to the log head   */
+  uint64 checkpoints;            /* Inode map and bitmask writes                     */
+} lfsstat_t;
+
+void   lfs_format(fsystem_t*);                  /* Write an empty inode map when making the FS       */
+int32  lfs_init(void);                          /* Load the inode map and continue the log           */
+void   lfs_release(void);                       /* Free the inode map                                */
+byte   lfs_active(void);                        /* Returns 1 while files are written to a log        */
+uint32 lfs_ialloc(void);                        /* Find an unused inode number (EMPTY if none)       */
+int32  lfs_iget(uint32, inode_t*);              /* Read an inode through the inode map               */
+int32  lfs_iput(inode_t*);                      /* Append an inode to the log                        */
+uint32 lfs_alloc(uint32, uint32);               /* Take the block at the head of the log             */
+uint32 lfs_renew(uint32, uint32, uint32);       /* Copy an indirect block the checkpoint refers to   */
+uint32 lfs_write(inode_t*, uint32, char*, uint32, char*);  /* Write file data at the head of the log */
+void   lfs_flush(void);                         /* Write out the file blocks the log holds back      */
+int32  lfs_checkpoint(void);                    /* Write the inodes, the log and the inode map       */
+int32  lfs_clean(uint32);                       /* Clean segments until that many are clean          */
+uint32 lfs_clean_segments(void);                /* Number of clean segments                          */
+byte   lfs_cleaner(char*);                      /* Thread that cleans segments while the FS is idle  */
+lfsstat_t lfs_stats(void);                      /* Get the log counters                              */
+
+#endif
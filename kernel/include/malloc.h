@@ -1,18 +1,48 @@
+#ifndef H_MALLOC
+#define H_MALLOC
+
 #include <barelib.h>
+#include <thread.h>
 
 #define M_FREE 0  /*  Macros for indicating if a block of  */
 #define M_USED 1  /*  memory is free or used               */
 
+#define M_KERNEL NTHREADS  /*  Owner of allocations that outlive any single thread (not a thread table slot)  */
+
 /*  'alloc_t' structs contain the necessary state for tracking *
 *   blocks of memory allocated to processes or free.           */
 typedef struct _alloc {    /*                                               */
   uint64 size;             /*  The size of the following block of memory    */
   char state;              /*  If the following block is free or allocated  */
+  uint32 owner;            /*  Thread that owns the allocation (M_KERNEL)   */
   struct _alloc* next;     /*  A pointer to the next block of memory        */
 } alloc_t;                 /*                                               */
 
+/*  'heapstat_t' is a snapshot of the heap usage, it is  *
+ *  filled in by 'heap_stats'.                           */
+typedef struct _heapstat {
+  uint64 size;             /*  Total number of bytes managed by the heap           */
+  uint64 used;             /*  Bytes currently allocated (excluding headers)       */
+  uint64 peak;             /*  Largest value of 'used' since 'heap_init'           */
+  uint64 allocs;           /*  Number of live allocations                          */
+  uint64 kernel;           /*  Bytes of 'used' owned by the kernel (M_KERNEL)      */
+  uint64 free;             /*  Bytes available in free blocks                      */
+  uint64 freeblocks;       /*  Number of blocks on the freelist                    */
+  uint64 largest;          /*  Size of the largest free block                      */
+  uint32 frag;             /*  External fragmentation, 100 * (1 - largest / free)  */
+} heapstat_t;
+
 
 /*  memory managmeent prototypes */
 void heap_init(void);    /*  Create the initial space for processes to allocate memory  */
 void* malloc(uint64);    /*  Allocate a block of memory for a process                   */
 void free(void*);        /*  Return a block of memory to the free pool of memory        */
+void* calloc(uint64, uint64);         /*  Allocate a cleared array of elements                 */
+void* realloc(void*, uint64);         /*  Resize an allocation, growing in place when possible  */
+void* aligned_alloc(uint64, uint64);  /*  Allocate a block at a power of two aligned address    */
+void heap_stats(heapstat_t*);         /*  Take a snapshot of the heap usage                     */
+void heap_print_map(void);            /*  Print every block on the heap                         */
+int32 heap_transfer(void*, uint32);   /*  Hand an allocation to another thread (or M_KERNEL)    */
+void heap_reclaim(uint32);            /*  Free every allocation still owned by a thread         */
+
+#endif
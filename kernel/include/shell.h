@@ -2,3 +2,4 @@
 byte shell(char*);
 byte builtin_echo(char*);
 byte builtin_hello(char*);
+byte builtin_meminfo(char*);
@@ -23,6 +23,7 @@ typedef struct _thread {
   uint32 parent;         /*  The index into the 'thread_table' of the thread's parent                */
   byte retval;           /*  The return value of the function (only valid when state == TH_DEFUNCT)  */
   uint32 priority;       /*  Thread priority (0=highest MAX_UINT32=lowest)                           */
+  uint64 memused;        /*  Bytes of heap currently owned by the thread (see lib/malloc.c)          */
 } thread_t;
 
 extern thread_t thread_table[];
@@ -0,0 +1,78 @@
+#ifndef H_VIRTIO
+#define H_VIRTIO
+
+#include <barelib.h>
+
+#define VBLK_SECTOR_SIZE 512    /* Unit of every virtio block request                        */
+#define VBLK_QSIZE       128    /* Descriptors in the request queue (a power of 2)           */
+#define VBLK_MAX_SEGS    16     /* Requests the elevator merges into one device request      */
+#define VBLK_PLUG_MAX    64     /* Requests held back by a plug before they are started anyway */
+
+/* A 'vblkreq_t' is one transfer of whole sectors between memory and the disk.  The caller owns   *
+ * the structure until 'done' is set by the interrupt handler, the device reads 'hdr' and writes  *
+ * 'status' directly so the request must stay in place while it is in flight.  'callback' (if    *
+ * set) is run when the request completes, in Machine mode from the interrupt handler, so it     *
+ * must be short.  It may submit further requests but must not wait for them.  Requests that     *
+ * are in flight together should not overlap, the device may complete them in any order.         */
+typedef struct vblkreq {
+  struct {                       /* Request header as laid out by the virtio spec   */
+    uint32 type;                 /*   VBLK_T_IN (read) or VBLK_T_OUT (write)         */
+    uint32 reserved;             /*                                                 */
+    uint64 sector;               /*   First sector of the transfer                  */
+  } hdr;
+  void* buf;                     /* Memory the sectors are read into or written from */
+  uint32 len;                    /* Bytes to move, a multiple of VBLK_SECTOR_SIZE    */
+  void (*callback)(struct vblkreq*);  /* Run when the request completes (or NULL)   */
+  void* arg;                     /* Left for the owner of the request (e.g. 'callback') */
+  struct vblkreq* next;          /* Next request waiting in the elevator             */
+  struct vblkreq* merged;        /* Requests that follow this one on the disk and   */
+  uint32 total;                  /*   are sent with it, the bytes and segments of   */
+  uint32 nseg;                   /*   the whole chain (see system/elevator.c)       */
+  uint32 expires;                /* Elevator clock by which the request must start   */
+  uint16 head;                   /* First descriptor of the request while queued     */
+  volatile byte status;          /* Written by the device, 0 on success              */
+  volatile byte done;            /* Set once the device is done with the request     */
+} vblkreq_t;
+
+/* 'vblkstat_t' holds the counters of the driver (see 'vblk_stats')  */
+typedef struct vblkstat {
+  uint64 submitted;              /* Requests passed to 'vblk_submit'                 */
+  uint64 dispatched;             /* Requests sent to the device (after merging)      */
+  uint64 completed;              /* Requests the device has finished                 */
+  uint64 kicks;                  /* Notifications sent to the device                 */
+  uint64 interrupts;             /* Interrupts taken from the device                 */
+} vblkstat_t;
+
+/* 'elvstat_t' holds the counters of the elevator (see 'elv_stats')  */
+typedef struct elvstat {
+  uint64 added;                  /* Requests given to the elevator                   */
+  uint64 backmerges;             /* Requests appended to a queued request            */
+  uint64 frontmerges;            /* Requests a queued request was appended to        */
+  uint64 dispatched;             /* Requests taken out in elevator order             */
+  uint64 expired;                /* Requests taken out first because of their age    */
+} elvstat_t;
+
+#define VBLK_T_IN  0            /* 'hdr.type' of a read                                       */
+#define VBLK_T_OUT 1            /* 'hdr.type' of a write                                      */
+
+int32  vblk_init(void);                  /* Find and start the virtio disk (-1 if there is none)  */
+byte   vblk_present(void);               /* Returns 1 once 'vblk_init' has found a disk           */
+uint64 vblk_capacity(void);              /* Size of the disk in sectors                           */
+int32  vblk_submit(vblkreq_t*);          /* Queue a request, -1 if it is not valid                */
+int32  vblk_wait(vblkreq_t*);            /* Wait for a queued request, 0 on success or -1         */
+int32  vblk_rw(vblkreq_t*, uint32);      /* Queue a list of requests and wait for all of them     */
+void   vblk_plug(void);                  /* Hold new requests back so they can be merged          */
+void   vblk_unplug(void);                /* Start the requests held back by 'vblk_plug'           */
+vblkstat_t vblk_stats(void);            /* Get the driver's counters                             */
+void   vblk_handler(void);               /* Interrupt handler, called by 'handle_plic'            */
+uint32 vblk_irq(void);                   /* PLIC source number of the disk                        */
+
+void   elv_init(void);                   /* Start with an empty elevator                          */
+void   elv_add(vblkreq_t*);              /* Queue a request, merging it with its neighbours       */
+vblkreq_t* elv_next(void);              /* Take out the request to start next (or NULL)          */
+uint32 elv_count(void);                  /* Number of requests waiting in the elevator            */
+elvstat_t elv_stats(void);              /* Get the elevator's counters                           */
+
+extern byte elv_enabled;                 /* 0 turns the elevator into a plain FIFO                */
+
+#endif
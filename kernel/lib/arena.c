@@ -0,0 +1,84 @@
+#include <barelib.h>
+#include <malloc.h>
+#include <arena.h>
+
+#define chunk_base(c) ((uint64)((c) + 1))
+
+/*  Sets up an empty arena.  No memory is taken from the heap  *
+ *  until the first call to 'arena_alloc'.                     */
+void arena_init(arena_t* arena, uint64 chunksz) {
+  arena->head = NULL;
+  arena->curr = NULL;
+  arena->used = 0;
+  arena->chunksz = (chunksz == 0 ? ARENA_CHUNK_SZ : chunksz);
+}
+
+/*  Returns the offset in 'chunk' where an allocation of 'size'  *
+ *  bytes would start, or -1 if it does not fit after 'used'.    */
+static int64 chunk_fit(arena_chunk_t* chunk, uint64 used, uint64 size) {
+  uint64 addr = (chunk_base(chunk) + used + ARENA_ALIGN - 1) & ~(uint64)(ARENA_ALIGN - 1);
+  uint64 off = addr - chunk_base(chunk);
+  if (off + size > chunk->size)
+    return -1;
+  return off;
+}
+
+/*  Take 'size' bytes from the current chunk.  When the current  *
+ *  chunk is exhausted, move on to the next retained chunk or    *
+ *  'malloc' a new chunk and link it after the current one.      */
+void* arena_alloc(arena_t* arena, uint64 size) {
+  arena_chunk_t* chunk;
+  uint64 chunksz;
+  int64 off;
+
+  if (arena->curr != NULL) {
+    if ((off = chunk_fit(arena->curr, arena->used, size)) >= 0) {   /*  Fast path, bump inside the current chunk  */
+      arena->used = off + size;
+      return (void*)(chunk_base(arena->curr) + off);
+    }
+    if (arena->curr->next != NULL &&                                 /*  Reuse a chunk kept by 'arena_reset'       */
+        (off = chunk_fit(arena->curr->next, 0, size)) >= 0) {
+      arena->curr = arena->curr->next;
+      arena->used = off + size;
+      return (void*)(chunk_base(arena->curr) + off);
+    }
+  }
+
+  chunksz = (size + ARENA_ALIGN > arena->chunksz ? size + ARENA_ALIGN : arena->chunksz);
+  if ((chunk = (arena_chunk_t*)malloc(sizeof(arena_chunk_t) + chunksz)) == NULL)
+    return NULL;
+  chunk->size = chunksz;
+  if (arena->curr == NULL) {           /*  First chunk of the arena       */
+    chunk->next = arena->head;
+    arena->head = chunk;
+  }
+  else {                               /*  Insert after the current chunk  */
+    chunk->next = arena->curr->next;
+    arena->curr->next = chunk;
+  }
+  arena->curr = chunk;
+  off = chunk_fit(chunk, 0, size);
+  arena->used = off + size;
+  return (void*)(chunk_base(chunk) + off);
+}
+
+/*  Invalidates every allocation made from the arena in O(1).  *
+ *  The chunks stay attached and are reused by later calls.    */
+void arena_reset(arena_t* arena) {
+  arena->curr = arena->head;
+  arena->used = 0;
+}
+
+/*  Returns every chunk to the heap.  The cost is one 'free'   *
+ *  per chunk regardless of how many objects were allocated.   */
+void arena_destroy(arena_t* arena) {
+  arena_chunk_t* chunk = arena->head;
+  arena_chunk_t* next;
+  while (chunk != NULL) {
+    next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+  arena->head = arena->curr = NULL;
+  arena->used = 0;
+}
@@ -1,10 +1,300 @@
+#include <barelib.h>
+#include <interrupts.h>
+
+/*
+ *  Memory routines used throughout the kernel (most notably by the block
+ *  store on every 'bs_read' and 'bs_write').  Each routine moves single
+ *  bytes until the destination is word aligned, then works on 64-bit
+ *  words, four at a time, and finishes the tail with single bytes.
+ *
+ *  When the hart implements the vector extension ('mem_init' is handed
+ *  'misa' at boot) requests of at least 'VEC_MIN' bytes are passed to
+ *  the RVV versions in 'memvec.s' instead.
+ */
+
+#define WORD_SZ      8
+#define WORD_MASK    (WORD_SZ - 1)
+#define is_aligned(p) (((uint64)(p) & WORD_MASK) == 0)
+#define MISA_V       (1UL << ('V' - 'A'))   /*  'misa' bit for the vector extension          */
+#define VEC_MIN      64                     /*  Below this the scalar loops are just as fast  */
+
+void vec_memcpy(void*, const void*, int);
+void vec_memset(void*, int, int);
+int32 vec_memcmp(const void*, const void*, int);
+uint32 vec_checksum(const void*, int);
+int32 vec_bitmap_scan(const byte*, int, int);
+
+static byte mem_vector = 0;   /*  Set when the vector routines may be used  */
+
+
+/*  Select the vector routines if 'misa' reports the 'V' extension.  The  *
+ *  bootstrap has already enabled the vector unit in that case.           */
+void mem_init(uint64 misa) {
+  mem_vector = (misa & MISA_V) != 0;
+}
+
+byte mem_has_vector(void) {
+  return mem_vector;
+}
+
+
 void* memset(void* s, int c, int n) {
-  while (n-- >= 0) ((char*)s)[n] = (char)c;
+  byte* d = (byte*)s;
+  uint64* w;
+  uint64 pattern = (byte)c * 0x0101010101010101UL;
+  char mask;
+
+  if (mem_vector && n >= VEC_MIN) {
+    mask = disable_interrupts();         /*  Vector registers are not saved on a context switch  */
+    vec_memset(s, c, n);
+    restore_interrupts(mask);
+    return s;
+  }
+  while (n > 0 && !is_aligned(d)) {      /*  Head, up to the first aligned word  */
+    *d++ = (byte)c;
+    n--;
+  }
+  w = (uint64*)d;
+  while (n >= 4 * WORD_SZ) {             /*  Body, four words per iteration      */
+    w[0] = pattern;
+    w[1] = pattern;
+    w[2] = pattern;
+    w[3] = pattern;
+    w += 4;
+    n -= 4 * WORD_SZ;
+  }
+  while (n >= WORD_SZ) {
+    *w++ = pattern;
+    n -= WORD_SZ;
+  }
+  d = (byte*)w;
+  while (n-- > 0)                        /*  Tail bytes                          */
+    *d++ = (byte)c;
   return s;
 }
 
 
+/*  Copies 'n' bytes front to back.  When the source and destination  *
+ *  disagree on alignment, aligned source words are merged with       *
+ *  shifts so that every load and store stays aligned.                */
 void* memcpy(void* dst, const void* src, int n) {
-  while (--n >= 0) ((char*)dst)[n] = ((char*)src)[n];
+  byte* d = (byte*)dst;
+  const byte* s = (const byte*)src;
+  uint64 *dw, w0, w1;
+  const uint64* sw;
+  uint32 shift;
+  char mask;
+
+  if (mem_vector && n >= VEC_MIN) {
+    mask = disable_interrupts();
+    vec_memcpy(dst, src, n);
+    restore_interrupts(mask);
+    return dst;
+  }
+  while (n > 0 && !is_aligned(d)) {      /*  Align the destination               */
+    *d++ = *s++;
+    n--;
+  }
+  dw = (uint64*)d;
+
+  if (is_aligned(s)) {
+    sw = (const uint64*)s;
+    while (n >= 4 * WORD_SZ) {
+      dw[0] = sw[0];
+      dw[1] = sw[1];
+      dw[2] = sw[2];
+      dw[3] = sw[3];
+      dw += 4;
+      sw += 4;
+      n -= 4 * WORD_SZ;
+    }
+    while (n >= WORD_SZ) {
+      *dw++ = *sw++;
+      n -= WORD_SZ;
+    }
+    s = (const byte*)sw;
+  }
+  else if (n >= WORD_SZ) {
+    shift = ((uint64)s & WORD_MASK) * 8;                  /*  Little endian: the low bytes of   */
+    sw = (const uint64*)((uint64)s & ~(uint64)WORD_MASK); /*  each output word come from the    */
+    w0 = *sw++;                                           /*  high bytes of the previous load   */
+    while (n >= WORD_SZ) {
+      w1 = *sw++;
+      *dw++ = (w0 >> shift) | (w1 << (64 - shift));
+      w0 = w1;
+      n -= WORD_SZ;
+    }
+    s = (const byte*)sw - WORD_SZ + shift / 8;
+  }
+
+  d = (byte*)dw;
+  while (n-- > 0)
+    *d++ = *s++;
+  return dst;
+}
+
+
+/*  Same as 'memcpy' but the buffers may overlap.  Overlapping copies  *
+ *  to a higher address run back to front.                             */
+void* memmove(void* dst, const void* src, int n) {
+  byte* d = (byte*)dst + n;
+  const byte* s = (const byte*)src + n;
+  uint64* dw;
+  const uint64* sw;
+
+  if ((byte*)dst <= (const byte*)src || (byte*)dst >= (const byte*)src + n)
+    return memcpy(dst, src, n);
+
+  if (((uint64)d & WORD_MASK) == ((uint64)s & WORD_MASK)) {
+    while (n > 0 && !is_aligned(d)) {
+      *--d = *--s;
+      n--;
+    }
+    dw = (uint64*)d;
+    sw = (const uint64*)s;
+    while (n >= 4 * WORD_SZ) {
+      dw -= 4;
+      sw -= 4;
+      dw[3] = sw[3];
+      dw[2] = sw[2];
+      dw[1] = sw[1];
+      dw[0] = sw[0];
+      n -= 4 * WORD_SZ;
+    }
+    while (n >= WORD_SZ) {
+      *--dw = *--sw;
+      n -= WORD_SZ;
+    }
+    d = (byte*)dw;
+    s = (const byte*)sw;
+  }
+  while (n-- > 0)
+    *--d = *--s;
   return dst;
 }
+
+
+/*  Compares 'n' bytes, returning the difference of the first pair  *
+ *  of bytes that differ (0 if the buffers match).                  */
+int32 memcmp(const void* a, const void* b, int n) {
+  const byte* x = (const byte*)a;
+  const byte* y = (const byte*)b;
+  const uint64 *xw, *yw;
+  char mask;
+  int32 diff;
+
+  if (mem_vector && n >= VEC_MIN) {
+    mask = disable_interrupts();
+    diff = vec_memcmp(a, b, n);
+    restore_interrupts(mask);
+    return diff;
+  }
+  if (((uint64)x & WORD_MASK) == ((uint64)y & WORD_MASK)) {
+    while (n > 0 && !is_aligned(x)) {
+      if (*x != *y)
+        return *x - *y;
+      x++, y++, n--;
+    }
+    xw = (const uint64*)x;
+    yw = (const uint64*)y;
+    while (n >= WORD_SZ && *xw == *yw) {   /*  Skip matching words, the first differing  */
+      xw++, yw++;                          /*  word is resolved byte by byte below       */
+      n -= WORD_SZ;
+    }
+    x = (const byte*)xw;
+    y = (const byte*)yw;
+  }
+  for (; n > 0; x++, y++, n--)
+    if (*x != *y)
+      return *x - *y;
+  return 0;
+}
+
+
+
+/*  Returns the 32-bit sum of the buffer read as little endian 32-bit  *
+ *  words, with a trailing partial word padded with zero bytes.        */
+uint32 checksum(const void* buf, int n) {
+  const byte* b = (const byte*)buf;
+  uint32 sum = 0, last = 0;
+  char mask;
+  int i;
+
+  if (mem_vector && n >= VEC_MIN && ((uint64)b & 3) == 0) {
+    mask = disable_interrupts();
+    sum = vec_checksum(b, n / 4);
+    restore_interrupts(mask);
+    b += n & ~3;
+  }
+  else if (((uint64)b & 3) == 0) {
+    for (; n >= 4; n -= 4, b += 4)
+      sum += *(const uint32*)b;
+  }
+  else {
+    for (; n >= 4; n -= 4, b += 4)
+      sum += b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32)b[3] << 24);
+  }
+  for (i=0; i<(n & 3); i++)
+    last |= (uint32)b[i] << (8 * i);
+  return sum + last;
+}
+
+
+/*  Returns the number of trailing zero bits of a non-zero 'w'.  The  *
+ *  lowest set bit is isolated and mapped to its position through a    *
+ *  de Bruijn sequence (rv64imac has no count-trailing-zeros).          */
+uint32 ctz64(uint64 w) {
+  static const byte debruijn_pos[64] = {
+     0,  1,  2, 53,  3,  7, 54, 27,  4, 38, 41,  8, 34, 55, 48, 28,
+    62,  5, 39, 46, 44, 42, 22,  9, 24, 35, 59, 56, 49, 18, 29, 11,
+    63, 52,  6, 26, 37, 40, 33, 47, 61, 45, 43, 21, 23, 58, 17, 10,
+    51, 25, 36, 32, 60, 20, 57, 16, 50, 31, 19, 15, 30, 14, 13, 12
+  };
+  return debruijn_pos[((w & -w) * 0x022fdd63cc95386dUL) >> 58];
+}
+
+
+/*  Returns the index of the first bit in ['from', 'nbits') of 'map'  *
+ *  whose value is 'set' (bit 'i' is bit 'i % 8' of byte 'i / 8'), or  *
+ *  -1 if there is none.  Bytes and words made up entirely of the      *
+ *  other value are skipped, 64 bits at a time once aligned.           */
+int32 bitmap_scan(const byte* map, int32 from, int32 nbits, byte set) {
+  byte skip = set ? 0x00 : 0xff;                   /*  Bytes with no bit of interest  */
+  uint64 wskip = set ? 0UL : ~0UL;
+  int32 nbytes = (nbits + 7) / 8, i = from / 8, bit, found;
+  char mask;
+
+  if (from >= nbits)
+    return -1;
+  if ((byte)((map[i] ^ skip) >> (from % 8))) {     /*  Remainder of the first byte    */
+    bit = from + ctz64((byte)(map[i] ^ skip) >> (from % 8));
+    return bit < nbits ? bit : -1;
+  }
+  i++;
+
+  if (mem_vector && nbytes - i >= VEC_MIN) {
+    mask = disable_interrupts();
+    found = vec_bitmap_scan(map + i, nbytes - i, skip);
+    restore_interrupts(mask);
+    if (found < 0)
+      return -1;
+    i += found;
+  }
+  else {
+    while (i < nbytes && !is_aligned(map + i) && map[i] == skip)
+      i++;
+    while (i + WORD_SZ <= nbytes && is_aligned(map + i)) {
+      if (*(const uint64*)(map + i) != wskip) {
+        bit = i * 8 + ctz64(*(const uint64*)(map + i) ^ wskip);
+        return bit < nbits ? bit : -1;
+      }
+      i += WORD_SZ;
+    }
+    while (i < nbytes && map[i] == skip)
+      i++;
+    if (i >= nbytes)
+      return -1;
+  }
+  bit = i * 8 + ctz64(map[i] ^ skip);
+  return bit < nbits ? bit : -1;
+}
@@ -0,0 +1,156 @@
+#include <barelib.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
+
+#define BMAP_PLACE 4     /*  'map' fills in the data block it is given (see 'fs_bmap_place')  */
+
+static uint32 owner;     /*  Inode number the blocks of a BMAP_LOG mapping are taken for  */
+
+/*  Make sure '*ptr' refers to a block, allocating one if it is  *
+ *  EMPTY and 'alloc' is set.  A new indirect block is filled    *
+ *  with EMPTY pointers.  Data blocks are placed at 'goal' when  *
+ *  it is free (see 'fs_alloc_goal'), BMAP_META blocks at the    *
+ *  top of the device.  BMAP_LOG takes blocks from the head of   *
+ *  the log, 'goal' is then what the segment summary records,    *
+ *  and always gives a data block a new one (indirect blocks     *
+ *  only when 'lfs_renew' has to).  BMAP_PLACE uses 'goal' as    *
+ *  the data block and takes indirect blocks from the top of     *
+ *  the device.  Returns the block or EMPTY.                     */
+static uint32 resolve(uint32* ptr, byte alloc, byte indirect, uint32 goal, char* dirty) {
+  int32 block;
+  if (alloc == BMAP_LOG && indirect && *ptr != EMPTY) {   /*  Copied first if the last log  */
+    block = lfs_renew(*ptr, owner, goal);                 /*  checkpoint refers to it       */
+    if (block != -1 && block != *ptr) {
+      *ptr = block;
+      *dirty = 1;
+    }
+    return block;
+  }
+  if ((*ptr != EMPTY && alloc != BMAP_LOG) || !alloc)
+    return *ptr;
+  if (alloc == BMAP_META || (alloc == BMAP_PLACE && indirect))
+    block = fs_alloc_high();
+  else if (alloc == BMAP_PLACE)
+    block = goal;
+  else if (alloc == BMAP_LOG)
+    block = lfs_alloc(owner, goal);
+  else
+    block = (indirect || goal == EMPTY ? fs_alloc_block() : fs_alloc_goal(goal));
+  if (block == -1)
+    return EMPTY;
+  if (indirect)
+    bc_fill(block, 0xff);
+  *ptr = block;
+  *dirty = 1;
+  return block;
+}
+
+/*  Same as 'resolve' for the 'slot'th pointer of indirect block 'iblock'  */
+static uint32 resolve_slot(uint32 iblock, uint32 slot, byte alloc, byte indirect, uint32 goal, char* dirty) {
+  uint32 ptr, old;
+  if (bc_read(iblock, slot * sizeof(uint32), &ptr, sizeof(uint32)) == -1)
+    return EMPTY;
+  old = ptr;
+  resolve(&ptr, alloc, indirect, goal, dirty);
+  if (ptr != old && jnl_write(iblock, slot * sizeof(uint32), &ptr, sizeof(uint32)) != 0) {
+    if (old == EMPTY && (alloc != BMAP_PLACE || indirect))   /*  Give back the block taken  */
+      fs_clearmaskbit(ptr);
+    return EMPTY;
+  }
+  return ptr;
+}
+
+/*  Look up (and with 'alloc' set, fill in) block 'index' of the file  */
+static uint32 map(inode_t* inode, uint32 index, byte alloc, uint32 goal, char* dirty) {
+  uint32 iblock;
+  if (index < INODE_BLOCKS)
+    return resolve(&inode->blocks[index], alloc, 0, goal, dirty);
+
+  index -= INODE_BLOCKS;
+  if (index < INODE_PTRS) {
+    if ((iblock = resolve(&inode->indirect, alloc, 1, LFS_SUM_IND, dirty)) == EMPTY)
+      return EMPTY;
+    return resolve_slot(iblock, index, alloc, 0, goal, dirty);
+  }
+
+  index -= INODE_PTRS;
+  if (index < INODE_PTRS * INODE_PTRS) {
+    if ((iblock = resolve(&inode->dindirect, alloc, 1, LFS_SUM_DIND, dirty)) == EMPTY)
+      return EMPTY;
+    if ((iblock = resolve_slot(iblock, index / INODE_PTRS, alloc, 1, LFS_SUM_IND2 + index / INODE_PTRS, dirty)) == EMPTY)
+      return EMPTY;
+    return resolve_slot(iblock, index % INODE_PTRS, alloc, 0, goal, dirty);
+  }
+  return EMPTY;
+}
+
+/* fs_bmap - Takes an inode, the index of a block within the file, whether   *
+ *           missing blocks should be allocated (BMAP_LOOKUP, BMAP_ALLOC,    *
+ *           BMAP_META or BMAP_LOG) and a flag to set when the file's        *
+ *           blocks changed.                                                 *
+ *                                                                           *
+ *           Block 'index' of the file is found in the inode's direct        *
+ *           'blocks', in the 'indirect' block, or through the 'dindirect'   *
+ *           block (which lists further indirect blocks).  Indirect blocks   *
+ *           are read through the block cache, so streaming through a file   *
+ *           touches the device for each of them only once.  A new data      *
+ *           block is placed right after the file's previous block when      *
+ *           that one is free, so files are laid out in contiguous runs.     *
+ *           BMAP_LOG moves the block to the head of the log (see            *
+ *           system/lfs.c), the caller frees the old one.                    *
+ *                                                                           *
+ *  returns - the device block holding that part of the file, or EMPTY if    *
+ *            there is none (a hole, past INODE_MAX_BLOCKS or out of space,  *
+ *            or a file kept in its inode block, see lib/fs_inline.c).       */
+uint32 fs_bmap(inode_t* inode, uint32 index, byte alloc, char* dirty) {
+  uint32 block, goal = EMPTY;
+  if (inode->blocks[0] == INLINE_DATA)
+    return EMPTY;
+  if (alloc == BMAP_LOG) {
+    owner = inode->id;
+    return (index < INODE_MAX_BLOCKS ? map(inode, index, alloc, index, dirty) : EMPTY);
+  }
+  block = map(inode, index, 0, EMPTY, dirty);
+  if (block != EMPTY || !alloc || index >= INODE_MAX_BLOCKS)
+    return block;
+  if (index > 0 && (goal = map(inode, index - 1, 0, EMPTY, dirty)) != EMPTY)  /*  Aim for the block right after  */
+    goal++;                                                                     /*  the previous one of the file   */
+  return map(inode, index, alloc, goal, dirty);
+}
+
+
+/* fs_bmap_run - Same as 'fs_bmap' for file blocks 'index' onwards, but   *
+ *               also counts how many of the following file blocks (up to *
+ *               'max' in all) sit right after it on the device.  Those   *
+ *               can be moved in a single transfer.                       *
+ *                                                                        *
+ *  returns - the device block of file block 'index' (or EMPTY), with     *
+ *            the length of the run in '*count'.                          */
+uint32 fs_bmap_run(inode_t* inode, uint32 index, uint32 max, byte alloc, char* dirty, uint32* count) {
+  uint32 first = fs_bmap(inode, index, alloc, dirty);
+  *count = (first == EMPTY ? 0 : 1);
+  while (*count > 0 && *count < max && fs_bmap(inode, index + *count, alloc, dirty) == first + *count)
+    (*count)++;
+  return first;
+}
+
+
+/* fs_bmap_place - Takes an inode, the index of a block within the file,  *
+ *                 a device block the caller has allocated for it and the *
+ *                 flag to set when the file's blocks changed.            *
+ *                                                                        *
+ *                 Maps file block 'index' to 'block'.  Used for data     *
+ *                 that was held back (see lib/fs_delay.c), whose run is  *
+ *                 allocated before its blocks are mapped.  Indirect      *
+ *                 blocks it needs are taken from the top of the device,  *
+ *                 out of the way of the runs the file grows into.        *
+ *                                                                        *
+ *  returns - 'block', or EMPTY if 'index' is mapped already, is past     *
+ *            INODE_MAX_BLOCKS or an indirect block could not be found.   */
+uint32 fs_bmap_place(inode_t* inode, uint32 index, uint32 block, char* dirty) {
+  if (inode->blocks[0] == INLINE_DATA || index >= INODE_MAX_BLOCKS || map(inode, index, 0, EMPTY, dirty) != EMPTY)
+    return EMPTY;
+  return map(inode, index, BMAP_PLACE, block, dirty);
+}
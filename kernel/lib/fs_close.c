@@ -1,5 +1,9 @@
 #include <barelib.h>
+#include <malloc.h>
 #include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
 
 extern fsystem_t* fsd;
 extern filetable_t oft[NUM_FD];
@@ -7,15 +11,42 @@ extern filetable_t oft[NUM_FD];
 /*  Modify  the state  of the open  file table to  close  *
  *  the 'fd' index and write the inode back to the block  *
     device.  If the  entry is already closed,  return an  *
- *  error.                                                */
+ *  error.  The file also stays open (and  an error  is   *
+ *  returned) if the blocks it held back found no place,  *
+ *  or its inode could not be written.                    */
 int32 fs_close(int32 fd) {
   //check if file is already closed
   if(oft[fd].state == FSTATE_CLOSED){
     return -1;
   }
-  //write inode to ramdisk
-  bs_write(oft[fd].inode.id, 0, &oft[fd].inode, sizeof(inode_t));
-  //set state to closed
+  //write out the blocks the file held back, then the inode and any
+  //pending freemask changes to ramdisk (with a journal they join the
+  //running transaction, a log-structured FS appends a changed inode
+  //to its log for the next checkpoint).  bitmask blocks that do not
+  //fit in the transaction stay dirty for the next fs_sync
+  jnl_begin();
+  if(fs_delay_flush(fd) != 0){
+    jnl_end();
+    return -1;
+  }
+  if(lfs_active()){
+    if(oft[fd].dirty){
+      lfs_iput(&oft[fd].inode);
+    }
+  }
+  else{
+    if(jnl_write(oft[fd].inode.id, 0, &oft[fd].inode, sizeof(inode_t)) != 0){
+      jnl_end();
+      return -1;
+    }
+    bc_sync_block(oft[fd].inode.id);
+  }
+  oft[fd].dirty = 0;
+  fs_flush_freemask();
+  jnl_end();
+  //set state to closed, the buffer for blocks held back goes with it
+  free(oft[fd].held);
+  oft[fd].held = NULL;
   oft[fd].state = FSTATE_CLOSED;
   return 0;
 }
@@ -1,51 +1,49 @@
 #include <barelib.h>
 #include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
 
 extern fsystem_t* fsd;
 
-/*  Search for 'filename' in the root directory.  If the  *
- *  file exists,  returns an error.  Otherwise, create a  *
- *  new file  entry in the  root directory, a llocate an  *
- *  unused  block in the block  device and  assign it to  *
- *  the new file.                                         */
-// Custom function to compare two strings
-
-void* memset(void*, int, int);
-
-int32 fs_create(char* filename) {
+/*  Search for the last name of 'path' in its directory.  If  *
+ *  the name exists, returns an error.  Otherwise, create a    *
+ *  new entry of the given 'type' in the directory, allocate   *
+ *  an unused block in the block device and assign it to the   *
+ *  new file or directory as its inode.                        */
+static int32 mknod(char* path, byte type) {
 //check for potential errors -----------------
 
-    //if directory is empty
-    if(fsd->root_dir.numentries == DIR_SIZE){
+    //find the directory the entry goes in
+    uint32 parent;
+    char name[FILENAME_LEN];
+    if (fs_walk(path, &parent, name) == -1) {
         return -1;
     }
 
-    //find unused directory
-    int32 entry_index = fsd->root_dir.numentries;
-    for (int32 i = 0; i < DIR_SIZE; i++) {
-        if (fsd->root_dir.entry[i].inode_block == EMPTY) {
-            entry_index = i;
-            break;
-        }
+    //if directory is full
+    //(new entries are appended to the directory)
+    int32 entry_index = fs_dir_entries(parent);
+    if (entry_index == -1 || entry_index >= DIR_SIZE) {
+        return -1;
     }
 
-
-    //check if filename is already used
-    for (int32 i = 0; i < fsd->root_dir.numentries; i++) {
-        if (fsd->root_dir.entry[i].inode_block != EMPTY &&
-            fs_strcmp(fsd->root_dir.entry[i].name, filename) == 0) {
-            return -1;
-        }
+    //check if name is already used
+    dirent_t entry;
+    if (fs_lookup(parent, name, &entry) != -1) {
+        return -1;
     }
 
-    //look for free block
-    uint32 inode_block_index = EMPTY;
-    for (uint32 i = 0; i < fsd->device.nblocks; i++) {
-        if (fs_getmaskbit(i) == 0) {
-            inode_block_index = i;
-            fs_setmaskbit(i);
-            break;
-        }
+    //look for free block (a file on a log-structured FS gets an inode
+    //number instead, and directories stay above the log)
+    byte logged = (lfs_active() && type == DT_FILE);
+    int32 inode_block_index;
+    if (logged) {
+        inode_block_index = lfs_ialloc();
+    } else if (lfs_active()) {
+        inode_block_index = fs_alloc_high();
+    } else {
+        inode_block_index = fs_alloc_block();
     }
 
     //return -1 if no block found
@@ -55,23 +53,67 @@ int32 fs_create(char* filename) {
 
 
 //create file TODO -----------------------
-    //populate directory entry
-    fsd->root_dir.entry[entry_index].inode_block = inode_block_index;
-    fsd->root_dir.numentries++;
-    fs_strcpy(fsd->root_dir.entry[entry_index].name, filename);
-
-    //write inode to block
+    //write inode to block (a directory starts without any blocks, too)
+    //before the entry that points at it.  a log-structured FS adds it
+    //to its inode map once the entry is in
     inode_t new_inode;
     new_inode.id = inode_block_index;
     new_inode.size = 0;
     for(int i = 0; i <INODE_BLOCKS; i++){
         new_inode.blocks[i] = EMPTY;
     }
+    new_inode.indirect = EMPTY;
+    new_inode.dindirect = EMPTY;
+
+    if (!logged) {
+        //the rest of the block is zeroed for a small file kept in it
+        bc_fill(inode_block_index, 0);
+        if (jnl_write(inode_block_index, 0, &new_inode, sizeof(inode_t)) != 0) {
+            fs_clearmaskbit(inode_block_index);
+            return -1;
+        }
+        bc_sync_block(inode_block_index);
+    }
 
-    bs_write(inode_block_index, 0, &new_inode, sizeof(inode_t));
+    //populate directory entry, only its directory block is written
+    inode_t dirbuf;
+    inode_t* dir = fs_dir_inode(parent, &dirbuf);
+    memset(&entry, 0, sizeof(dirent_t));
+    entry.inode_block = inode_block_index;
+    entry.type = type;
+    fs_strcpy(entry.name, name);
+    if (dir == NULL || fs_dir_put(dir, entry_index, &entry) == -1) {
+        if (!logged) {
+            fs_clearmaskbit(inode_block_index);
+        }
+        return -1;
+    }
+    if (parent == ROOT_DIR) {
+        fsd->root_dir.numentries++;
+    }
+    fs_dir_added(parent, entry_index, &entry);
+    if (logged) {
+        lfs_iput(&new_inode);
+    }
 
-    //write freemask
-    bs_write(BM_BIT, 0, fsd->freemask, fsd->freemasksz);
+    //write freemask (bitmask blocks other files changed that do not
+    //fit in the transaction stay dirty for 'fs_sync', the entry is in)
+    fs_flush_freemask();
 
     return 0;
-}
\ No newline at end of file
+}
+
+/*  Same as 'mknod', as a single operation of the journal  *
+ *  (the entry, inode and bitmask commit together).        */
+int32 fs_mknod(char* path, byte type) {
+    jnl_begin();
+    int32 result = mknod(path, type);
+    jnl_end();
+    return result;
+}
+
+/*  Create an empty file at 'filename', a name in the root  *
+ *  directory or a path such as "/logs/a.txt".              */
+int32 fs_create(char* filename) {
+    return fs_mknod(filename, DT_FILE);
+}
@@ -0,0 +1,164 @@
+#include <barelib.h>
+#include <malloc.h>
+#include <interrupts.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
+
+extern fsystem_t* fsd;
+extern filetable_t oft[NUM_FD];
+
+/*
+ *  Delayed allocation.  With 'fs_delay_alloc' set, a write to blocks a
+ *  file does not have yet is kept in a buffer of its open file table
+ *  entry ('held') instead of getting device blocks there and then.  An
+ *  open file holds up to FS_DELAY_BLOCKS consecutive file blocks starting
+ *  at 'hfirst'.  They are only given a place on the device when they are
+ *  written out ('fs_delay_flush'): once the buffer is full or a write goes
+ *  elsewhere in the file, and by 'fs_read', 'fs_sync' and 'fs_close'.  By
+ *  then the allocator knows how far the file grew and takes a single run
+ *  for all of it (see 'fs_alloc_extent'), written in one request.  A file
+ *  built from many small appends, or several files growing side by side,
+ *  end up in long runs instead of blocks taken one at a time as each
+ *  append reached them.
+ *
+ *  The blocks held are set aside from the free blocks as they are taken
+ *  in, with DELAY_META more for each file's indirect blocks.  The other
+ *  allocators leave them alone (see 'fs_delay_reserved'), so a write that
+ *  is held back finds room when it is written out.  Should that still
+ *  fail, what could not be placed stays held and the error is returned.
+ *
+ *  Both functions run with interrupts disabled: the flusher thread calls
+ *  'fs_sync', which writes out the blocks of every open file, and must not
+ *  do so halfway through a write adding to them.  The buffer is kept from
+ *  the first write held back until 'fs_close'.
+ */
+
+#define DELAY_META 3     /*  Indirect blocks placing the blocks a file holds may need  */
+
+/*  Blocks the open files hold back, with room for their indirect blocks.  *
+ *  The allocators in system/fs.c keep this many blocks free.               */
+uint32 fs_delay_reserved(void) {
+  uint32 n = 0;
+  for (uint32 i=0; i<NUM_FD; i++)
+    if (oft[i].hcount > 0)
+      n += oft[i].hcount + DELAY_META;
+  return n;
+}
+
+/*  Returns 1 if none of file blocks ['from', 'to'] has a device block  */
+static byte unmapped(inode_t* inode, uint32 from, uint32 to) {
+  for (uint32 i=from; i<=to; i++)
+    if (fs_bmap(inode, i, BMAP_LOOKUP, NULL) != EMPTY)
+      return 0;
+  return 1;
+}
+
+/* fs_delay_write - Takes a file descriptor index into the 'oft', the byte  *
+ *                  of the file to write at, a buffer and its length.       *
+ *                                                                          *
+ *                  The write is held back when the blocks it touches are   *
+ *                  already held or follow on from them, have no device     *
+ *                  block and fit in FS_DELAY_BLOCKS.  What the file held   *
+ *                  before is written out first if this write goes          *
+ *                  somewhere else.  The caller updates the size.           *
+ *                                                                          *
+ *  returns - 0 if the data was held back, 1 if the caller writes it to     *
+ *            the file's blocks, or -1 if held data could not be written.   */
+int32 fs_delay_write(uint32 fd, uint32 offset, char* buf, uint32 len) {
+  filetable_t* f = &oft[fd];
+  uint32 first, last, end, add;
+  char mask;
+
+  if (!fs_delay_alloc || lfs_active() || len == 0 || len > 0xffffffff - offset)
+    return 1;
+  first = offset / FS_BLOCK_SIZE;
+  last = (offset + len - 1) / FS_BLOCK_SIZE;
+  mask = disable_interrupts();
+  if (f->hcount > 0 && (first < f->hfirst || first > f->hfirst + f->hcount || last >= f->hfirst + FS_DELAY_BLOCKS))
+    if (fs_delay_flush(fd) != 0) {
+      restore_interrupts(mask);
+      return -1;
+    }
+  if (last - first >= FS_DELAY_BLOCKS || last >= INODE_MAX_BLOCKS) {
+    restore_interrupts(mask);
+    return 1;
+  }
+
+  end = (f->hcount > 0 ? f->hfirst + f->hcount : first);
+  add = (last >= end ? last - end + 1 : 0);
+  if (add > 0 && (!unmapped(&f->inode, end, last) ||
+                  fsd->freeblocks < fs_delay_reserved() + add + (f->hcount > 0 ? 0 : DELAY_META))) {
+    restore_interrupts(mask);                        /*  The caller writes over the blocks  */
+    return (fs_delay_flush(fd) != 0 ? -1 : 1);       /*  held, they have to be placed       */
+  }
+  if (f->held == NULL) {
+    if ((f->held = malloc(FS_DELAY_BLOCKS * FS_BLOCK_SIZE)) == NULL) {
+      restore_interrupts(mask);
+      return 1;
+    }
+    heap_transfer(f->held, M_KERNEL);
+  }
+  if (f->hcount == 0)
+    f->hfirst = first;
+  memset(f->held + (end - f->hfirst) * FS_BLOCK_SIZE, 0, add * FS_BLOCK_SIZE);
+  memcpy(f->held + (offset - f->hfirst * FS_BLOCK_SIZE), buf, len);
+  f->hcount += add;
+  restore_interrupts(mask);
+  return 0;
+}
+
+/* fs_delay_flush - Takes a file descriptor index into the 'oft'.           *
+ *                                                                          *
+ *                  Allocates device blocks for the file blocks the open    *
+ *                  file holds, in as few runs as the free blocks allow,    *
+ *                  starting right after the file's previous block when     *
+ *                  that is free.  Each run is mapped into the inode and    *
+ *                  written to the device in a single request.  The blocks  *
+ *                  the file set aside are given up first, they are what    *
+ *                  the allocators take these from.                         *
+ *                                                                          *
+ *  returns - 0, or -1 if some of the data could not be placed.  It stays   *
+ *            held (and set aside) for a later call.                        */
+int32 fs_delay_flush(uint32 fd) {
+  filetable_t* f = &oft[fd];
+  uint32 index, goal, n, k, count, done = 0;
+  int32 start, result = 0;
+  char mask;
+
+  if (f->hcount == 0)
+    return 0;
+  mask = disable_interrupts();
+  count = f->hcount;
+  f->hcount = 0;                                     /*  No longer set aside  */
+  jnl_begin();
+  while (done < count) {
+    index = f->hfirst + done;
+    goal = (index > 0 ? fs_bmap(&f->inode, index - 1, BMAP_LOOKUP, NULL) : EMPTY);
+    if ((start = fs_alloc_extent(goal == EMPTY ? EMPTY : goal + 1, count - done, &n)) == -1) {
+      result = -1;
+      break;
+    }
+    k = 0;
+    while (k < n && fs_bmap_place(&f->inode, index + k, start + k, &f->dirty) != EMPTY)
+      k++;
+    for (uint32 i=k; i<n; i++)                       /*  Out of indirect blocks  */
+      fs_clearmaskbit(start + i);
+    if (k > 0)
+      bc_write_blocks(start, k, f->held + done * FS_BLOCK_SIZE);
+    done += k;
+    if (k < n) {
+      result = -1;
+      break;
+    }
+  }
+  jnl_end();
+  if (done < count) {                                /*  Keep what was not placed  */
+    memmove(f->held, f->held + done * FS_BLOCK_SIZE, (count - done) * FS_BLOCK_SIZE);
+    f->hfirst += done;
+    f->hcount = count - done;
+  }
+  restore_interrupts(mask);
+  return result;
+}
@@ -0,0 +1,108 @@
+#include <barelib.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+
+// Directories keep their entries in directory blocks, DIR_PER_BLOCK to a
+// block, mapped by the directory's inode like the blocks of a file.
+// Adding an entry only writes the directory block it lands in.  The
+// directory's inode (for the root directory, the super block) is only
+// written when the directory grows by a block.  With a journal these
+// writes join the running transaction instead (see system/journal.c).
+
+// Offset of entry 'i' within its directory block
+#define ENTRY_OFFSET(i) (((i) % DIR_PER_BLOCK) * sizeof(dirent_t))
+
+/* fs_dir_inode - Takes the inode block of a directory (ROOT_DIR for the   *
+ *                root directory) and a buffer for its inode.              *
+ *                                                                         *
+ *  returns - the root directory's inode in 'fsd', the inode read into     *
+ *            'buf' for any other directory, or NULL if it can't be read.  */
+inode_t* fs_dir_inode(uint32 block, inode_t* buf) {
+    if (block == ROOT_DIR) {
+        return &fsd->root_dir.inode;
+    }
+    if (bc_read(block, 0, buf, sizeof(inode_t)) == -1) {
+        return NULL;
+    }
+    return buf;
+}
+
+/* fs_dir_get - Takes a directory inode, the index of one of its entries  *
+ *              and a 'dirent_t' to copy the entry into.                  *
+ *                                                                        *
+ *  returns - 0 on success, -1 if the directory (NULL if it could not be  *
+ *            read) has no block for the entry.                           */
+int32 fs_dir_get(inode_t* dir, uint32 i, dirent_t* entry) {
+    uint32 block = (dir ? fs_bmap(dir, i / DIR_PER_BLOCK, BMAP_LOOKUP, NULL) : EMPTY);
+    if (block == EMPTY) {
+        return -1;
+    }
+    return bc_read(block, ENTRY_OFFSET(i), entry, sizeof(dirent_t));
+}
+
+/* fs_dir_put - Takes a directory inode, the index of one of its entries    *
+ *              and the new contents of the entry.                          *
+ *                                                                          *
+ *              The directory block holding the entry is allocated (from    *
+ *              the top of the device, see 'fs_alloc_high') and filled with *
+ *              unused entries if the directory does not reach that far     *
+ *              yet.  The block is written back to the device right away.   *
+ *                                                                          *
+ *  returns - 0 on success, -1 if there is no space for the directory       *
+ *            block.                                                        */
+int32 fs_dir_put(inode_t* dir, uint32 i, dirent_t* entry) {
+    uint32 index = i / DIR_PER_BLOCK;
+    uint32 block = fs_bmap(dir, index, BMAP_LOOKUP, NULL);
+    char grown = 0;
+
+    if (i >= DIR_SIZE) {
+        return -1;
+    }
+
+    //grow the directory by a block of unused entries
+    if (block == EMPTY) {
+        if ((block = fs_bmap(dir, index, BMAP_META, &grown)) == EMPTY) {
+            return -1;
+        }
+        bc_fill(block, 0xff);
+        if ((index + 1) * FS_BLOCK_SIZE > dir->size) {
+            dir->size = (index + 1) * FS_BLOCK_SIZE;
+        }
+        if (dir->id == ROOT_DIR && jnl_active()) {
+            if (jnl_write(SB_BIT, 0, fsd, sizeof(fsystem_t)) != 0) {
+                return -1;
+            }
+        } else if (dir->id == ROOT_DIR) {
+            bs_write(SB_BIT, 0, fsd, sizeof(fsystem_t));
+        } else {
+            if (jnl_write(dir->id, 0, dir, sizeof(inode_t)) != 0) {
+                return -1;
+            }
+            bc_sync_block(dir->id);
+        }
+    }
+
+    if (jnl_write(block, ENTRY_OFFSET(i), entry, sizeof(dirent_t)) != 0) {
+        return -1;
+    }
+    bc_sync_block(block);
+    return 0;
+}
+
+// Entries are appended, so a directory ends at the first unused entry
+// of its last block.
+uint32 fs_dir_count(inode_t* dir) {
+    uint32 nblocks = dir->size / FS_BLOCK_SIZE;
+    uint32 count;
+    dirent_t entry;
+
+    if (nblocks == 0) {
+        return 0;
+    }
+    count = (nblocks - 1) * DIR_PER_BLOCK;
+    while (count < nblocks * DIR_PER_BLOCK && fs_dir_get(dir, count, &entry) == 0 && entry.inode_block != EMPTY) {
+        count++;
+    }
+    return count;
+}
@@ -0,0 +1,92 @@
+#include <barelib.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+
+extern fsystem_t* fsd;
+
+/*
+ *  Small files kept in their inode block.  An 'inode_t' only takes the
+ *  start of its block, on a file system made with 'fs_inline_max' set
+ *  a file of at most 'fsd->inlinemax' bytes keeps its data in the rest
+ *  of that block instead of in a block of its own.  'blocks[0]' is then
+ *  INLINE_DATA and the other pointers stay EMPTY.  Creating a file zeroes
+ *  its inode block, so a hole inside an inline file reads as zeros.
+ *
+ *  The data goes through the same buffer as the inode, so writing a
+ *  small file and closing it writes a single block.  A write that would
+ *  take the file past 'inlinemax' first moves the data to an ordinary
+ *  block ('promote') and the file carries on like any other.
+ */
+
+#define INLINE_OFFSET sizeof(inode_t)    /*  Where the data starts in the inode block  */
+
+/*  Move the data of an inline file to a block of its own.  Returns  *
+ *  0, or -1 (and leaves the file inline) if there is no free block. */
+static int32 promote(inode_t* inode, char* dirty) {
+  uint32 block;
+  bcbuf_t* b;
+
+  inode->blocks[0] = EMPTY;
+  if ((block = fs_bmap(inode, 0, BMAP_ALLOC, dirty)) == EMPTY || (b = bc_get(block, 0)) == NULL) {
+    if (block != EMPTY)
+      fs_clearmaskbit(block);
+    inode->blocks[0] = INLINE_DATA;
+    return -1;
+  }
+  bc_read(inode->id, INLINE_OFFSET, b->data, inode->size);
+  memset(b->data + inode->size, 0, FS_BLOCK_SIZE - inode->size);
+  bc_put(b, 1);
+  *dirty = 1;
+  return 0;
+}
+
+/* fs_inline_write - Takes an inode, the byte of the file to write at, a    *
+ *                   buffer, its length and the flag to set when the inode  *
+ *                   changed.                                               *
+ *                                                                          *
+ *                   The write is made in the inode block when the file is  *
+ *                   inline (or still empty) and stays within 'inlinemax'.  *
+ *                   An inline file the write does not fit in is promoted   *
+ *                   to an ordinary block first.  The caller updates the    *
+ *                   size.                                                  *
+ *                                                                          *
+ *  returns - 0 if the data was written, 1 if the caller writes it to the   *
+ *            file's blocks, or -1 if an inline file could not be promoted. */
+int32 fs_inline_write(inode_t* inode, uint32 offset, char* buf, uint32 len, char* dirty) {
+  byte inlined = (inode->blocks[0] == INLINE_DATA);
+
+  if (fsd->inlinemax == 0 || len == 0)
+    return 1;
+  if (!inlined && (inode->size != 0 || inode->blocks[0] != EMPTY || inode->indirect != EMPTY || inode->dindirect != EMPTY))
+    return 1;
+  if (offset > fsd->inlinemax || len > fsd->inlinemax - offset) {
+    if (inlined && promote(inode, dirty) != 0)
+      return -1;
+    return 1;
+  }
+
+  if (jnl_write(inode->id, INLINE_OFFSET + offset, buf, len) != 0)
+    return -1;
+  if (!inlined) {
+    inode->blocks[0] = INLINE_DATA;
+    *dirty = 1;
+  }
+  return 0;
+}
+
+/* fs_inline_read - Takes an inode, the byte of the file to read from, a    *
+ *                  buffer and the number of bytes to read.                 *
+ *                                                                          *
+ *  returns - the number of bytes read (short at the end of the file), or   *
+ *            EMPTY if the file's data is not kept in its inode block.      */
+uint32 fs_inline_read(inode_t* inode, uint32 offset, char* buf, uint32 len) {
+  if (inode->blocks[0] != INLINE_DATA)
+    return EMPTY;
+  if (offset >= inode->size)
+    return 0;
+  if (len > inode->size - offset)
+    len = inode->size - offset;
+  bc_read(inode->id, INLINE_OFFSET + offset, buf, len);
+  return len;
+}
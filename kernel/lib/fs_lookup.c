@@ -0,0 +1,335 @@
+#include <barelib.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bcache.h>
+
+// Dentry cache.  Maps (directory, name) pairs to directory entries so
+// that resolving a path costs one hash lookup per component instead of
+// reading directory blocks.  The first lookup in a directory reads all
+// of its entries into the cache, along with a record of the directory
+// itself holding its number of entries.  From then on a name that is not
+// in the cache is not in the directory either.  Cached entries stay until
+// unmount, the table (open addressing) doubles whenever it is half full.
+//
+// Names recently looked up and not found are also remembered in a small
+// negative cache, which answers repeated misses without probing.
+//
+// The cache starts over whenever the root directory's entry count differs
+// from the one recorded (the directory was changed without going through
+// 'fs_mknod').
+
+#define NO_ENTRY   -1
+#define FREE_SLOT  -2      // 'entry' of an unused slot
+#define DIR_RECORD -3      // 'entry' of a directory's own record
+
+typedef struct dentry {
+    int32 entry;                   // Index of the entry in 'dir', FREE_SLOT or DIR_RECORD
+    uint32 dir;                    // Inode block of the directory
+    uint32 hash;                   // Hash of 'dir' and the entry's name
+    uint32 count;                  // DIR_RECORD only, the number of entries in 'dir'
+    dirent_t d;                    // Copy of the directory entry
+} dentry_t;
+
+typedef struct negent {
+    char valid;                    // Set when the slot holds a name
+    uint32 dir;                    // Directory the name is missing from
+    uint32 hash;                   // Hash of 'dir' and 'name'
+    char name[FILENAME_LEN];
+} negent_t;
+
+static dentry_t* slots = NULL;           // The cache, 'nslots' entries
+static uint32 nslots;                    // A power of 2 (0 while 'slots' is NULL)
+static uint32 used;                      // Slots that are not FREE_SLOT
+static negent_t negative[DIR_NEG_CACHE];
+static uint32 negnext;                   // Next negative cache slot to replace
+static dirstat_t stats;
+
+// FNV-1a over the directory block and at most FILENAME_LEN characters of 'name'
+static uint32 hash_name(uint32 dir, const char* name) {
+    uint32 h = 2166136261u;
+    for (int i = 0; i < 4; i++, dir >>= 8) {
+        h ^= (byte)dir;
+        h *= 16777619u;
+    }
+    for (int i = 0; i < FILENAME_LEN && name[i] != '\0'; i++) {
+        h ^= (byte)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static void drop(void) {
+    free(slots);
+    slots = NULL;
+    nslots = used = 0;
+    for (int i = 0; i < DIR_NEG_CACHE; i++) {
+        negative[i].valid = 0;
+    }
+}
+
+static void place(dentry_t* dentry) {
+    uint32 slot;
+    for (slot = dentry->hash & (nslots - 1); slots[slot].entry != FREE_SLOT; slot = (slot + 1) & (nslots - 1));
+    slots[slot] = *dentry;
+    used++;
+}
+
+// Make room for one more slot, doubling the table if it would be more
+// than half full.  Returns -1 if there is no memory for it.
+static int32 reserve(void) {
+    dentry_t* old = slots;
+    uint32 oldsz = nslots;
+
+    if (2 * (used + 1) <= nslots) {
+        return 0;
+    }
+    nslots = (oldsz ? 2 * oldsz : DIR_HASH_MIN);
+    if ((slots = malloc(nslots * sizeof(dentry_t))) == NULL) {
+        slots = old;
+        nslots = oldsz;
+        return -1;
+    }
+    heap_transfer(slots, M_KERNEL);
+    for (uint32 i = 0; i < nslots; i++) {
+        slots[i].entry = FREE_SLOT;
+    }
+    used = 0;
+    for (uint32 i = 0; i < oldsz; i++) {
+        if (old[i].entry != FREE_SLOT) {
+            place(&old[i]);
+        }
+    }
+    free(old);
+    return 0;
+}
+
+static dentry_t* find_record(uint32 dir) {
+    uint32 h = hash_name(dir, "");
+    for (uint32 slot = h & (nslots - 1); nslots && slots[slot].entry != FREE_SLOT; slot = (slot + 1) & (nslots - 1)) {
+        if (slots[slot].entry == DIR_RECORD && slots[slot].dir == dir) {
+            return &slots[slot];
+        }
+    }
+    return NULL;
+}
+
+static dentry_t* find_name(uint32 dir, const char* name, uint32 h) {
+    for (uint32 slot = h & (nslots - 1); nslots && slots[slot].entry != FREE_SLOT; slot = (slot + 1) & (nslots - 1)) {
+        stats.probes++;
+        if (slots[slot].entry >= 0 && slots[slot].hash == h && slots[slot].dir == dir &&
+            fs_strcmp(slots[slot].d.name, name) == 0) {
+            return &slots[slot];
+        }
+    }
+    return NULL;
+}
+
+// Read every entry of directory 'dir' into the cache and return the
+// directory's record, or NULL if the directory can't be read or there
+// is no memory to cache it (the cache is dropped in that case).
+static dentry_t* load(uint32 dir) {
+    bcbuf_t* b = NULL;
+    dentry_t dentry;
+    inode_t buf, *inode;
+    uint32 count, block;
+
+    if ((inode = fs_dir_inode(dir, &buf)) == NULL) {
+        return NULL;
+    }
+    count = (dir == ROOT_DIR ? fsd->root_dir.numentries : fs_dir_count(inode));
+    dentry.dir = dir;
+    for (uint32 i = 0; i < count; i++) {
+        if (i % DIR_PER_BLOCK == 0) {
+            if (b != NULL) {
+                bc_put(b, 0);
+            }
+            block = fs_bmap(inode, i / DIR_PER_BLOCK, BMAP_LOOKUP, NULL);
+            if (block == EMPTY || (b = bc_get(block, 1)) == NULL) {
+                drop();
+                return NULL;
+            }
+            stats.dirblocks++;
+        }
+        dentry.entry = i;
+        dentry.d = ((dirent_t*)b->data)[i % DIR_PER_BLOCK];
+        dentry.hash = hash_name(dir, dentry.d.name);
+        if (reserve() == -1) {
+            bc_put(b, 0);
+            drop();
+            return NULL;
+        }
+        place(&dentry);
+    }
+    if (b != NULL) {
+        bc_put(b, 0);
+    }
+
+    dentry.entry = DIR_RECORD;
+    dentry.hash = hash_name(dir, "");
+    dentry.count = count;
+    if (reserve() == -1) {
+        drop();
+        return NULL;
+    }
+    place(&dentry);
+    return find_record(dir);
+}
+
+// Start over (negative entries included) if the root directory's entry
+// count is not the one recorded, before anything cached about it is used
+static void check_root(uint32 dir) {
+    dentry_t* rec;
+    if (dir == ROOT_DIR && (rec = find_record(dir)) != NULL && rec->count != fsd->root_dir.numentries) {
+        drop();
+        stats.rebuilds++;
+    }
+}
+
+// Returns the record of 'dir', reading the directory into the cache if
+// it isn't there yet
+static dentry_t* record(uint32 dir, byte* loaded) {
+    dentry_t* rec;
+    check_root(dir);
+    rec = find_record(dir);
+    *loaded = (rec == NULL);
+    return (rec != NULL ? rec : load(dir));
+}
+
+// Used when the directory could not be cached, check every entry
+static int32 scan(uint32 dir, const char* name, dirent_t* found) {
+    inode_t buf, *inode = fs_dir_inode(dir, &buf);
+    uint32 count;
+    if (inode == NULL) {
+        return -1;
+    }
+    count = (dir == ROOT_DIR ? fsd->root_dir.numentries : fs_dir_count(inode));
+    for (uint32 i = 0; i < count; i++) {
+        if (fs_dir_get(inode, i, found) == 0 && fs_strcmp(found->name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Returns the negative cache slot holding 'name' in 'dir', or NO_ENTRY
+static int32 find_negative(uint32 dir, const char* name, uint32 h) {
+    for (int i = 0; i < DIR_NEG_CACHE; i++) {
+        if (negative[i].valid && negative[i].hash == h && negative[i].dir == dir &&
+            fs_strcmp(negative[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return NO_ENTRY;
+}
+
+/* fs_lookup - Takes the inode block of a directory (ROOT_DIR for the root  *
+ *             directory), a name and a 'dirent_t' to fill in, and finds    *
+ *             the entry with that name in the directory.                   *
+ *                                                                          *
+ *  returns - the index of the entry in the directory, or -1 if there is    *
+ *            no such entry.                                                */
+int32 fs_lookup(uint32 dir, const char* name, dirent_t* found) {
+    uint32 h = hash_name(dir, name);
+    dentry_t* dentry;
+    byte loaded;
+
+    stats.lookups++;
+    check_root(dir);
+    if (find_negative(dir, name, h) != NO_ENTRY) {
+        stats.neghits++;
+        stats.hits++;
+        return -1;
+    }
+    if (record(dir, &loaded) == NULL) {
+        stats.misses++;
+        return scan(dir, name, found);
+    }
+    if (loaded) {
+        stats.misses++;
+    } else {
+        stats.hits++;
+    }
+
+    if ((dentry = find_name(dir, name, h)) != NULL) {
+        *found = dentry->d;
+        return dentry->entry;
+    }
+
+    //remember the miss, replacing the oldest remembered name
+    if (fs_strlen(name) < FILENAME_LEN) {
+        negative[negnext].valid = 1;
+        negative[negnext].dir = dir;
+        negative[negnext].hash = h;
+        fs_strcpy(negative[negnext].name, name);
+        negnext = (negnext + 1) % DIR_NEG_CACHE;
+    }
+    return -1;
+}
+
+// Returns the number of entries in directory 'dir' (where the next one
+// is appended), or -1 if the directory can't be read
+int32 fs_dir_entries(uint32 dir) {
+    inode_t buf, *inode;
+    dentry_t* rec;
+    byte loaded;
+
+    if (dir == ROOT_DIR) {
+        return fsd->root_dir.numentries;
+    }
+    if ((rec = record(dir, &loaded)) != NULL) {
+        return rec->count;
+    }
+    if ((inode = fs_dir_inode(dir, &buf)) == NULL) {
+        return -1;
+    }
+    return fs_dir_count(inode);
+}
+
+// Called by 'fs_mknod' once entry 'i' of directory 'dir' has been
+// written (and, in the root directory, counted in 'numentries').
+void fs_dir_added(uint32 dir, uint32 i, dirent_t* d) {
+    dentry_t dentry, *rec;
+    int32 neg;
+
+    dentry.entry = i;
+    dentry.dir = dir;
+    dentry.hash = hash_name(dir, d->name);
+    dentry.d = *d;
+    if ((neg = find_negative(dir, d->name, dentry.hash)) != NO_ENTRY) {
+        negative[neg].valid = 0;
+    }
+
+    //a directory that isn't cached yet picks the entry up when it's read
+    if (find_record(dir) == NULL) {
+        return;
+    }
+    if (reserve() == -1) {
+        drop();
+        return;
+    }
+    rec = find_record(dir);
+    if (dir == ROOT_DIR && rec->count + 1 != fsd->root_dir.numentries) {
+        drop();
+        return;
+    }
+    place(&dentry);
+    rec->count++;
+}
+
+// Start with an empty cache on mount
+void fs_dir_init(void) {
+    slots = NULL;
+    nslots = used = 0;
+    for (int i = 0; i < DIR_NEG_CACHE; i++) {
+        negative[i].valid = 0;
+    }
+}
+
+// Release the cache on unmount
+void fs_dir_release(void) {
+    drop();
+}
+
+dirstat_t fs_dir_stats(void) {
+    return stats;
+}
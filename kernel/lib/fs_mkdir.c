@@ -0,0 +1,10 @@
+#include <barelib.h>
+#include <fs.h>
+
+/*  Create an empty directory at 'path'.  Every directory on  *
+ *  the way must already exist.  The new directory gets an    *
+ *  inode block like a file, its directory blocks are only    *
+ *  allocated once entries are added to it.                   */
+int32 fs_mkdir(char* path) {
+    return fs_mknod(path, DT_DIR);
+}
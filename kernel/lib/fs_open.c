@@ -1,41 +1,58 @@
 #include <barelib.h>
 #include <fs.h>
+#include <bcache.h>
+#include <lfs.h>
 
 extern fsystem_t* fsd;
 extern filetable_t oft[NUM_FD];
 
-/*  Search for a filename  in the directory, if the file doesn't exist  *
+/*  Search for a filename  in its directory, if the file doesn't exist  *
  *  or it is  already  open, return  an error.   Otherwise find a free  *
  *  slot in the open file table and initialize it to the corresponding  *
- *  inode in the root directory.                                        *
+ *  inode.  'filename' may be a path such as "/logs/a.txt".             *
  *  'head' is initialized to the start of the file.                     */
 
 
 int32 fs_open(char* filename) {
-  int i;
-  //iterate through directory
-  for(i = 0; i < fsd->root_dir.numentries; i++){
-    //check for filename
-    if(fs_strcmp(fsd->root_dir.entry[i].name, filename) == 0){
-      //check if file is already open
-      for(int j = 0; j < NUM_FD; j++){
-        if(oft[j].state == FSTATE_OPEN && oft[j].direntry == i){
+  //find the file through the dentry cache
+  uint32 parent;
+  char name[FILENAME_LEN];
+  dirent_t entry;
+  if(fs_walk(filename, &parent, name) == -1){
+    return -1;
+  }
+  int32 i = fs_lookup(parent, name, &entry);
+  if(i == -1 || entry.type != DT_FILE){
+    return -1;
+  }
+  //check if file is already open
+  for(int j = 0; j < NUM_FD; j++){
+    if(oft[j].state == FSTATE_OPEN && oft[j].inode.id == entry.inode_block){
+      return -1;
+    }
+  }
+  //check for open index in file table
+  for(int j = 0; j < NUM_FD; j++){
+    //populate element and read inode
+    if(oft[j].state == FSTATE_CLOSED){
+      oft[j].state = FSTATE_OPEN;
+      oft[j].direntry = i;
+      oft[j].parent = parent;
+      oft[j].head = 0;
+      oft[j].dirty = 0;
+      oft[j].held = NULL;
+      oft[j].hcount = 0;
+      //(a log-structured FS finds the inode through its inode map)
+      if(lfs_active()){
+        if(lfs_iget(entry.inode_block, &(oft[j].inode)) == -1){
+          oft[j].state = FSTATE_CLOSED;
           return -1;
         }
       }
-      //check for open index in file table
-      for(int j = 0; j < NUM_FD; j++){
-        //populate element and read inode
-        if(oft[j].state == FSTATE_CLOSED){
-          oft[j].state = FSTATE_OPEN;
-          oft[j].direntry = i;
-          oft[j].head = 0;
-          bs_read(fsd->root_dir.entry[i].inode_block, 0, &(oft[j].inode), sizeof(inode_t));
-          return j;
-        }
+      else{
+        bc_read(entry.inode_block, 0, &(oft[j].inode), sizeof(inode_t));
       }
-      
-      return -1;
+      return j;
     }
   }
   return -1;
@@ -0,0 +1,58 @@
+#include <barelib.h>
+#include <fs.h>
+
+// Copy the path component at the start of 'path' (after any '/') into
+// 'name'.  Returns the rest of the path, or NULL if the component does
+// not fit in a directory entry.
+static const char* component(const char* path, char* name) {
+    int len = 0;
+    while (*path == '/') {
+        path++;
+    }
+    while (*path != '\0' && *path != '/') {
+        if (len == FILENAME_LEN - 1) {
+            return NULL;
+        }
+        name[len++] = *path++;
+    }
+    name[len] = '\0';
+    return path;
+}
+
+/* fs_walk - Takes a path, a place to store the inode block of a directory  *
+ *           and a buffer of FILENAME_LEN bytes for a name.                 *
+ *                                                                          *
+ *           Paths are made of names separated by '/' and always start at   *
+ *           the root directory, "a.txt" and "/a.txt" are the same file.    *
+ *           Every name but the last is looked up (through the dentry       *
+ *           cache, see 'fs_lookup') and must be a directory.               *
+ *                                                                          *
+ *  returns - 0 with the directory that holds (or would hold) the last      *
+ *            name of the path in '*dir' and that name in 'name', or -1 if  *
+ *            the path is empty or goes through a missing directory.        */
+int32 fs_walk(const char* path, uint32* dir, char* name) {
+    char next[FILENAME_LEN];
+    dirent_t entry;
+
+    *dir = ROOT_DIR;
+    if ((path = component(path, name)) == NULL) {
+        return -1;
+    }
+    while (1) {
+        const char* rest = component(path, next);
+        if (rest == NULL) {
+            return -1;
+        }
+        if (next[0] == '\0') {
+            break;
+        }
+        //'name' is not the last component, step into it
+        if (fs_lookup(*dir, name, &entry) == -1 || entry.type != DT_DIR) {
+            return -1;
+        }
+        *dir = entry.inode_block;
+        fs_strcpy(name, next);
+        path = rest;
+    }
+    return (name[0] == '\0' ? -1 : 0);
+}
@@ -1,5 +1,7 @@
 #include <barelib.h>
 #include <fs.h>
+#include <bcache.h>
+#include <lfs.h>
 
 /* fs_read - Takes a file descriptor index into the 'oft', a  pointer to a  *
  *           buffer that the function writes data to and a number of bytes  *
@@ -7,40 +9,91 @@
  *                                                                          *
  *           'fs_read' reads data starting at the open file's 'head' until  *
  *           it has  copied either 'len' bytes  from the file's  blocks or  *
- *           the 'head' reaches the end of the file.                        *
+ *           the 'head' reaches the end of the file.  A hole (a block the   *
+ *           file never wrote, see 'fs_seek') reads as zeros without going  *
+ *           to the device.  A small file kept in its inode block is read   *
+ *           from there (see 'fs_inline_read').                             *
  *                                                                          *
  * returns - 'fs_read' should return the number of bytes read (either 'len' *
  *           or the  number of bytes  remaining in the file,  whichever is  *
- *           smaller).                                                      */
+ *           smaller), or -1 if blocks the file held back found no place.   */
 uint32 fs_read(uint32 fd, char* buff, uint32 len) {
     inode_t* fileinode = &oft[fd].inode;
     uint32 bytes_read = 0;
-    uint32 remaining = oft[fd].inode.size - oft[fd].head; 
+    uint32 remaining = (oft[fd].head < oft[fd].inode.size ? oft[fd].inode.size - oft[fd].head : 0);
     uint32 offset = oft[fd].head;
+    //a read of more than one block gathers its whole blocks into a
+    //list of segments that goes to the device in a single request
+    bsvec_t vec[FS_IOV_MAX];
+    uint32 nvec = 0;
+
+    //a log-structured FS holds written blocks back, they go out first
+    //(as do the blocks this file holds back, see lib/fs_delay.c)
+    lfs_flush();
+    if (fs_delay_flush(fd) != 0) {
+        return -1;
+    }
+
+    //a small file is read from its inode block
+    uint32 inlined = fs_inline_read(fileinode, offset, buff, len);
+    if (inlined != EMPTY) {
+        oft[fd].head = offset + inlined;
+        return inlined;
+    }
 
     //loop until either len bytes are read or offset reaches file size
     while (bytes_read < len && offset < fileinode->size) {
         //calculate index for block
-        uint32 block_index = offset / MDEV_BLOCK_SIZE;
+        uint32 block_index = offset / FS_BLOCK_SIZE;
         //calculate offset for block
-        uint32 block_offset = offset % MDEV_BLOCK_SIZE;
+        uint32 block_offset = offset % FS_BLOCK_SIZE;
         //initialize variable for number of bytes to read
         uint32 bytes_to_read;
 
         //declare variable for number of bytes to read depending on case
-        if (MDEV_BLOCK_SIZE - block_offset < len - bytes_read) {
-            bytes_to_read = MDEV_BLOCK_SIZE - block_offset;
+        if (FS_BLOCK_SIZE - block_offset < len - bytes_read) {
+            bytes_to_read = FS_BLOCK_SIZE - block_offset;
         } else {
             bytes_to_read = len - bytes_read;
         }
 
+        //whole blocks inside the file are added to the list a run of
+        //contiguous device blocks at a time
+        uint32 nblocks = 0;
+        uint32 max_blocks = (len - bytes_read) / FS_BLOCK_SIZE;
+        uint32 file_blocks = (fileinode->size - offset + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+        uint32 block;
+        if (len > FS_BLOCK_SIZE && block_offset == 0 && max_blocks > 0) {
+            block = fs_bmap_run(fileinode, block_index, (max_blocks < file_blocks ? max_blocks : file_blocks), 0, NULL, &nblocks);
+        } else {
+            block = fs_bmap(fileinode, block_index, 0, NULL);
+        }
+
         //read data from block to buff plus number of bytes that have been read already
-        bs_read(fileinode->blocks[block_index], block_offset, buff + bytes_read, bytes_to_read);
+        //(a hole has no block and is all zeros)
+        if (block == EMPTY) {
+            memset(buff + bytes_read, 0, bytes_to_read);
+        } else if (nblocks > 0) {
+            bytes_to_read = nblocks * FS_BLOCK_SIZE;
+            vec[nvec].block = block;
+            vec[nvec].offset = 0;
+            vec[nvec].buf = buff + bytes_read;
+            vec[nvec].len = bytes_to_read;
+            if (++nvec == FS_IOV_MAX) {
+                bc_readv(vec, nvec);
+                nvec = 0;
+            }
+        } else {
+            bc_read(block, block_offset, buff + bytes_read, bytes_to_read);
+        }
         
         //update offset and bytes_read
         offset += bytes_to_read;
         bytes_read += bytes_to_read;
     }
+    if (nvec > 0) {
+        bc_readv(vec, nvec);
+    }
 
     //update head position
     oft[fd].head = offset;
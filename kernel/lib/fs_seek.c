@@ -1,11 +1,42 @@
 #include <barelib.h>
 #include <fs.h>
 
-/* fs_write - Takes a file descriptor index  into the 'oft' and an  integer  *
- *            offset.  'fs_seek' moves the current head to match the given   *
- *            offset, bounded by the size of the file.                       *
+extern fsystem_t* fsd;
+extern filetable_t oft[NUM_FD];
+
+/* fs_seek - Takes a file descriptor index into the 'oft', an offset and     *
+ *           where it counts from.  'fs_seek' moves the current head to      *
+ *           'offset' bytes from the start of the file (SEEK_START), down    *
+ *           from the end of the file (SEEK_END) or on from the current     *
+ *           head (SEEK_HEAD).  The last two take the offset as signed.      *
+ *                                                                           *
+ *           The head may be moved past the end of the file, up to the      *
+ *           largest file size.  A write there leaves the blocks it skips   *
+ *           unallocated (a hole), and reading them returns zeros.           *
  *                                                                           *
- *  returns - 'fs_seek' should return the new position of the file head      */
+ *  returns - 'fs_seek' should return the new position of the file head,     *
+ *            or -1 if the file is not open or 'relative' is unknown.        */
 uint32 fs_seek(uint32 fd, uint32 offset, uint32 relative) {
-  return 0;
+  uint64 max = (uint64)INODE_MAX_BLOCKS * FS_BLOCK_SIZE;
+  int64 head;
+
+  if (fd >= NUM_FD || oft[fd].state != FSTATE_OPEN)
+    return -1;
+  if (relative == SEEK_START)
+    head = offset;
+  else if (relative == SEEK_END)
+    head = (int64)oft[fd].inode.size - (int32)offset;
+  else if (relative == SEEK_HEAD)
+    head = (int64)oft[fd].head + (int32)offset;
+  else
+    return -1;
+
+  if (max > 0xffffffff)                             /*  Sizes are kept in 32 bits  */
+    max = 0xffffffff;
+  if (head < 0)
+    head = 0;
+  if ((uint64)head > max)
+    head = max;
+  oft[fd].head = head;
+  return oft[fd].head;
 }
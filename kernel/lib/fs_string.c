@@ -1,7 +1,32 @@
 #include <barelib.h>
 #include <fs.h>
 
+/*  Strings are scanned a 64-bit word at a time once the pointer is   *
+ *  aligned.  An aligned word never crosses a page, so reading past   *
+ *  the terminator inside the last word is safe.                      */
+#define WORD_MASK   7
+#define ONES        0x0101010101010101UL
+#define HIGHS       0x8080808080808080UL
+#define has_zero(w) (((w) - ONES) & ~(w) & HIGHS)   /*  Non-zero if any byte of 'w' is 0  */
+
 int32 fs_strcmp(const char* str1, const char* str2) {
+    const uint64 *w1, *w2;
+    if (((uint64)str1 & WORD_MASK) == ((uint64)str2 & WORD_MASK)) {
+        while (((uint64)str1 & WORD_MASK) && *str1 && *str1 == *str2) {
+            str1++;
+            str2++;
+        }
+        if (((uint64)str1 & WORD_MASK) == 0) {
+            w1 = (const uint64*)str1;
+            w2 = (const uint64*)str2;
+            while (*w1 == *w2 && !has_zero(*w1)) {   /*  Equal words with no terminator  */
+                w1++;
+                w2++;
+            }
+            str1 = (const char*)w1;
+            str2 = (const char*)w2;
+        }
+    }
     while (*str1 && (*str1 == *str2)) {
         str1++;
         str2++;
@@ -19,11 +44,18 @@ char* fs_strcpy(char* destination, const char* source) {
 }
 
 int fs_strlen(const char* str) {
-    int length = 0;
-    while (*str != '\0') {
-        length++;
+    const char* start = str;
+    const uint64* w;
+    while ((uint64)str & WORD_MASK) {
+        if (*str == '\0')
+            return str - start;
         str++;
     }
-    return length;
+    w = (const uint64*)str;
+    while (!has_zero(*w))
+        w++;
+    str = (const char*)w;
+    while (*str != '\0')
+        str++;
+    return str - start;
 }
-            
\ No newline at end of file
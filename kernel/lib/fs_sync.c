@@ -0,0 +1,96 @@
+#include <barelib.h>
+#include <interrupts.h>
+#include <thread.h>
+#include <sleep.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
+
+extern fsystem_t* fsd;
+extern filetable_t oft[NUM_FD];
+
+/*  Write the blocks of the free bitmask that changed since they  *
+ *  were last written back to the block device, along with the    *
+ *  super block that holds the count of free blocks.  The bitmask  *
+ *  of a log-structured FS is only written by its checkpoints.     *
+ *  Returns -1 if a write failed (what was not written stays       *
+ *  dirty for the next call).                                      */
+int32 fs_flush_freemask(void) {
+  int32 result = 0;
+  if (fsd == NULL || !fsd->maskdirty || lfs_active())
+    return 0;
+  for (uint32 b = 0; b < fsd->maskblocks; b++)
+    if ((fsd->maskstate[b] & MASK_DIRTY) && fs_maskio(b, 1) != 0)
+      result = -1;
+  if ((jnl_active() ? jnl_write(SB_BIT, 0, fsd, sizeof(fsystem_t))
+                    : bs_write(SB_BIT, 0, fsd, sizeof(fsystem_t))) != 0)
+    result = -1;
+  if (result == 0)
+    fsd->maskdirty = 0;
+  return result;
+}
+
+/* fs_sync - Writes every dirty inode in the open file table, every dirty  *
+ *           buffer in the block cache and the free bitmask back to the    *
+ *           block device.  'fs_write' only marks the metadata it changes  *
+ *           as dirty and leaves data in the cache, so this (or            *
+ *           'fs_close' for the inode) is what makes changes durable.      *
+ *           With a journal the metadata is committed to it instead, all   *
+ *           the operations since the last call share a single commit.     *
+ *           A log-structured FS takes a checkpoint (see system/lfs.c).    *
+ *           Blocks open files hold back are placed and written first.     *
+ *                                                                         *
+ *  returns - 0 on success, -1 if no file system is mounted, some of the   *
+ *            blocks held back found no place or the metadata could not    *
+ *            be written (the rest is synced).                             */
+int32 fs_sync(void) {
+  char mask;
+  int32 result = 0;
+  if (fsd == NULL)
+    return -1;
+
+  mask = disable_interrupts();
+  if (lfs_active()) {
+    lfs_checkpoint();
+    restore_interrupts(mask);
+    return 0;
+  }
+  for (int i = 0; i < NUM_FD; i++) {
+    if (oft[i].state == FSTATE_OPEN && fs_delay_flush(i) != 0)
+      result = -1;             /*  Blocks held back are placed, which changes the inode  */
+    if (oft[i].state == FSTATE_OPEN && oft[i].dirty) {
+      if (jnl_write(oft[i].inode.id, 0, &oft[i].inode, sizeof(inode_t)) == 0)
+        oft[i].dirty = 0;
+      else
+        result = -1;
+    }
+  }
+  if (jnl_active()) {
+    if (fs_flush_freemask() != 0)  /*  Joins the transaction, which is committed after the data  */
+      result = -1;
+    if (jnl_commit() != 0)
+      result = -1;
+  }
+  else {
+    bs_plug();               /*  The writes of the flush reach the device sorted and merged  */
+    if (bc_flush() != 0)
+      result = -1;
+    if (fs_flush_freemask() != 0)
+      result = -1;
+    bs_unplug();
+  }
+  restore_interrupts(mask);
+  return result;
+}
+
+/*  Body of the metadata flusher thread started by the shell.  It  *
+ *  calls 'fs_sync' every 'FS_FLUSH_TICKS' timer ticks so dirty    *
+ *  metadata never stays in memory for long.                        */
+byte fs_flusher(char* arg) {
+  while (1) {
+    sleep(current_thread, FS_FLUSH_TICKS);
+    fs_sync();
+  }
+  return 0;
+}
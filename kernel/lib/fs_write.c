@@ -1,5 +1,8 @@
 #include <barelib.h>
 #include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
 
 /* fs_write - Takes a file descriptor index into the 'oft', a  pointer to a  *
  *            buffer  that the  function reads data  from and the number of  *
@@ -8,72 +11,139 @@
  *            'fs_write' reads data from the 'buff' and copies it into the   *
  *            file  'blocks' starting  at the 'head'.  The  function  will   *
  *            allocate new blocks from the block device as needed to write   *
- *            data to the file and assign them to the file's inode.          *
+ *            data to the file and assign them to the file's inode (see      *
+ *            'fs_bmap' for files larger than INODE_BLOCKS blocks).  Only    *
+ *            the blocks written to are allocated, a head moved past the     *
+ *            end of the file leaves a hole behind (see 'fs_seek').  The     *
+ *            rest of a new block written in part is zeroed.  A small file   *
+ *            is kept in its inode block instead (see 'fs_inline_write'),    *
+ *            and new blocks may be held back to be placed later (see        *
+ *            'fs_delay_write').                                             *
  *                                                                           *
  *  returns - 'fs_write' should return the number of bytes written to the    *
- *            file.                                                          */
+ *            file, which is short if the device or the largest file size    *
+ *            ran out (-1 if nothing could be written).                      */
 
 uint32 fs_write(uint32 fd, char* buff, uint32 len) {
     //initialize inode, bytes_written and offset to track and perform write
     inode_t* fileinode = &oft[fd].inode;
     uint32 bytes_written = 0;
     uint32 offset = oft[fd].head;
+    //a write of more than one block gathers its whole blocks into a
+    //list of segments that goes to the device in a single request
+    bsvec_t vec[FS_IOV_MAX];
+    uint32 nvec = 0;
 
-    //write until 'len' bytes are written
-    while (bytes_written < len) {
+    //indirect blocks filled in below join the journal as one operation
+    jnl_begin();
+
+    //a small file is written in its inode block, one growing past
+    //that moves to a block of its own first.  blocks the file does
+    //not have yet may be held back and given a place later instead
+    int32 inlined = fs_inline_write(fileinode, offset, buff, len, &oft[fd].dirty);
+    if (inlined == 1) {
+        inlined = fs_delay_write(fd, offset, buff, len);
+    }
+    if (inlined == 0) {
+        bytes_written = len;
+        offset += len;
+    }
+
+    //a log-structured file system writes every block at the head of
+    //its log instead (see system/lfs.c)
+    if (inlined == 1 && lfs_active()) {
+        bytes_written = lfs_write(fileinode, offset, buff, len, &oft[fd].dirty);
+        offset += bytes_written;
+    }
+
+    //write until 'len' bytes are written.  with a journal a long write
+    //is several operations, each covering up to INODE_PTRS blocks, so
+    //the indirect blocks one fills in always fit in a transaction
+    uint32 opfirst = offset / FS_BLOCK_SIZE;
+    while (inlined == 1 && !lfs_active() && bytes_written < len) {
         //calculate index for block
-        uint32 block_index = offset / MDEV_BLOCK_SIZE;
+        uint32 block_index = offset / FS_BLOCK_SIZE;
         //calculate offset for block
-        uint32 block_offset = offset % MDEV_BLOCK_SIZE;
+        uint32 block_offset = offset % FS_BLOCK_SIZE;
 
         //declare variable to keep track of bytes left to write
         uint32 bytes_to_write;
 
         //ensure writing to block wont surpass len
-        if (MDEV_BLOCK_SIZE - block_offset < len - bytes_written) {
-            bytes_to_write = MDEV_BLOCK_SIZE - block_offset;
+        if (FS_BLOCK_SIZE - block_offset < len - bytes_written) {
+            bytes_to_write = FS_BLOCK_SIZE - block_offset;
         } else {
             bytes_to_write = len - bytes_written;
         }
 
-        //check if a block has not already been allocated
-        if (fileinode->blocks[block_index] == EMPTY) {
-            //find new block to allocate
-            uint32 new_block = -1;
-            for (uint32 i = 0; i < fsd->device.nblocks; i++) {
-              if (fs_getmaskbit(i) == 0) {
-                  fs_setmaskbit(i);
-                  new_block = i;
-                  break;
-              }
-            }
-            if (new_block == -1) {
-                return -1;
+        //find the block, allocating it (and indirect blocks) if needed.
+        //whole blocks are looked up as a run of contiguous device blocks
+        uint32 nblocks = 0;
+        uint32 block;
+        uint32 max_blocks = (len - bytes_written) / FS_BLOCK_SIZE;
+        if (len > FS_BLOCK_SIZE && block_offset == 0 && max_blocks > 0) {
+            block = fs_bmap_run(fileinode, block_index, (max_blocks < INODE_PTRS ? max_blocks : INODE_PTRS), 1, &oft[fd].dirty, &nblocks);
+        } else if ((block = fs_bmap(fileinode, block_index, 0, NULL)) == EMPTY) {
+            //a new block written in part must not show what it held before
+            if ((block = fs_bmap(fileinode, block_index, 1, &oft[fd].dirty)) != EMPTY) {
+                bc_fill(block, 0);
             }
-            fileinode->blocks[block_index] = new_block;
-            fileinode->size += MDEV_BLOCK_SIZE;
+        }
+        if (block == EMPTY) {
+            break;
         }
 
-        //write data from buffer to allocated block
-        bs_write(fileinode->blocks[block_index], block_offset, buff + bytes_written, bytes_to_write);
+        //write data from buffer to allocated block, a run of whole
+        //blocks is added to the list as a single segment
+        if (nblocks > 0) {
+            bytes_to_write = nblocks * FS_BLOCK_SIZE;
+            vec[nvec].block = block;
+            vec[nvec].offset = 0;
+            vec[nvec].buf = buff + bytes_written;
+            vec[nvec].len = bytes_to_write;
+            if (++nvec == FS_IOV_MAX) {
+                bc_writev(vec, nvec);
+                nvec = 0;
+            }
+        } else {
+            bc_write(block, block_offset, buff + bytes_written, bytes_to_write);
+        }
 
         //update offset and written variable with bytes that were written
         offset += bytes_to_write;
         bytes_written += bytes_to_write;
+
+        //the data goes to the cache before the operation mapping it ends
+        //(and may commit)
+        if (jnl_active() && offset / FS_BLOCK_SIZE - opfirst >= INODE_PTRS) {
+            if (nvec > 0) {
+                bc_writev(vec, nvec);
+                nvec = 0;
+            }
+            jnl_end();
+            jnl_begin();
+            opfirst = offset / FS_BLOCK_SIZE;
+        }
+    }
+    if (nvec > 0) {
+        bc_writev(vec, nvec);
+    }
+    jnl_end();
+
+    if (bytes_written == 0 && len > 0) {
+        return -1;
     }
 
     //update file head to new offset
     oft[fd].head = offset;
 
     //update inode size if new offset exceeds previous size
+    //(the inode and freemask are only marked dirty here, fs_sync or
+    //fs_close write them back to the block device)
     if (oft[fd].head > fileinode->size) {
         fileinode->size = oft[fd].head;
+        oft[fd].dirty = 1;
     }
 
-    //write updated inode info to disk
-    bs_write(fileinode->id, 0, fileinode, sizeof(inode_t));
-    //write freemask after allocations and writes
-    bs_write(BM_BIT, 0, fsd->freemask, fsd->freemasksz);
-
     return bytes_written;
 }
@@ -1,10 +1,19 @@
 #include <barelib.h>
+#include <bareio.h>
 #include <malloc.h>
 #include <thread.h>
 
 extern uint32* mem_start;
 extern uint32* mem_end;
 static alloc_t* freelist;
+static char* heap_limit;    /*  Address directly after the last block of the heap        */
+static uint64 heap_used;    /*  Bytes currently handed out to allocations (w/o headers)  */
+static uint64 heap_peak;    /*  Highest value 'heap_used' has reached since 'heap_init'  */
+static uint64 heap_allocs;  /*  Number of allocations currently live                     */
+static uint64 heap_kernel;  /*  Bytes owned by M_KERNEL, which has no thread table slot  */
+
+
+#define block_end(b) ((char*)(b) + sizeof(alloc_t) + (b)->size)  /*  Address directly after a block  */
 
 /*  Sets the 'freelist' to 'mem_start' and creates  *
  *  a free allocation at that location for the      *
@@ -15,6 +24,87 @@ void heap_init(void) {
   freelist->size = get_stack(NTHREADS) - mem_start - sizeof(alloc_t);
   freelist->state = M_FREE;
   freelist->next = NULL;
+  heap_limit = block_end(freelist);
+  heap_used = heap_peak = heap_allocs = heap_kernel = 0;
+  for (int i=0; i<NTHREADS; i++)
+    thread_table[i].memused = 0;
+}
+
+/*  Returns the thread new allocations belong to.  Memory taken  *
+ *  outside of a running thread (e.g. during boot) is owned by   *
+ *  the kernel.                                                  */
+static uint32 heap_owner(void) {
+  if (current_thread < NTHREADS && thread_table[current_thread].state == TH_RUNNING)
+    return current_thread;
+  return M_KERNEL;
+}
+
+/*  Record that 'size' more bytes are handed out to 'block'  */
+static void heap_grow(alloc_t* block, uint64 size) {
+  heap_used += size;
+  if (block->owner < NTHREADS)
+    thread_table[block->owner].memused += size;
+  else if (block->owner == M_KERNEL)
+    heap_kernel += size;
+  if (heap_used > heap_peak)
+    heap_peak = heap_used;
+}
+
+/*  Record that 'block' gave 'size' bytes back to the heap  */
+static void heap_shrink(alloc_t* block, uint64 size) {
+  heap_used -= size;
+  if (block->owner < NTHREADS)
+    thread_table[block->owner].memused -= size;
+  else if (block->owner == M_KERNEL)
+    heap_kernel -= size;
+}
+
+/*  Places 'block' on the freelist at its address-ordered position and  *
+ *  coalesces it with the free blocks directly before and after it.     */
+static void insert_free(alloc_t* block) {
+  alloc_t* curr = freelist;
+  alloc_t* prev = NULL;
+
+  //find the free blocks on either side, the freelist is kept in address order
+  while (curr != NULL && curr < block) {
+    prev = curr;
+    curr = curr->next;
+  }
+
+  //add freed block to list
+  block->state = M_FREE;
+  block->next = curr;
+  if (prev != NULL) {
+    prev->next = block;
+  } else {
+    freelist = block;
+  }
+
+  //coalesce up
+  if (curr != NULL && block_end(block) == (char*)curr) {
+    block->size += sizeof(alloc_t) + curr->size;
+    block->next = curr->next;
+  }
+
+  //coalesce down
+  if (prev != NULL && block_end(prev) == (char*)block) {
+    prev->size += sizeof(alloc_t) + block->size;
+    prev->next = block->next;
+  }
+}
+
+/*  Shrinks the allocation 'block' down to 'size' bytes.  If    *
+ *  enough space remains for another header, the tail becomes  *
+ *  a new free block and is returned to the freelist.           */
+static void split_block(alloc_t* block, uint64 size) {
+  alloc_t* tail;
+  if (block->size <= size + sizeof(alloc_t))
+    return;
+  tail = (alloc_t*)((char*)block + sizeof(alloc_t) + size);
+  tail->size = block->size - size - sizeof(alloc_t);
+  heap_shrink(block, block->size - size);
+  block->size = size;
+  insert_free(tail);
 }
 
 /*  Locates a free block large enough to contain a new    *
@@ -29,8 +119,8 @@ void* malloc(uint64 size) {
   while (curr != NULL) {
     //if block is free and appropriate size
     if (curr->state == M_FREE && curr->size >= size) {
-      //if size is same as requested size, set as used
-      if (curr->size == size) {
+      //if the leftover space cannot hold another block, hand out the whole block
+      if (curr->size <= size + sizeof(alloc_t)) {
         curr->state = M_USED;
       } else {
         //reallocate block to appropriate size if it is too large
@@ -51,14 +141,17 @@ void* malloc(uint64 size) {
         //at the next block after current
         freelist = curr->next;
       }
+      curr->owner = heap_owner();
+      heap_grow(curr, curr->size);
+      heap_allocs++;
       //return address of current +1
-      return (void*)(curr+1); 
+      return (void*)(curr+1);
     }
     prev = curr;
     curr = curr->next;
   }
 
-  return NULL; 
+  return NULL;
 }
 
 /*  Free the allocation at location 'addr'.  If the newly *
@@ -70,62 +163,157 @@ void free(void* addr) {
         return;
 
     alloc_t* freeblock = (alloc_t*)addr - 1;
-    alloc_t* curr = freelist;
-    alloc_t* prev = NULL;
+    heap_shrink(freeblock, freeblock->size);
+    heap_allocs--;
+    insert_free(freeblock);
+}
 
-    while (curr != NULL && curr < freeblock) {
-        prev = curr;
-        curr = curr->next;
-    }
+/*  Allocates space for 'count' elements of 'size' bytes  *
+ *  and clears the memory before returning it.            */
+void* calloc(uint64 count, uint64 size) {
+  void* addr;
+  uint64 total = count * size;
+  if (size != 0 && total / size != count)         /*  Reject requests that overflow  */
+    return NULL;
+  if ((addr = malloc(total)) != NULL)
+    memset(addr, 0, total);
+  return addr;
+}
 
-    //add freed block to list
-    if (prev != NULL) {
-        prev->next = freeblock;
-    } else {
-        freelist = freeblock;
-    }
+/*  Resizes the allocation at 'addr' to 'size' bytes.  Shrinking   *
+ *  and growing into a directly following free block are done in   *
+ *  place, otherwise the data is moved to a new allocation.         */
+void* realloc(void* addr, uint64 size) {
+  alloc_t* block;
+  alloc_t* curr = freelist;
+  alloc_t* prev = NULL;
+  void* moved;
 
-    //coalesce up
-    if (freeblock->next != NULL && (char*)freeblock + sizeof(alloc_t) + freeblock->size == (char*)freeblock->next) {
-        freeblock->size += sizeof(alloc_t) + freeblock->next->size;
-        freeblock->next = freeblock->next->next;
-    }
+  if (addr == NULL)
+    return malloc(size);
+  if (size == 0) {
+    free(addr);
+    return NULL;
+  }
 
-    //coalesce down
-    if (prev != NULL && (char*)prev + sizeof(alloc_t) + prev->size == (char*)freeblock) {
-        prev->size += sizeof(alloc_t) + freeblock->size;
-        prev->next = freeblock->next;
-        freeblock = prev;
-    }
+  block = (alloc_t*)addr - 1;
+  if (size <= block->size) {                                       /*  Shrink in place  */
+    split_block(block, size);
+    return addr;
+  }
 
-    // mark as free
-    freeblock->state = M_FREE;
-
-    // check that addresses increase monotonically
-    if (prev != NULL && prev > freeblock) {
-        if (prev == freelist) {
-            freelist = freeblock;
-        } else {
-            alloc_t* temp = freelist;
-            while (temp->next != freeblock) {
-                temp = temp->next;
-            }
-            temp->next = prev;
-        }
-        prev->next = curr;
-    } else {
-        freeblock->next = curr;
-    }
+  while (curr != NULL && (char*)curr < block_end(block)) {        /*  Locate the block that follows this allocation  */
+    prev = curr;                                                   /*  in the freelist                                */
+    curr = curr->next;
+  }
+  if (curr != NULL && (char*)curr == block_end(block) &&          /*  Grow in place if the neighbor is free and  */
+      block->size + sizeof(alloc_t) + curr->size >= size) {        /*  large enough                               */
+    if (prev != NULL)
+      prev->next = curr->next;
+    else
+      freelist = curr->next;
+    block->size += sizeof(alloc_t) + curr->size;
+    heap_grow(block, sizeof(alloc_t) + curr->size);
+    split_block(block, size);
+    return addr;
+  }
 
-    //check for downward coalescing
-    if (freeblock->next != NULL && ((char*)freeblock + sizeof(alloc_t) + freeblock->size) == (char*)freeblock->next) {
-        freeblock->size += sizeof(alloc_t) + freeblock->next->size;
-        freeblock->next = freeblock->next->next;
-    }
+  if ((moved = malloc(size)) == NULL)                              /*  Fall back to allocate, copy and free  */
+    return NULL;
+  memcpy(moved, addr, block->size);
+  heap_transfer(moved, block->owner);                              /*  The moved block keeps its original owner  */
+  free(addr);
+  return moved;
+}
 
-    //check for upward coalescing
-    if (prev != NULL && ((char*)prev + sizeof(alloc_t) + prev->size) == (char*)freeblock) {
-        prev->size += sizeof(alloc_t) + freeblock->size;
-        prev->next = freeblock->next;
-    }
+/*  Allocates 'size' bytes at an address that is a multiple of   *
+ *  'align' (a power of two).  The allocation is over-sized so   *
+ *  the unaligned head can be split off and returned to the      *
+ *  freelist.                                                     */
+void* aligned_alloc(uint64 align, uint64 size) {
+  alloc_t *block, *aligned;
+  uint64 addr, gap;
+  char* raw;
+
+  if (align == 0 || (align & (align - 1)) != 0)
+    return NULL;
+  if ((raw = malloc(size + align + sizeof(alloc_t))) == NULL)
+    return NULL;
+  block = (alloc_t*)raw - 1;
+  if (((uint64)raw & (align - 1)) == 0) {
+    split_block(block, size);
+    return raw;
+  }
+
+  addr = ((uint64)raw + sizeof(alloc_t) + align - 1) & ~(align - 1); /*  Leave room for the head to become a block  */
+  gap = addr - (uint64)raw;
+  aligned = (alloc_t*)addr - 1;
+  aligned->size = block->size - gap;
+  aligned->state = M_USED;
+  aligned->owner = block->owner;
+  aligned->next = NULL;
+  block->size = gap - sizeof(alloc_t);
+  heap_shrink(aligned, gap);
+  insert_free(block);
+  split_block(aligned, size);
+  return (void*)addr;
+}
+
+/*  Fills 'stats' with the current state of the heap.  The usage  *
+ *  counters are kept up to date by the allocator while the free  *
+ *  space figures are gathered by walking the freelist.           */
+void heap_stats(heapstat_t* stats) {
+  alloc_t* curr;
+  stats->size = heap_limit - (char*)mem_start;
+  stats->used = heap_used;
+  stats->peak = heap_peak;
+  stats->allocs = heap_allocs;
+  stats->kernel = heap_kernel;
+  stats->free = stats->freeblocks = stats->largest = 0;
+  for (curr = freelist; curr != NULL; curr = curr->next) {
+    stats->free += curr->size;
+    stats->freeblocks++;
+    if (curr->size > stats->largest)
+      stats->largest = curr->size;
+  }
+  stats->frag = (stats->free ? ((stats->free - stats->largest) * 100) / stats->free : 0);
+}
+
+/*  Print every block on the heap in address order, used and free  */
+void heap_print_map(void) {
+  alloc_t* block = (alloc_t*)mem_start;
+  printf("\n    heap map\n");
+  printf("address      size        state\n");
+  while ((char*)block < heap_limit) {
+    printf("%x  %d  %s\n", block, block->size, (block->state == M_FREE ? "free" : "used"));
+    block = (alloc_t*)block_end(block);
+  }
+}
+
+/*  Moves ownership of the allocation at 'addr' to thread 'tid'  *
+ *  (or M_KERNEL) so it survives the original owner exiting.     */
+int32 heap_transfer(void* addr, uint32 tid) {
+  alloc_t* block;
+  if (addr == NULL || tid > M_KERNEL)
+    return -1;
+  block = (alloc_t*)addr - 1;
+  heap_shrink(block, block->size);
+  block->owner = tid;
+  heap_grow(block, block->size);
+  return 0;
+}
+
+/*  Frees every allocation still owned by thread 'tid'.  Called  *
+ *  when a thread is reaped so its memory is not leaked.         */
+void heap_reclaim(uint32 tid) {
+  alloc_t* block = (alloc_t*)mem_start;
+  alloc_t* next;
+  if (tid >= M_KERNEL)
+    return;
+  while ((char*)block < heap_limit && thread_table[tid].memused > 0) {
+    next = (alloc_t*)block_end(block);     /*  A freed block may coalesce, so step over it first  */
+    if (block->state == M_USED && block->owner == tid)
+      free((void*)(block + 1));
+    block = next;
+  }
 }
@@ -0,0 +1,100 @@
+	.file "memvec.s"
+	.option arch, +v
+
+#  RISC-V Vector (RVV 1.0) versions of the memory routines in 'barelib.c'.
+#  They are only called once 'mem_init' has seen the 'V' bit in 'misa' and
+#  the bootstrap has switched on the vector unit (mstatus.VS).  Callers make
+#  sure 'n' is greater than zero and disable interrupts around the call as
+#  the vector registers are not part of a thread's saved context.
+
+
+#  'vec_memcpy' copies 'a2' bytes from 'a1' to 'a0' (non-overlapping or 'a0' < 'a1')
+.globl vec_memcpy
+vec_memcpy:
+	mv t0, a0                         # --
+1:	vsetvli t1, a2, e8, m8, ta, ma    #  |
+	vle8.v v0, (a1)                   #  |
+	vse8.v v0, (t0)                   #  |    Move one register group (LMUL=8) per iteration
+	add a1, a1, t1                    #  |
+	add t0, t0, t1                    #  |
+	sub a2, a2, t1                    #  |
+	bnez a2, 1b                       # --
+	ret
+
+
+#  'vec_memset' fills 'a2' bytes at 'a0' with the byte in 'a1'
+.globl vec_memset
+vec_memset:
+	mv t0, a0                         # --
+	vsetvli t1, zero, e8, m8, ta, ma  #  |    Splat the byte across a full register group
+	vmv.v.x v0, a1                    # --
+1:	vsetvli t1, a2, e8, m8, ta, ma    # --
+	vse8.v v0, (t0)                   #  |
+	add t0, t0, t1                    #  |    Store one register group per iteration
+	sub a2, a2, t1                    #  |
+	bnez a2, 1b                       # --
+	ret
+
+
+#  'vec_memcmp' returns the difference of the first differing bytes of 'a0'
+#  and 'a1' within 'a2' bytes, or 0 if they match
+.globl vec_memcmp
+vec_memcmp:
+1:	vsetvli t1, a2, e8, m8, ta, ma    # --
+	vle8.v v0, (a0)                   #  |
+	vle8.v v8, (a1)                   #  |
+	vmsne.vv v16, v0, v8              #  |    Compare a chunk, stop at the first
+	vfirst.m t2, v16                  #  |    element that differs
+	bgez t2, 2f                       #  |
+	add a0, a0, t1                    #  |
+	add a1, a1, t1                    #  |
+	sub a2, a2, t1                    #  |
+	bnez a2, 1b                       # --
+	li a0, 0
+	ret
+2:	add a0, a0, t2                    # --
+	add a1, a1, t2                    #  |
+	lbu t0, 0(a0)                     #  |    Difference of the mismatching bytes
+	lbu t1, 0(a1)                     #  |
+	sub a0, t0, t1                    # --
+	ret
+
+
+#  'vec_checksum' returns the 32-bit sum of the 'a1' 32-bit words at 'a0'
+.globl vec_checksum
+vec_checksum:
+	vsetvli t0, zero, e32, m8, ta, ma # --    Clear the per-lane accumulators
+	vmv.v.i v8, 0                     # --
+1:	vsetvli t0, a1, e32, m8, tu, ma   # --
+	vle32.v v0, (a0)                  #  |
+	vadd.vv v8, v8, v0                #  |    Accumulate lane-wise, 'tu' keeps the lanes
+	slli t1, t0, 2                    #  |    past 'vl' intact on the final iteration
+	add a0, a0, t1                    #  |
+	sub a1, a1, t0                    #  |
+	bnez a1, 1b                       # --
+	vsetvli t0, zero, e32, m8, ta, ma # --
+	vmv.s.x v16, zero                 #  |    Fold the accumulators into one sum
+	vredsum.vs v16, v8, v16           #  |
+	vmv.x.s a0, v16                   # --
+	ret
+
+
+#  'vec_bitmap_scan' returns the index of the first of 'a1' bytes at 'a0'
+#  that differs from the byte 'a2' (0xff when looking for a clear bit, 0
+#  when looking for a set bit), or -1 if every byte matches 'a2'
+.globl vec_bitmap_scan
+vec_bitmap_scan:
+	mv t2, a0
+1:	vsetvli t0, a1, e8, m8, ta, ma    # --
+	vle8.v v0, (a0)                   #  |
+	vmsne.vx v8, v0, a2               #  |    Find the first byte that is not 'a2'
+	vfirst.m t1, v8                   #  |
+	bgez t1, 2f                       #  |
+	add a0, a0, t0                    #  |
+	sub a1, a1, t0                    #  |
+	bnez a1, 1b                       # --
+	li a0, -1
+	ret
+2:	add a0, a0, t1
+	sub a0, a0, t2
+	ret
@@ -23,6 +23,10 @@ void printf(const char* format, ...) {
           unsigned long val = va_arg(ap, unsigned long);
           char buff[64] = {0};
           int i = 0;
+          //add 0 to buffer if argument is 0
+          if(val == 0){
+            buff[i++] = '0';
+          }
           if(val < 0){
             uart_putc('-');
             val = -val;
@@ -0,0 +1,347 @@
+#include <barelib.h>
+#include <interrupts.h>
+#include <malloc.h>
+#include <bcache.h>
+#include <fs.h>
+
+/*
+ *  Block buffer cache.  The file system reads and writes blocks through
+ *  'bc_read' and 'bc_write', which keep the most recently used blocks in
+ *  memory and only touch the block device on a miss, on eviction of a
+ *  dirty buffer, or when asked to flush.  Buffers are found by hashing the
+ *  block number and replaced with the CLOCK (second chance) policy.
+ */
+
+static bcbuf_t* bufs = NULL;        /*  The buffers themselves                           */
+static char* bufdata = NULL;        /*  Backing memory for the buffer contents           */
+static uint32 nbufs;                /*  Number of entries in 'bufs'                      */
+static uint32 blocksz;              /*  Size of a block on the device                    */
+static uint32 hand;                 /*  Current position of the CLOCK hand               */
+static bcbuf_t* hash[BC_HASHSZ];    /*  Chains of valid buffers keyed by block number    */
+static bcstat_t stats;
+
+#define bucket(b) (hash[(b) % BC_HASHSZ])
+
+
+/*  Return the cached buffer for 'block', or NULL  */
+static bcbuf_t* lookup(uint32 block) {
+  bcbuf_t* buf;
+  for (buf = bucket(block); buf != NULL && buf->block != block; buf = buf->hnext);
+  return buf;
+}
+
+static void unhash(bcbuf_t* buf) {
+  bcbuf_t** link = &bucket(buf->block);
+  while (*link != buf)
+    link = &(*link)->hnext;
+  *link = buf->hnext;
+}
+
+/*  Write a buffer back to the block device if it is dirty and  *
+ *  not pinned by the journal.  Returns -1 if the write failed,  *
+ *  the buffer then stays dirty.                                 */
+static int32 writeback(bcbuf_t* buf) {
+  if (buf->valid && buf->dirty && !buf->pinned) {
+    if (bs_write(buf->block, 0, buf->data, blocksz) != 0)
+      return -1;
+    buf->dirty = 0;
+    stats.writebacks++;
+    stats.dirty--;
+  }
+  return 0;
+}
+
+/*  Advance the CLOCK hand until it finds a buffer nobody holds whose  *
+ *  second chance has been used up.  Returns NULL if every buffer is   *
+ *  held.                                                              */
+static bcbuf_t* victim(void) {
+  bcbuf_t* buf;
+  for (uint32 i=0; i<2*nbufs; i++) {
+    buf = &bufs[hand];
+    hand = (hand + 1) % nbufs;
+    if (buf->refcount)
+      continue;
+    if (buf->referenced) {
+      buf->referenced = 0;
+      continue;
+    }
+    return buf;
+  }
+  return NULL;
+}
+
+
+/*  Allocate 'n' buffers for the mounted block device and start with  *
+ *  an empty cache.                                                   */
+int32 bc_init(uint32 n) {
+  char mask = disable_interrupts();
+  blocksz = bs_stats().blocksz;
+  bufs = malloc(n * sizeof(bcbuf_t));
+  bufdata = aligned_alloc(8, n * blocksz);
+  if (bufs == NULL || bufdata == NULL) {
+    free(bufs);
+    free(bufdata);
+    bufs = NULL;
+    restore_interrupts(mask);
+    return -1;
+  }
+  heap_transfer(bufs, M_KERNEL);
+  heap_transfer(bufdata, M_KERNEL);
+
+  nbufs = n;
+  hand = 0;
+  memset(hash, 0, sizeof(hash));
+  memset(&stats, 0, sizeof(stats));
+  stats.nbufs = n;
+  for (uint32 i=0; i<n; i++) {
+    bufs[i].block = EMPTY;
+    bufs[i].refcount = 0;
+    bufs[i].valid = bufs[i].dirty = bufs[i].referenced = bufs[i].pinned = 0;
+    bufs[i].hnext = NULL;
+    bufs[i].data = bufdata + i * blocksz;
+  }
+  restore_interrupts(mask);
+  return 0;
+}
+
+void bc_destroy(void) {
+  char mask = disable_interrupts();
+  if (bufs != NULL) {
+    bc_flush();
+    free(bufs);
+    free(bufdata);
+    bufs = NULL;
+  }
+  restore_interrupts(mask);
+}
+
+
+/*  Return the buffer holding 'block' with its reference count raised.  *
+ *  On a miss a buffer is claimed from the CLOCK, and the block is read  *
+ *  from the device unless 'load' is 0 (the caller will overwrite the    *
+ *  whole block).  Returns NULL if every buffer is held, the buffer      *
+ *  claimed could not be written back or the block could not be read.   */
+bcbuf_t* bc_get(uint32 block, byte load) {
+  bcbuf_t* buf;
+  char mask = disable_interrupts();
+  if ((buf = lookup(block)) != NULL) {
+    stats.hits++;
+  }
+  else {
+    if ((buf = victim()) == NULL) {
+      restore_interrupts(mask);
+      return NULL;
+    }
+    stats.misses++;
+    if (buf->valid) {
+      if (writeback(buf) != 0) {
+        restore_interrupts(mask);
+        return NULL;
+      }
+      stats.evictions++;
+      unhash(buf);
+    }
+    buf->block = block;
+    buf->hnext = bucket(block);
+    bucket(block) = buf;
+    buf->valid = 1;
+    if (load && bs_read(block, 0, buf->data, blocksz) != 0) {
+      unhash(buf);
+      buf->valid = 0;
+      buf->block = EMPTY;
+      restore_interrupts(mask);
+      return NULL;
+    }
+  }
+  buf->refcount++;
+  buf->referenced = 1;
+  restore_interrupts(mask);
+  return buf;
+}
+
+/*  Drop a reference taken by 'bc_get', marking the buffer dirty if  *
+ *  the caller modified it.                                          */
+void bc_put(bcbuf_t* buf, byte dirty) {
+  char mask = disable_interrupts();
+  if (dirty && !buf->dirty) {
+    buf->dirty = 1;
+    stats.dirty++;
+  }
+  buf->refcount--;
+  restore_interrupts(mask);
+}
+
+/*  Pin ('pin' = 1) a held buffer so it is neither evicted nor written  *
+ *  back, or unpin it ('pin' = 0).  The pin keeps a reference of its    *
+ *  own, the caller still drops the one it got from 'bc_get'.           */
+void bc_pin(bcbuf_t* buf, byte pin) {
+  char mask = disable_interrupts();
+  if (pin && !buf->pinned)
+    buf->refcount++;
+  else if (!pin && buf->pinned)
+    buf->refcount--;
+  buf->pinned = pin;
+  restore_interrupts(mask);
+}
+
+/*  Forget the cached copy of 'block' without writing it back, for a  *
+ *  block that was freed and must not reach the device again.         */
+void bc_discard(uint32 block) {
+  bcbuf_t* buf;
+  char mask = disable_interrupts();
+  if (bufs != NULL && (buf = lookup(block)) != NULL && buf->refcount == 0) {
+    if (buf->dirty)
+      stats.dirty--;
+    buf->dirty = buf->valid = 0;
+    unhash(buf);
+    buf->block = EMPTY;
+  }
+  restore_interrupts(mask);
+}
+
+
+/*  Same contract as 'bs_read', but served from the cache  */
+int32 bc_read(uint32 block, uint32 offset, void* buf, uint32 len) {
+  bcbuf_t* b;
+  if (bufs == NULL)
+    return bs_read(block, offset, buf, len);
+  if (offset + len > blocksz || block >= bs_stats().nblocks)
+    return -1;
+  if ((b = bc_get(block, 1)) == NULL)
+    return bs_read(block, offset, buf, len);
+  memcpy(buf, b->data + offset, len);
+  bc_put(b, 0);
+  return 0;
+}
+
+/*  Same contract as 'bs_write', but the data stays in the cache until  *
+ *  the buffer is evicted or flushed.  Several small writes to a block  *
+ *  therefore reach the device as a single block write.                 */
+int32 bc_write(uint32 block, uint32 offset, void* buf, uint32 len) {
+  bcbuf_t* b;
+  if (bufs == NULL)
+    return bs_write(block, offset, buf, len);
+  if (offset + len > blocksz || block >= bs_stats().nblocks)
+    return -1;
+  if ((b = bc_get(block, offset != 0 || len != blocksz)) == NULL)
+    return bs_write(block, offset, buf, len);
+  memcpy(b->data + offset, buf, len);
+  bc_put(b, 1);
+  return 0;
+}
+
+
+/*  Set every byte of 'block' to 'value', as used for new indirect and  *
+ *  directory blocks.  The block is not read from the device first.     */
+int32 bc_fill(uint32 block, byte value) {
+  byte chunk[64];
+  bcbuf_t* b;
+  uint32 size = bs_stats().blocksz;
+  if (block >= bs_stats().nblocks)
+    return -1;
+  if (bufs != NULL && (b = bc_get(block, 0)) != NULL) {
+    memset(b->data, value, blocksz);
+    bc_put(b, 1);
+    return 0;
+  }
+  memset(chunk, value, sizeof(chunk));
+  for (uint32 off=0; off<size; off+=sizeof(chunk))
+    bs_write(block, off, chunk, sizeof(chunk));
+  return 0;
+}
+
+
+/*  Bring the cache and segment 'v' of a vectored transfer in line for  *
+ *  every block of the segment that has a buffer.  After a read, data   *
+ *  of dirty buffers is copied over what came from the device.  After   *
+ *  a write, buffers take the new data, and a buffer the segment        *
+ *  covers completely is no longer dirty, so a later write back cannot  *
+ *  undo the new data.                                                  */
+static void overlay(bsvec_t* v, byte write) {
+  uint64 start = v->offset, end = (uint64)v->offset + v->len, lo, hi;
+  bcbuf_t* b;
+  for (uint32 k=start / blocksz; (uint64)k * blocksz < end; k++) {
+    if ((b = lookup(v->block + k)) == NULL)
+      continue;
+    lo = ((uint64)k * blocksz > start ? (uint64)k * blocksz : start);
+    hi = ((uint64)(k + 1) * blocksz < end ? (uint64)(k + 1) * blocksz : end);
+    if (write) {
+      memcpy(b->data + (lo - (uint64)k * blocksz), (char*)v->buf + (lo - start), hi - lo);
+      if (hi - lo == blocksz && b->dirty) {
+        b->dirty = 0;
+        stats.dirty--;
+      }
+    }
+    else if (b->dirty) {
+      memcpy((char*)v->buf + (lo - start), b->data + (lo - (uint64)k * blocksz), hi - lo);
+    }
+  }
+}
+
+/*  Read the 'n' segments of 'vec' in one request to the device (see  *
+ *  'bs_readv').  The cache is not filled, a long transfer would only  *
+ *  push out the metadata blocks kept there.                           */
+int32 bc_readv(bsvec_t* vec, uint32 n) {
+  char mask = disable_interrupts();
+  if (bs_readv(vec, n) == -1) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  for (uint32 i=0; bufs != NULL && stats.dirty && i<n; i++)
+    overlay(&vec[i], 0);
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Write the 'n' segments of 'vec' straight to the device in one  *
+ *  request.  Cached copies of the blocks are refreshed.            */
+int32 bc_writev(bsvec_t* vec, uint32 n) {
+  char mask = disable_interrupts();
+  if (bs_writev(vec, n) == -1) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  for (uint32 i=0; bufs != NULL && i<n; i++)
+    overlay(&vec[i], 1);
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Same as 'bc_readv' and 'bc_writev' for a run of 'count' whole  *
+ *  blocks starting at 'block'.                                    */
+int32 bc_read_blocks(uint32 block, uint32 count, void* buf) {
+  bsvec_t vec = { block, 0, buf, count * bs_stats().blocksz };
+  return bc_readv(&vec, 1);
+}
+
+int32 bc_write_blocks(uint32 block, uint32 count, void* buf) {
+  bsvec_t vec = { block, 0, buf, count * bs_stats().blocksz };
+  return bc_writev(&vec, 1);
+}
+
+
+int32 bc_sync_block(uint32 block) {
+  bcbuf_t* buf;
+  int32 result = 0;
+  char mask = disable_interrupts();
+  if (bufs != NULL && (buf = lookup(block)) != NULL)
+    result = writeback(buf);
+  restore_interrupts(mask);
+  return result;
+}
+
+/*  Returns -1 if a buffer could not be written back, the others  *
+ *  are written all the same.                                     */
+int32 bc_flush(void) {
+  int32 result = 0;
+  char mask = disable_interrupts();
+  for (uint32 i=0; bufs != NULL && i<nbufs; i++)
+    if (writeback(&bufs[i]) != 0)
+      result = -1;
+  restore_interrupts(mask);
+  return result;
+}
+
+bcstat_t bc_stats(void) {
+  return stats;
+}
@@ -2,44 +2,225 @@
 #include <malloc.h>
 #include <barelib.h>
 #include <fs.h>
-
-void* memcpy(void*, void*, int);
+#include <syscall.h>
+#include <virtio.h>
 
 static bdev_t ramdisk;             /* After initialization, contains metadata about the block device */
 static char* ramfs_blocks = NULL;  /* A pointer to the actual memory used as the block device        */
+static byte on_vdisk = 0;          /* Set when the blocks are kept on the virtio disk instead        */
+
+#define bs_ready() (ramfs_blocks != NULL || on_vdisk)
 
 uint32 bs_mk_ramdisk(uint32 blocksize, uint32 numblocks) {                    /*                               */
-  char mask = disable_interrupts();                                           /*  Initialize the block device  */
-  ramdisk.blocksz = (blocksize == NULL ? MDEV_BLOCK_SIZE : blocksize);        /*  This  sets  the block  size  */
-  ramdisk.nblocks = (numblocks == NULL ? MDEV_NUM_BLOCKS : numblocks);        /*  and block count for  future  */
-  ramfs_blocks = malloc(ramdisk.blocksz * ramdisk.nblocks);                   /*  reference.   And  allocates  */
-  restore_interrupts(mask);                                                   /*  the memory  for the  device  */
-  return (ramfs_blocks == (void*)-1 ? -1 : 0);                                /*  itself.                      */
+  char mask;                                                                  /*  Initialize the block device  */
+  blocksize = (blocksize == NULL ? MDEV_BLOCK_SIZE : blocksize);              /*  This  sets  the block  size  */
+  if (blocksize < MIN_BLOCK_SIZE || blocksize > MAX_BLOCK_SIZE ||             /*  and block count for  future  */
+      (blocksize & (blocksize - 1)) != 0)                                     /*  reference.   And  allocates  */
+    return -1;                                                                /*  the memory  for the  device  */
+  mask = disable_interrupts();                                                /*  itself, which is owned  by  */
+  ramdisk.blocksz = blocksize;                                                /*  the kernel.  The block size  */
+  ramdisk.nblocks = (numblocks == NULL ? MDEV_NUM_BLOCKS : numblocks);        /*  must be a power of 2 between */
+  ramfs_blocks = malloc(ramdisk.blocksz * ramdisk.nblocks);                   /*  MIN_ and MAX_BLOCK_SIZE      */
+  heap_transfer(ramfs_blocks, M_KERNEL);                                      /*                               */
+  on_vdisk = 0;                                                               /*                               */
+  restore_interrupts(mask);                                                   /*                               */
+  return (ramfs_blocks == NULL ? -1 : 0);                                     /*                               */
 }                                                                             /*                               */
 
+/*  Use the virtio disk as the block device, split into as many blocks of  *
+ *  'blocksize' bytes as fit on it.  Unlike the ramdisk its contents       *
+ *  survive a reboot, see 'fs_init'.  Returns -1 if QEMU was started       *
+ *  without a disk.                                                        */
+uint32 bs_mk_vdisk(uint32 blocksize) {
+  blocksize = (blocksize == NULL ? MDEV_BLOCK_SIZE : blocksize);
+  if (blocksize < MIN_BLOCK_SIZE || blocksize > MAX_BLOCK_SIZE ||
+      (blocksize & (blocksize - 1)) != 0 || vblk_init() != 0 ||
+      vblk_capacity() * VBLK_SECTOR_SIZE / blocksize == 0)
+    return -1;
+  char mask = disable_interrupts();
+  ramdisk.blocksz = blocksize;
+  ramdisk.nblocks = vblk_capacity() * VBLK_SECTOR_SIZE / blocksize;
+  on_vdisk = 1;
+  restore_interrupts(mask);
+  return 0;
+}
+
 bdev_t bs_stats(void) {   /*                                                            */
   return ramdisk;         /*  External accessor function for the block device metadata  */
 }                         /*                                                            */
 
 uint32 bs_free_ramdisk(void) {  /*                                        */
   char mask;                    /*                                        */
+  if (on_vdisk) {               /*  The virtio disk is only let go of,    */
+    on_vdisk = 0;               /*  its contents stay on the disk         */
+    return 0;                   /*                                        */
+  }                             /*                                        */
   if (ramfs_blocks == NULL) {   /*                                        */
     return -1;                  /*                                        */
   }                             /*  Free memory used by the block device  */
   mask = disable_interrupts();  /*                                        */
   free(ramfs_blocks);           /*                                        */
+  ramfs_blocks = NULL;          /*                                        */
   restore_interrupts(mask);     /*                                        */
   return 0;                     /*                                        */
 }
 
+
+/*  Read a segment that does not start and end on sector boundaries   *
+ *  through a buffer holding the sectors it touches.  Writes fill the  *
+ *  buffer from the disk first so the rest of those sectors is kept.   */
+static int32 vdisk_bounce(uint64 start, void* buf, uint32 len, byte write) {
+  uint64 first = start / VBLK_SECTOR_SIZE;
+  uint32 skip = start % VBLK_SECTOR_SIZE;
+  vblkreq_t req;
+  int32 result;
+
+  req.hdr.type = VBLK_T_IN;
+  req.hdr.sector = first;
+  req.len = (skip + len + VBLK_SECTOR_SIZE - 1) / VBLK_SECTOR_SIZE * VBLK_SECTOR_SIZE;
+  if ((req.buf = malloc(req.len)) == NULL)
+    return -1;
+  result = vblk_rw(&req, 1);
+  if (result == 0 && write) {
+    memcpy((char*)req.buf + skip, buf, len);
+    req.hdr.type = VBLK_T_OUT;
+    result = vblk_rw(&req, 1);
+  }
+  else if (result == 0)
+    memcpy(buf, (char*)req.buf + skip, len);
+  free(req.buf);
+  return result;
+}
+
+/*  Finish 'req' with 'result' and run its callback  */
+static void bs_complete(bsreq_t* req, int32 result) {
+  req->result = result;
+  req->done = 1;
+  if (req->callback != NULL)
+    req->callback(req);
+}
+
+/*  Callback of the virtio request behind a 'bsreq_t'  */
+static void bs_complete_io(vblkreq_t* io) {
+  bs_complete((bsreq_t*)io->arg, io->status == 0 ? 0 : -1);
+}
+
+/*  Queue 'req', whose segment covers whole sectors from byte 'start'  *
+ *  of the virtio disk, on the device                                  */
+static void vdisk_start(bsreq_t* req, uint64 start) {
+  req->done = 0;
+  req->io.hdr.type = (req->write ? VBLK_T_OUT : VBLK_T_IN);
+  req->io.hdr.sector = start / VBLK_SECTOR_SIZE;
+  req->io.buf = req->seg.buf;
+  req->io.len = req->seg.len;
+  req->io.callback = bs_complete_io;
+  req->io.arg = req;
+  if (vblk_submit(&req->io) != 0)
+    bs_complete(req, -1);
+}
+
+
+/*  While the block store is plugged (see 'bs_plug') writes to the virtio  *
+ *  disk are not waited for.  They are kept in 'held' and sit in the       *
+ *  elevator until the plug is pulled, so the writes of a flush reach the  *
+ *  device sorted and merged.                                              */
+static uint32 plugs = 0;                  /*  Depth of 'bs_plug' calls                          */
+static bsreq_t held[VBLK_PLUG_MAX];       /*  Writes accepted while plugged                     */
+static uint32 nheld = 0;                  /*                                                    */
+static int32 heldresult = 0;              /*  -1 once one of the held writes has failed         */
+
+/*  Returns 1 if bytes ['start', 'start' + 'len') of the device overlap  *
+ *  a held write                                                         */
+static byte held_overlap(uint64 start, uint32 len) {
+  uint64 from;
+  for (uint32 i=0; i<nheld; i++) {
+    from = (uint64)held[i].seg.block * ramdisk.blocksz + held[i].seg.offset;
+    if (start < from + held[i].seg.len && from < start + len)
+      return 1;
+  }
+  return 0;
+}
+
+/*  Wait for every held write  */
+static void drain(void) {
+  for (uint32 i=0; i<nheld; i++)
+    if (bs_wait(&held[i]) != 0)
+      heldresult = -1;
+  nheld = 0;
+}
+
+/*  Queue a write of whole sectors from byte 'start' without waiting  */
+static void hold(bsvec_t* seg, uint64 start) {
+  bsreq_t* req;
+  if (nheld == VBLK_PLUG_MAX)
+    drain();
+  req = &held[nheld++];
+  req->seg = *seg;
+  req->write = 1;
+  req->callback = NULL;
+  vdisk_start(req, start);
+}
+
+
+/*  Move the segments of 'vec' to or from the virtio disk.  Segments   *
+ *  made of whole sectors are handed to the device up to FS_IOV_MAX at  *
+ *  a time so that they are all in flight together (or held while the   *
+ *  block store is plugged), any other segment is moved on its own      *
+ *  through 'vdisk_bounce'.  A segment that touches a held write waits  *
+ *  for the held writes first.                                          */
+static uint32 vdisk_io(bsvec_t* vec, uint32 n, byte write) {
+  vblkreq_t reqs[FS_IOV_MAX];
+  uint32 nreqs = 0;
+  int32 result = 0;
+  uint64 start;
+
+  for (uint32 i=0; i<n; i++) {
+    start = (uint64)vec[i].block * ramdisk.blocksz + vec[i].offset;
+    if (vec[i].len == 0)
+      continue;
+    if (nheld > 0 && held_overlap(start, vec[i].len))
+      drain();
+    if (start % VBLK_SECTOR_SIZE != 0 || vec[i].len % VBLK_SECTOR_SIZE != 0) {
+      if (nreqs > 0 && vblk_rw(reqs, nreqs) != 0)         /*  Keep the segments in order  */
+        result = -1;
+      nreqs = 0;
+      if (vdisk_bounce(start, vec[i].buf, vec[i].len, write) != 0)
+        result = -1;
+      continue;
+    }
+    if (write && plugs > 0) {
+      hold(&vec[i], start);
+      continue;
+    }
+    reqs[nreqs].hdr.type = (write ? VBLK_T_OUT : VBLK_T_IN);
+    reqs[nreqs].hdr.sector = start / VBLK_SECTOR_SIZE;
+    reqs[nreqs].buf = vec[i].buf;
+    reqs[nreqs].len = vec[i].len;
+    if (++nreqs == FS_IOV_MAX) {
+      if (vblk_rw(reqs, nreqs) != 0)
+        result = -1;
+      nreqs = 0;
+    }
+  }
+  if (nreqs > 0 && vblk_rw(reqs, nreqs) != 0)
+    result = -1;
+  return result;
+}
+
 uint32 bs_read(uint32 block, uint32 offset, void* buf, uint32 len) {    /*                                   */
   char mask = disable_interrupts();                                     /*                                   */
   if (offset < 0 || offset + len > ramdisk.blocksz ||                   /*  Check if the block is valid      */
       block < 0 || block >= ramdisk.nblocks ||                          /*  if not valid, restore interrupts */
-      ramfs_blocks == NULL) {                                           /*  and return error.                */
+      !bs_ready()) {                                                    /*  and return error.                */
     restore_interrupts(mask);                                           /*                                   */
     return -1;                                                          /*                                   */
   }                                                                     /*                                   */
+  if (on_vdisk) {                                                       /*                                   */
+    bsvec_t vec = { block, offset, buf, len };                          /*                                   */
+    uint32 result = vdisk_io(&vec, 1, 0);                               /*                                   */
+    restore_interrupts(mask);                                           /*                                   */
+    return result;                                                      /*                                   */
+  }                                                                     /*                                   */
   memcpy(buf, &(ramfs_blocks[block * ramdisk.blocksz]) + offset, len);  /*  Copy the data from the block to  */
   restore_interrupts(mask);                                             /*  the output buffer.               */
   return 0;                                                             /*                                   */
@@ -49,11 +230,149 @@ uint32 bs_write(uint32 block, uint32 offset, void* buf, uint32 len) {   /*
   char mask = disable_interrupts();                                     /*                                   */
   if (offset < 0 || offset + len > ramdisk.blocksz ||                   /*  Check if the block is valid      */
       block < 0 || block >= ramdisk.nblocks ||                          /*  if not valid, restore interrupts */
-      ramfs_blocks == NULL) {                                           /*  and return error.                */
+      !bs_ready()) {                                                    /*  and return error.                */
     restore_interrupts(mask);                                           /*                                   */
     return -1;                                                          /*                                   */
   }                                                                     /*                                   */
+  if (on_vdisk) {                                                       /*                                   */
+    bsvec_t vec = { block, offset, buf, len };                          /*                                   */
+    uint32 result = vdisk_io(&vec, 1, 1);                               /*                                   */
+    restore_interrupts(mask);                                           /*                                   */
+    return result;                                                      /*                                   */
+  }                                                                     /*                                   */
   memcpy(&(ramfs_blocks[block * ramdisk.blocksz]) + offset, buf, len);  /*  Copy the data from the buffer    */
   restore_interrupts(mask);                                             /*  to the block.                    */
   return 0;                                                             /*                                   */
 }                                                                       /*                                   */
+
+/*  Returns 1 if every segment of 'vec' lies within the device  */
+static byte valid_vec(bsvec_t* vec, uint32 n) {
+  for (uint32 i=0; i<n; i++)
+    if (vec[i].block >= ramdisk.nblocks || vec[i].buf == NULL ||
+        (uint64)vec[i].offset + vec[i].len > (uint64)(ramdisk.nblocks - vec[i].block) * ramdisk.blocksz)
+      return 0;
+  return 1;
+}
+
+/*  Move the 'n' segments of 'vec' as one request: the whole list is  *
+ *  checked first and then copied with interrupts disabled once, so   *
+ *  either every segment is transferred or none is.  The file system  *
+ *  gathers the whole blocks of a transfer into a single list.        */
+uint32 bs_readv(bsvec_t* vec, uint32 n) {
+  char mask = disable_interrupts();
+  if (!bs_ready() || !valid_vec(vec, n)) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  if (on_vdisk) {
+    uint32 result = vdisk_io(vec, n, 0);
+    restore_interrupts(mask);
+    return result;
+  }
+  for (uint32 i=0; i<n; i++)
+    memcpy(vec[i].buf, &(ramfs_blocks[vec[i].block * ramdisk.blocksz]) + vec[i].offset, vec[i].len);
+  restore_interrupts(mask);
+  return 0;
+}
+
+uint32 bs_writev(bsvec_t* vec, uint32 n) {
+  char mask = disable_interrupts();
+  if (!bs_ready() || !valid_vec(vec, n)) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  if (on_vdisk) {
+    uint32 result = vdisk_io(vec, n, 1);
+    restore_interrupts(mask);
+    return result;
+  }
+  for (uint32 i=0; i<n; i++)
+    memcpy(&(ramfs_blocks[vec[i].block * ramdisk.blocksz]) + vec[i].offset, vec[i].buf, vec[i].len);
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Start the transfer of 'req->seg' and return without waiting for it.   *
+ *  On the virtio disk a segment made of whole sectors is queued on the   *
+ *  device and completed by its interrupt handler, so a thread may keep   *
+ *  several requests in flight.  The ramdisk (and segments that need a    *
+ *  bounce buffer) complete before 'bs_submit' returns.  Either way the   *
+ *  callback runs once 'done' is set.  Returns -1, without completing     *
+ *  the request, if the segment is not on the device.                     */
+uint32 bs_submit(bsreq_t* req) {
+  uint64 start;
+  char mask = disable_interrupts();
+  if (!bs_ready() || !valid_vec(&req->seg, 1)) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  req->done = 0;
+  start = (uint64)req->seg.block * ramdisk.blocksz + req->seg.offset;
+  if (on_vdisk && nheld > 0 && held_overlap(start, req->seg.len))
+    drain();
+  if (on_vdisk && start % VBLK_SECTOR_SIZE == 0 && req->seg.len % VBLK_SECTOR_SIZE == 0 && req->seg.len > 0)
+    vdisk_start(req, start);
+  else if (on_vdisk)
+    bs_complete(req, vdisk_io(&req->seg, 1, req->write));
+  else {
+    if (req->write)
+      memcpy(ramfs_blocks + start, req->seg.buf, req->seg.len);
+    else
+      memcpy(req->seg.buf, ramfs_blocks + start, req->seg.len);
+    bs_complete(req, 0);
+  }
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Wait for a submitted request, giving the processor to other threads  *
+ *  in the meantime.  Returns 0 if the transfer succeeded.               */
+int32 bs_wait(bsreq_t* req) {
+  if (!req->done && on_vdisk)
+    vblk_wait(&req->io);
+  while (!req->done) {
+    if (is_interrupting())
+      raise_syscall(RESCHED);
+  }
+  return req->result;
+}
+
+/*  Plug the block store: until the matching 'bs_unplug' whole sector  *
+ *  writes to the virtio disk return without waiting, and they are      *
+ *  sent to the device in elevator order, contiguous ones merged.  The  *
+ *  memory written from must not change until then.  Reads and writes   *
+ *  that overlap a held write wait for it first.  Plugs nest.           */
+void bs_plug(void) {
+  char mask = disable_interrupts();
+  plugs++;
+  vblk_plug();
+  restore_interrupts(mask);
+}
+
+/*  Pull the plug, waiting for the held writes once the outermost plug  *
+ *  is pulled.  Returns -1 if any of them failed.                       */
+int32 bs_unplug(void) {
+  int32 result = 0;
+  char mask = disable_interrupts();
+  if (plugs > 0 && --plugs == 0) {
+    vblk_unplug();
+    drain();
+    result = heldresult;
+    heldresult = 0;
+  }
+  else if (plugs > 0)
+    vblk_unplug();
+  restore_interrupts(mask);
+  return result;
+}
+
+/*  Move 'count' whole blocks starting at 'block', a single segment  */
+uint32 bs_read_blocks(uint32 block, uint32 count, void* buf) {
+  bsvec_t vec = { block, 0, buf, count * ramdisk.blocksz };
+  return bs_readv(&vec, 1);
+}
+
+uint32 bs_write_blocks(uint32 block, uint32 count, void* buf) {
+  bsvec_t vec = { block, 0, buf, count * ramdisk.blocksz };
+  return bs_writev(&vec, 1);
+}
@@ -45,6 +45,7 @@ int32 create_thread(void* proc, char* arg, uint32 arglen) {
   thread_table[i].state = TH_SUSPEND;          /*                                                                */
   thread_table[i].stackptr = (uint64*)stkptr;  /*              Configure the thread table entry                  */
   thread_table[i].parent = current_thread;     /*                                                                */
+  thread_table[i].memused = 0;                 /*  The new thread starts without any heap allocations            */
   ctxptr[-1] = (uint64)__noop;                 /*  [-1] Return address after context switch in Machine privilage */
   ctxptr[-2] = (uint64)proc;                   /*  [-2] 'a0' register or first argument to the wrapper function  */
   ctxptr[-3] = (uint64)wrapper;                /*  [-3] Return point after existing Machine privilage            */
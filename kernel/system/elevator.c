@@ -0,0 +1,142 @@
+#include <barelib.h>
+#include <virtio.h>
+
+/*
+ *  Request scheduler of the block layer.  Requests that cannot start right
+ *  away (the device queue is full or plugged, see 'vblk_plug') wait here,
+ *  sorted by sector.  A request that continues a waiting request of the
+ *  same direction on the disk is chained to it and the two are sent as a
+ *  single device request.  Requests are taken out in one direction of
+ *  sector order from where the last one ended (C-SCAN), unless the oldest
+ *  waiting request has been passed over for ELV_DEADLINE others, which is
+ *  then taken out first.
+ *
+ *  Only the virtio driver calls these, with its queue held (see 'enter').
+ */
+
+#define ELV_DEADLINE 32         /*  Requests taken out before a waiting one is overdue  */
+
+byte elv_enabled = 1;
+
+static vblkreq_t* queue = NULL;     /*  Waiting requests sorted by sector, or in arrival order  */
+static uint32 count;                /*  when the elevator is turned off                          */
+static uint32 clock;                /*  Requests taken out so far                                */
+static uint64 headpos;              /*  Sector after the last request taken out                  */
+static elvstat_t stats;
+
+#define end(r) ((r)->hdr.sector + (r)->total / VBLK_SECTOR_SIZE)
+
+
+void elv_init(void) {
+  queue = NULL;
+  count = clock = 0;
+  headpos = 0;
+  memset(&stats, 0, sizeof(stats));
+}
+
+uint32 elv_count(void) {
+  return count;
+}
+
+elvstat_t elv_stats(void) {
+  return stats;
+}
+
+
+/*  Returns 1 if 'b' can be sent as the continuation of 'a'  */
+static byte mergeable(vblkreq_t* a, vblkreq_t* b) {
+  return a->hdr.type == b->hdr.type && end(a) == b->hdr.sector && a->nseg + b->nseg <= VBLK_MAX_SEGS;
+}
+
+/*  Append the chain of 'b' to the chain of 'a'  */
+static void chain(vblkreq_t* a, vblkreq_t* b) {
+  vblkreq_t* last = a;
+  while (last->merged != NULL)
+    last = last->merged;
+  last->merged = b;
+  a->total += b->total;
+  a->nseg += b->nseg;
+  if ((int32)(b->expires - a->expires) < 0)
+    a->expires = b->expires;
+}
+
+
+/*  Queue 'req' by sector.  It is appended to the request ending where  *
+ *  it starts (and that to the one after it when they now touch), or  *
+ *  takes the place of the request starting where it ends.            */
+void elv_add(vblkreq_t* req) {
+  vblkreq_t **link = &queue, *prev = NULL;
+
+  req->merged = NULL;
+  req->total = req->len;
+  req->nseg = 1;
+  req->expires = clock + ELV_DEADLINE;
+  stats.added++;
+
+  if (!elv_enabled) {
+    while (*link != NULL)
+      link = &(*link)->next;
+    req->next = NULL;
+    *link = req;
+    count++;
+    return;
+  }
+
+  while (*link != NULL && (*link)->hdr.sector <= req->hdr.sector) {
+    prev = *link;
+    link = &(*link)->next;
+  }
+  if (prev != NULL && mergeable(prev, req)) {
+    chain(prev, req);
+    stats.backmerges++;
+    if (prev->next != NULL && mergeable(prev, prev->next)) {
+      vblkreq_t* after = prev->next;
+      prev->next = after->next;
+      chain(prev, after);
+      count--;
+      stats.backmerges++;
+    }
+    return;
+  }
+  if (*link != NULL && mergeable(req, *link)) {
+    req->next = (*link)->next;
+    chain(req, *link);
+    *link = req;
+    stats.frontmerges++;
+    return;
+  }
+  req->next = *link;
+  *link = req;
+  count++;
+}
+
+
+/*  Remove and return the request to start next  */
+vblkreq_t* elv_next(void) {
+  vblkreq_t **link, **pick = NULL;
+  vblkreq_t* req;
+
+  if (queue == NULL)
+    return NULL;
+  if (!elv_enabled)
+    pick = &queue;
+  else {
+    for (link = &queue; *link != NULL; link = &(*link)->next)     /*  Oldest request if it is due  */
+      if ((int32)((*link)->expires - clock) <= 0 && (pick == NULL || (int32)((*link)->expires - (*pick)->expires) < 0))
+        pick = link;
+    if (pick != NULL)
+      stats.expired++;
+    else {
+      for (link = &queue; *link != NULL && (*link)->hdr.sector < headpos; link = &(*link)->next);
+      pick = (*link != NULL ? link : &queue);                      /*  Next one up, or wrap around  */
+    }
+  }
+  req = *pick;
+  *pick = req->next;
+  req->next = NULL;
+  headpos = end(req);
+  count--;
+  clock++;
+  stats.dispatched++;
+  return req;
+}
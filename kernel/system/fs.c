@@ -2,56 +2,314 @@
 #include <malloc.h>
 #include <interrupts.h>
 #include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+#include <lfs.h>
 
 fsystem_t* fsd = NULL;
 filetable_t oft[NUM_FD];
+uint32 fs_alloc_window = FS_ALLOC_WINDOW;   /*  Blocks set aside for a file starting a new run (0: plain next-fit)  */
+byte fs_mask_lazy = 1;                      /*  Read bitmask blocks when first used (0: all of them on mount)       */
+uint32 fs_journal_blocks = 0;               /*  Journal made by 'fs_mkfs' (0: metadata written in place)            */
+uint32 fs_log_segblocks = 0;                /*  Segment size of the log made by 'fs_mkfs' (0: files kept in place)  */
+uint32 fs_inline_max = 0;                   /*  Largest file kept in its inode block (0: data always in blocks)     */
+byte fs_delay_alloc = 0;                    /*  Hold new file blocks back until they are written (0: place at once) */
 
-void* memset(void*, int, int);
+#define MASK_BITS (fsd->device.blocksz * 8)  /*  Blocks described by one block of the free bitmask  */
+
+
+/*  Make sure the bitmask blocks describing blocks ['from', 'to')  *
+ *  have been read from the device.  The free bitmask is only      *
+ *  read as the blocks it describes are looked at, so mounting a   *
+ *  large device does not read (or count) the whole bitmask.       */
+static void mask_need(uint32 from, uint32 to) {
+  for (uint32 b=from / MASK_BITS; b * MASK_BITS < to; b++)
+    if (!(fsd->maskstate[b] & MASK_LOADED))
+      fs_maskio(b, 0);
+}
 
 void fs_setmaskbit(uint32 x) {                     /*                                           */
   if (fsd == NULL) return;                         /*  Sets the block at index 'x' as used      */
-  fsd->freemask[x / 8] |= 0x1 << (x % 8);          /*  in the free bitmask.                     */
+  if (!fs_getmaskbit(x)) fsd->freeblocks--;        /*  in the free bitmask.                     */
+  fsd->freemask[x / 8] |= 0x1 << (x % 8);          /*                                           */
+  fsd->maskstate[x / MASK_BITS] |= MASK_DIRTY;     /*                                           */
+  fsd->maskdirty = 1;                              /*                                           */
 }                                                  /*                                           */
 
 void fs_clearmaskbit(uint32 x) {                   /*                                           */
   if (fsd == NULL) return;                         /*  Sets the block at index 'x' as unused    */
-  fsd->freemask[x / 8] &= ~(0x1 << (x % 8));       /*  in the free bitmask.                     */
+  if (fs_getmaskbit(x)) fsd->freeblocks++;         /*  in the free bitmask.  A block freed      */
+  if (x < fsd->nextfit) fsd->nextfit = x;          /*  behind the next-fit cursor rewinds it    */
+  fsd->freemask[x / 8] &= ~(0x1 << (x % 8));       /*  so the hole is reused first.             */
+  fsd->maskstate[x / MASK_BITS] |= MASK_DIRTY;     /*                                           */
+  fsd->maskdirty = 1;                              /*                                           */
 }                                                  /*                                           */
 
 uint32 fs_getmaskbit(uint32 x) {                   /*                                           */
   if (fsd == NULL) return -1;                      /*  Returns the current value of the         */
-  return (fsd->freemask[x / 8] >> (x % 8)) & 0x1;  /*  'x'th block in the block device          */
-}                                                  /*  0 for unused 1 for used.                 */
+  mask_need(x, x + 1);                             /*  'x'th block in the block device          */
+  return (fsd->freemask[x / 8] >> (x % 8)) & 0x1;  /*  0 for unused 1 for used.                 */
+}                                                  /*                                           */
+
+
+/*  Search ['from', 'to') for 'n' contiguous free blocks and    *
+ *  return the first, or -1 if there is no such run.  The range  *
+ *  is scanned one bitmask block at a time so that only the      *
+ *  blocks up to the run found have to be read.                  */
+static int32 find_run(uint32 from, uint32 to, uint32 n) {
+  int32 start, used;
+  uint32 end;
+  while (from < to) {
+    end = (from / MASK_BITS + 1) * MASK_BITS;                           /*  End of the bitmask block */
+    end = (end < to ? end : to);                                        /*  'from' is in             */
+    mask_need(from, end);
+    if ((start = bitmap_scan((byte*)fsd->freemask, from, end, 0)) == -1) {
+      from = end;
+      continue;
+    }
+    if (start + n > to)                                                 /*  Not enough room left     */
+      return -1;
+    mask_need(start, start + n);
+    used = bitmap_scan((byte*)fsd->freemask, start, start + n, 1);     /*  First used block inside  */
+    if (used == -1)                                                     /*  the candidate run        */
+      return start;
+    from = used + 1;
+  }
+  return -1;
+}
+
+
+/*  Next-fit search for 'n' contiguous free blocks: start where the  *
+ *  previous allocation ended (or at the lowest block freed since)   *
+ *  and wrap around to the start of the device once.                 */
+static int32 next_fit(uint32 n) {
+  int32 start = -1;
+  if (fsd->nextfit < fsd->device.nblocks)
+    start = find_run(fsd->nextfit, fsd->device.nblocks, n);
+  if (start == -1 && fsd->nextfit > 0)
+    start = find_run(0, fsd->device.nblocks, n);
+  return start;
+}
+
+
+/*  Free blocks the allocators may hand out.  The blocks set aside for  *
+ *  data the open files hold back (see lib/fs_delay.c) are not, only    *
+ *  'fs_alloc_extent' places that data once its file gives them up.     */
+static uint32 spare(void) {
+  uint32 reserved = fs_delay_reserved();
+  return (fsd->freeblocks > reserved ? fsd->freeblocks - reserved : 0);
+}
+
+
+/*  Allocate 'n' contiguous free blocks and return the index of the  *
+ *  first, or -1 if no run of 'n' free blocks exists.                */
+int32 fs_alloc_run(uint32 n) {
+  int32 start;
+  uint32 i;
+  if (fsd == NULL || n == 0 || spare() < n)
+    return -1;
+  if ((start = next_fit(n)) == -1)
+    return -1;
+
+  for (i=0; i<n; i++)
+    fs_setmaskbit(start + i);
+  fsd->nextfit = (start + n) % fsd->device.nblocks;
+  return start;
+}
+
+int32 fs_alloc_block(void) {
+  return fs_alloc_run(1);
+}
+
+
+/*  Allocate the block that follows a file's current last block.       *
+ *  'goal' is the block right after it, which is taken if free so the  *
+ *  file stays contiguous.  Otherwise the file starts a new run at a   *
+ *  free stretch of 'fs_alloc_window' blocks and the next-fit cursor   *
+ *  is moved past the whole stretch.  Files growing side by side then  *
+ *  each extend into their own stretch instead of taking turns over    *
+ *  consecutive blocks.  Returns -1 when the device is full.           */
+int32 fs_alloc_goal(uint32 goal) {
+  int32 start;
+  if (fsd == NULL || spare() == 0)
+    return -1;
+  if (fs_alloc_window == 0)
+    return fs_alloc_block();
+  if (goal < fsd->device.nblocks && !fs_getmaskbit(goal)) {
+    fs_setmaskbit(goal);
+    return goal;
+  }
+  if ((start = next_fit(fs_alloc_window)) == -1)     /*  No stretch that long is left, fall  */
+    return fs_alloc_block();                         /*  back to any free block              */
+  fs_setmaskbit(start);
+  fsd->nextfit = (start + fs_alloc_window) % fsd->device.nblocks;
+  return start;
+}
+
+
+/*  Allocate up to 'n' contiguous blocks for file data that was held  *
+ *  back (see lib/fs_delay.c), now that its length is known.  The run  *
+ *  starts at 'goal', right after the file's previous block, for as    *
+ *  long as the blocks there are free.  Otherwise it is the first free  *
+ *  stretch of 'n' blocks, or of half as many if there is none, and    *
+ *  the next-fit cursor moves past it (and past 'fs_alloc_window').    *
+ *  Returns the first block with the length of the run in '*count',    *
+ *  or -1 when the device is full.  It is held to the spare blocks     *
+ *  too, the file being placed has given up its own beforehand.        */
+int32 fs_alloc_extent(uint32 goal, uint32 n, uint32* count) {
+  int32 start = goal;
+  uint32 len;
+  if (fsd == NULL || n == 0 || spare() == 0)
+    return -1;
+  if (n > spare())
+    n = spare();
+  if (goal < fsd->device.nblocks && !fs_getmaskbit(goal)) {
+    len = 1;
+    while (len < n && goal + len < fsd->device.nblocks && !fs_getmaskbit(goal + len))
+      len++;
+  }
+  else {
+    len = n;
+    while (len > 0 && (start = next_fit(len)) == -1)
+      len /= 2;
+    if (len == 0)
+      return -1;
+    fsd->nextfit = (start + (len > fs_alloc_window ? len : fs_alloc_window)) % fsd->device.nblocks;
+  }
+  for (uint32 i=0; i<len; i++)
+    fs_setmaskbit(start + i);
+  *count = len;
+  return start;
+}
+
+
+/*  Allocate the highest free block.  Directory blocks are taken from  *
+ *  the top of the device so they stay out of the contiguous runs      *
+ *  file data is allocated in from the bottom (on a log-structured FS  *
+ *  they are kept above the log).  Returns -1 when the device is full. */
+int32 fs_alloc_high(void) {
+  int32 i, low;
+  if (fsd == NULL || spare() == 0)
+    return -1;
+  low = (fsd->imapblocks ? fsd->log + fsd->nsegs * fsd->segblocks : 0);
+  for (i=fsd->device.nblocks - 1; i>=low; i--) {
+    mask_need(i, i + 1);
+    if (i % 8 == 7 && (byte)fsd->freemask[i / 8] == 0xff) {   /*  Skip full bytes  */
+      i -= 7;
+      continue;
+    }
+    if (!fs_getmaskbit(i)) {
+      fs_setmaskbit(i);
+      return i;
+    }
+  }
+  return -1;
+}
+
+
+/*  Read ('write' = 0) or write block 'b' of the free bitmask.  The  *
+ *  bitmask takes as many blocks as it needs, starting at the block   *
+ *  recorded in the super block ('maskblock').  Returns -1 if a       *
+ *  write failed, the block then stays dirty.                         */
+int32 fs_maskio(uint32 b, byte write) {
+  uint32 blocksz = fsd->device.blocksz;
+  uint32 len = fsd->freemasksz - b * blocksz;
+  len = (len < blocksz ? len : blocksz);
+  if (write) {
+    if ((jnl_active() ? jnl_write(fsd->maskblock + b, 0, fsd->freemask + b * blocksz, len)
+                      : bs_write(fsd->maskblock + b, 0, fsd->freemask + b * blocksz, len)) != 0)
+      return -1;
+    fsd->maskstate[b] &= ~MASK_DIRTY;
+  }
+  else {
+    bs_read(fsd->maskblock + b, 0, fsd->freemask + b * blocksz, len);
+    fsd->maskstate[b] = MASK_LOADED;
+  }
+  return 0;
+}
 
 
 /*  Build the file system and save it to a block device.  *
- *  Must be called before the filesystem can be used      */
+ *  Must be called before the filesystem can be used.     *
+ *  With 'fs_journal_blocks' set, that many blocks after  *
+ *  the bitmask are kept for the metadata journal.  With  *
+ *  'fs_log_segblocks' set files are written to a log of  *
+ *  segments that size instead (see system/lfs.c), after  *
+ *  an inode map with room for an inode every 8 blocks.   *
+ *  The top 1/16 of the device is left for directories.   *
+ *  With 'fs_inline_max' set, files up to that size (or   *
+ *  what is left of a block after the inode) are kept in  *
+ *  their inode block, except in a log.                   */
 void fs_mkfs(void) {
   char mask;
   fsystem_t fsd;
   bdev_t device = bs_stats();
-  uint32 masksize, i;
+  uint32 masksize, maskblocks, jblocks, segblocks, imapblocks, nsegs, used, i;
   mask = disable_interrupts();
   
   masksize = device.nblocks / 8;                          /*                                             */
-  masksize += (device.nblocks % 8 ? 0 : 1);               /*  Construct the 'fsd' variable               */
+  masksize += (device.nblocks % 8 ? 1 : 0);               /*  Construct the 'fsd' variable               */
+  maskblocks = (masksize + device.blocksz - 1) / device.blocksz;
+  jblocks = fs_journal_blocks;
+  if (jblocks != 0 && jblocks < JNL_MIN + maskblocks)     /*  Room for a transaction with every block of */
+    jblocks = JNL_MIN + maskblocks;                       /*  the bitmask (see system/journal.c)         */
+  if (1 + maskblocks + jblocks > device.nblocks / 2)      /*  No journal on a device too small for it    */
+    jblocks = 0;
+  segblocks = fs_log_segblocks;                           /*                                             */
+  if (segblocks > device.blocksz / sizeof(lfssum_t))      /*  A segment summary fits in a block          */
+    segblocks = device.blocksz / sizeof(lfssum_t);        /*                                             */
+  imapblocks = nsegs = 0;                                 /*                                             */
+  if (segblocks >= 4) {                                   /*  A log replaces the journal                 */
+    jblocks = 0;                                          /*                                             */
+    imapblocks = (device.nblocks / 8 * sizeof(uint32) + device.blocksz - 1) / device.blocksz;
+    used = 1 + maskblocks + imapblocks + device.nblocks / 16;
+    nsegs = (used < device.nblocks ? (device.nblocks - used) / segblocks : 0);
+    if (nsegs < LFS_MIN_SEGS)                             /*  No log on a device too small for it        */
+      imapblocks = nsegs = 0;                             /*                                             */
+  }                                                       /*                                             */
   fsd.device = device;                                    /*  and set to initial values                  */
   fsd.freemasksz = masksize;                              /*                                             */
+  fsd.maskblock = BM_BIT;                                 /*  The bitmask follows the super block        */
+  fsd.maskblocks = maskblocks;                            /*                                             */
+  fsd.journal = (jblocks ? BM_BIT + maskblocks : 0);      /*  and the journal (if any) follows that      */
+  fsd.jblocks = jblocks;                                  /*                                             */
+  fsd.imap = (imapblocks ? BM_BIT + maskblocks : 0);      /*  or the inode map and the log (if any)      */
+  fsd.imapblocks = imapblocks;                            /*                                             */
+  fsd.log = fsd.imap + imapblocks;                        /*                                             */
+  fsd.nsegs = nsegs;                                      /*                                             */
+  fsd.segblocks = (nsegs ? segblocks : 0);                /*                                             */
+  fsd.loghead = fsd.log;                                  /*                                             */
+  fsd.inlinemax = (nsegs ? 0 : fs_inline_max);            /*  Small files go in the rest of their inode  */
+  if (fsd.inlinemax > device.blocksz - sizeof(inode_t))   /*  block, which a log does not keep           */
+    fsd.inlinemax = device.blocksz - sizeof(inode_t);     /*                                             */
+  fsd.freeblocks = device.nblocks - 1 - maskblocks - jblocks - imapblocks;
+  fsd.nextfit = 0;                                        /*                                             */
+  fsd.maskdirty = 0;                                      /*                                             */
   fsd.freemask = malloc(masksize);                        /*  Allocate the free bitmask                  */
   fsd.root_dir.numentries = 0;                            /*                                             */
 
   for (i=0; i<masksize; i++)                              /*                                             */
     fsd.freemask[i] = 0;                                  /*  Initially clear the free bitmask           */
                                                           /*                                             */
-  for (i=0; i<DIR_SIZE; i++) {                            /*  Set up the directory entries as            */
-    fsd.root_dir.entry[i].inode_block = EMPTY;            /*  empty.                                     */
-    memset(fsd.root_dir.entry[i].name, 0, FILENAME_LEN);  /*                                             */
-  }                                                       /*                                             */
+  fsd.root_dir.inode.id = ROOT_DIR;                       /*  The root directory starts without any      */
+  fsd.root_dir.inode.size = 0;                            /*  blocks, they are allocated as entries      */
+  for (i=0; i<INODE_BLOCKS; i++)                          /*  are added                                  */
+    fsd.root_dir.inode.blocks[i] = EMPTY;                 /*                                             */
+  fsd.root_dir.inode.indirect = EMPTY;                    /*                                             */
+  fsd.root_dir.inode.dindirect = EMPTY;                   /*                                             */
   
   fsd.freemask[SB_BIT / 8] |= 0x1 << (SB_BIT % 8);        /*                                             */
-  fsd.freemask[BM_BIT / 8] |= 0x1 << (BM_BIT % 8);        /*  Set  the  super  block  and free  bitmask  */
-  bs_write(SB_BIT, 0, &fsd, sizeof(fsystem_t));           /*  block  as used  and write  the 'fsd'  and  */
-  bs_write(BM_BIT, 0, fsd.freemask, fsd.freemasksz);      /*  bitmask to the 0 and 1 block respectively  */
+  used = BM_BIT + maskblocks + jblocks + imapblocks;      /*                                             */
+  for (i=BM_BIT; i<used; i++)                             /*  Set  the  super  block  and free  bitmask  */
+    fsd.freemask[i / 8] |= 0x1 << (i % 8);                /*  blocks as used and write the 'fsd' and     */
+  bs_write(SB_BIT, 0, &fsd, sizeof(fsystem_t));           /*  bitmask  to block 0  and the blocks that   */
+  for (i=0; i<maskblocks; i++)                            /*  follow it respectively                     */
+    bs_write(BM_BIT + i, 0, fsd.freemask + i * device.blocksz,
+             (i == maskblocks - 1 ? masksize - i * device.blocksz : device.blocksz));
+  if (jblocks)                                            /*                                             */
+    jnl_format(fsd.journal);                              /*                                             */
+  if (imapblocks)                                         /*                                             */
+    lfs_format(&fsd);                                     /*                                             */
   free(fsd.freemask);                                     /*                                             */
 
   restore_interrupts(mask);
@@ -59,30 +317,77 @@ void fs_mkfs(void) {
 }
 
 
+/*  Undo what 'fs_mount' set up before it failed and forget the   *
+ *  half built 'fsd'.  Each release only acts on what was started,  *
+ *  the bitmask was never changed so the journal must not write it. */
+static uint32 mount_failed(char mask) {
+  fsd->maskdirty = 0;
+  jnl_release();
+  lfs_release();
+  bc_destroy();
+  fs_dir_release();
+  free(fsd->maskstate);
+  free(fsd->freemask);
+  free(fsd);
+  fsd = NULL;
+  restore_interrupts(mask);
+  return -1;
+}
+
+
 /*  Take an initialized block device containing a file system *
  *  and copies it into the 'fsd' to make it the active file   *
- *  system.                                                   */
+ *  system.  The free bitmask is read as it is used (unless   *
+ *  'fs_mask_lazy' is cleared), the number of free blocks is  *
+ *  taken from the super block.                               */
 uint32 fs_mount(void) {
   char mask;
-  int i;
+  int i, replayed;
 
   mask = disable_interrupts();
-  if ((fsd = (fsystem_t*)malloc(sizeof(fsystem_t))) == (fsystem_t*)-1) {  /*                              */
+  if ((fsd = (fsystem_t*)malloc(sizeof(fsystem_t))) == NULL) {            /*                              */
     restore_interrupts(mask);                                             /*  Allocate space for the fsd  */
     return -1;                                                            /*                              */
   }                                                                       /*  Read the contents of the    */
   bs_read(SB_BIT, 0, fsd, sizeof(fsystem_t));                             /*  superblock into the 'fsd'   */
-  if ((fsd->freemask = malloc(fsd->freemasksz)) == (char*)-1) {           /*                              */
-    restore_interrupts(mask);                                             /*  Allocate space for the      */
-    return -1;                                                            /*  free bitmask and read       */
-  }                                                                       /*  the block from the block    */
-  bs_read(BM_BIT, 0, fsd->freemask, fsd->freemasksz);                     /*  device.                     */
+  if ((replayed = jnl_init()) == -1) {                                    /*  Replay the journal (if the  */
+    free(fsd);                                                            /*  FS has one), which may have */
+    fsd = NULL;                                                           /*  rewritten the super block   */
+    restore_interrupts(mask);                                             /*                              */
+    return -1;                                                            /*                              */
+  }                                                                       /*                              */
+  if (replayed > 0)                                                       /*                              */
+    bs_read(SB_BIT, 0, fsd, sizeof(fsystem_t));                           /*                              */
+  fsd->freemask = malloc(fsd->freemasksz);                                /*                              */
+  fsd->maskstate = malloc(fsd->maskblocks);                               /*  Allocate space for the      */
+  if (fsd->freemask == NULL || fsd->maskstate == NULL)                    /*  free bitmask and the state  */
+    return mount_failed(mask);                                            /*  of each of its blocks, none */
+                                                                          /*  of which has been read yet  */
+  heap_transfer(fsd, M_KERNEL);                                           /*  All of them outlive the     */
+  heap_transfer(fsd->freemask, M_KERNEL);                                 /*  thread that mounted the FS  */
+  heap_transfer(fsd->maskstate, M_KERNEL);                                /*                              */
+  memset(fsd->maskstate, 0, fsd->maskblocks);                             /*                              */
+  for (i=0; !fs_mask_lazy && i<fsd->maskblocks; i++)                      /*                              */
+    fs_maskio(i, 0);                                                      /*                              */
+                                                                          /*  Start allocating from the   */
+  fsd->nextfit = 0;                                                       /*  beginning of the device     */
+  fsd->maskdirty = 0;                                                     /*                              */
+  fsd->root_dir.numentries = fs_dir_count(&fsd->root_dir.inode);          /*  Count the directory entries */
+  fs_dir_init();                                                          /*  and index them anew         */
 
   for (i=0; i<NUM_FD; i++) {                                              /*                              */
     oft[i].state = FSTATE_CLOSED;                                         /*  Initialize the open file    */
     oft[i].head = 0;                                                      /*  table                       */
     oft[i].direntry = 0;                                                  /*                              */
+    oft[i].parent = ROOT_DIR;                                             /*                              */
+    oft[i].dirty = 0;                                                     /*                              */
+    oft[i].held = NULL;                                                   /*                              */
+    oft[i].hcount = 0;                                                    /*                              */
   }                                                                       /*                              */
+                                                                          /*                              */
+  if (bc_init(BC_NBUFS) == -1 || lfs_init() == -1)                       /*  Start with an empty block   */
+    return mount_failed(mask);                                            /*  cache, and load the inode   */
+                                                                          /*  map of a log-structured FS  */
 
   restore_interrupts(mask);
   return 0;
@@ -90,15 +395,35 @@ uint32 fs_mount(void) {
 
 
 /*  Write the current state of the file system to a block device and  *
- *  free the resources for the file system.                           */
+ *  free the resources for the file system.  It stays mounted if the  *
+ *  data open files hold back could not be written.                   */
 uint32 fs_umount(void) {
   char mask = disable_interrupts();
 
-  bs_write(BM_BIT, 0, fsd->freemask, fsd->freemasksz);     /*  Write the bitmask and super blocks to  */
-  bs_write(SB_BIT, 0, fsd, sizeof(fsystem_t));             /*  their respective block device blocks   */
+  if (fsd == NULL || fs_sync() == -1) {                    /*  Nothing is mounted, or held data was   */
+    restore_interrupts(mask);                              /*  not written (see 'fs_delay_flush')     */
+    return -1;                                             /*                                         */
+  }                                                        /*                                         */
+  for (int i=0; i<NUM_FD; i++) {                           /*  Write back dirty inodes and buffers,   */
+    free(oft[i].held);                                     /*  close the open files and drop their    */
+    oft[i].held = NULL;                                    /*  buffers,                               */
+    oft[i].hcount = 0;                                     /*                                         */
+    oft[i].dirty = 0;                                      /*                                         */
+    oft[i].state = FSTATE_CLOSED;                          /*                                         */
+  }                                                        /*                                         */
+  jnl_release();                                           /*  empty the journal, release the cache   */
+  lfs_release();                                           /*  (and the inode map of a log)           */
+  bc_destroy();                                            /*  and the directory                      */
+  fs_dir_release();                                        /*  index, then write the bitmask and      */
+  fs_flush_freemask();                                     /*  super blocks to their respective       */
+  bs_write(SB_BIT, 0, fsd, sizeof(fsystem_t));             /*  block device blocks                    */
 
-  free(fsd->freemask);                                     /*  Free memory used for the filesystem    */
+  free(fsd->maskstate);                                    /*  Free memory used for the filesystem    */
+  free(fsd->freemask);                                     /*  and forget it, so the flusher thread   */
+  fsd->maskstate = NULL;                                   /*  and later calls see that nothing is    */
+  fsd->freemask = NULL;                                    /*  mounted                                */
   free((void*)fsd);                                        /*                                         */
+  fsd = NULL;                                              /*                                         */
   
   restore_interrupts(mask);
   return 0;
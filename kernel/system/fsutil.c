@@ -34,37 +34,46 @@ void fs_print_mask(void) {
 
 /*  Print the contents of the open file table  */
 void fs_print_oft(void) {
+  inode_t dir;
+  dirent_t entry;
   int i;
 
   printf("\n    oft\n");
   printf("Num  state  fileptr  in.id  name\n");
   for (i=0; i<NUM_FD; i++) {
+    if (fs_dir_get(fs_dir_inode(oft[i].parent, &dir), oft[i].direntry, &entry) == -1)
+      entry.name[0] = '\0';
     printf("%3d  %5s  %7d  %5d  %s 0x%x\n", i,
 	    (oft[i].state == FSTATE_OPEN ? "OPEN" : "CLOSE"),
 	    oft[i].head,
-	    fsd->root_dir.entry[oft[i].direntry].name,
+	    entry.name,
 	    &oft);
   }
 }
 
 /*  Print the entries in the root directory  */
 void fs_print_root(void) {
+  dirent_t entry;
   int i;
   printf("\n    root directory [%d entries]\n", fsd->root_dir.numentries);
   printf("ID  block  name          blocks\n");
   for (i=0; i<fsd->root_dir.numentries; i++) {
+    fs_dir_get(&fsd->root_dir.inode, i, &entry);
     printf("%2d %5d %s \n", i,
-	   fsd->root_dir.entry[i].inode_block,
-	   fsd->root_dir.entry[i].name);
+	   entry.inode_block,
+	   entry.name);
   }
 }
 
 /*  Print the status of a entry in the open file table  */
 void fs_print_fd(int32 fd) {
+  inode_t dir;
+  dirent_t entry;
   int sz=0,i=0;
 
   printf("\n    file descriptor [%d]\n", fd);
-  printf("Name:    %s\n", fsd->root_dir.entry[oft[fd].direntry].name);
+  fs_dir_get(fs_dir_inode(oft[fd].parent, &dir), oft[fd].direntry, &entry);
+  printf("Name:    %s\n", entry.name);
   printf("State:   %d\n", oft[fd].state);
   printf("Fileptr: %d\n", oft[fd].head);
   printf("Size:    %d\n", oft[fd].inode.size);
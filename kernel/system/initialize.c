@@ -23,14 +23,28 @@ extern uint32* mem_end;       /*    (see mmap.c and kernel.ld for source)    */
 void ctxload(uint64**);
 
 uint32 boot_complete = 0;
+uint64 boot_misa;            /*  Written by the bootstrap before 'initialize' runs  */
 
+/*
+ *  The file system is kept on the virtio disk when QEMU has one attached
+ *  and is only made anew if the disk does not already hold one of the same
+ *  shape (the super block starts with the device geometry).  Without a disk
+ *  a fresh file system is made on a ramdisk.
+ */
 void fs_init(){
-  uint32 ramdisk_result = bs_mk_ramdisk(MDEV_BLOCK_SIZE, MDEV_NUM_BLOCKS);
-  if (ramdisk_result != 0) {
-      return;
+  bdev_t saved;
+  if (bs_mk_vdisk(MDEV_BLOCK_SIZE) == 0) {
+      if (bs_read(SB_BIT, 0, &saved, sizeof(bdev_t)) != 0 ||
+          saved.blocksz != bs_stats().blocksz || saved.nblocks != bs_stats().nblocks)
+          fs_mkfs();
+  }
+  else {
+      uint32 ramdisk_result = bs_mk_ramdisk(MDEV_BLOCK_SIZE, MDEV_NUM_BLOCKS);
+      if (ramdisk_result != 0) {
+          return;
+      }
+      fs_mkfs();
   }
-
-  fs_mkfs();
 
   uint32 mount_result = fs_mount();
   if (mount_result != 0) {
@@ -42,6 +56,7 @@ void initialize(void) {
   char mask;
   mask = disable_interrupts();
   uart_init();
+  mem_init(boot_misa);
 
   for(int i = 0; i < NTHREADS; i++){
     thread_table[i].state = TH_FREE;
@@ -0,0 +1,358 @@
+#include <barelib.h>
+#include <interrupts.h>
+#include <malloc.h>
+#include <fs.h>
+#include <bcache.h>
+#include <journal.h>
+
+/*
+ *  Write-ahead journal of the file system metadata.  A file system made
+ *  with a journal ('fs_journal_blocks', see 'fs_mkfs') sends its inode,
+ *  directory, indirect, bitmask and super block writes through
+ *  'jnl_write'.  The change is made to the cached block, which joins the
+ *  running transaction and is pinned in the cache so it cannot reach its
+ *  home location before the transaction commits.
+ *
+ *  Nothing is written while operations run.  'jnl_commit' (called by
+ *  'fs_sync', so at least every FS_FLUSH_TICKS by the flusher thread)
+ *  writes the file data first and then the whole transaction in one
+ *  vectored write: a descriptor block listing the home of each block and
+ *  a checksum of their images, followed by the images.  Every operation
+ *  since the previous commit shares that write.  The bitmask blocks that
+ *  changed and the super block join every transaction as it commits
+ *  (see 'commit'), so a logged inode or indirect block never points at
+ *  blocks the bitmask on the device still shows as free.  A commit asked for while
+ *  an operation is still running (between 'jnl_begin' and 'jnl_end') is
+ *  left to the last one to end, so a transaction never holds half an
+ *  operation.  The same goes for a transaction filling up (JNL_TXN_MAX):
+ *  it takes up to JNL_OP_MAX more blocks while operations run, and an
+ *  operation that would log more than that fails instead.  Operations
+ *  are kept small enough ('fs_write' splits a long write into several).
+ *  Once committed the blocks are unpinned and reach their home with the
+ *  ordinary cache write back.
+ *
+ *  When the journal is close to full every dirty buffer is written home
+ *  and the journal is emptied by moving the sequence number in its header
+ *  past the transactions it holds (a checkpoint).  Mounting replays the
+ *  transactions that follow the header, stopping at the first one that
+ *  does not carry the next sequence number or whose images do not match
+ *  their checksum.  The only blocks freed while mounted are ones taken by
+ *  an operation that then failed (an inode block, an indirect block or
+ *  data blocks), before anything was logged to them, so a replayed image
+ *  never lands on data written since.
+ */
+
+static byte active = 0;             /*  Set while metadata goes through the journal          */
+static uint32 start;                /*  First block of the journal (its header)              */
+static uint32 nblocks;              /*  Blocks in the journal                                */
+static uint32 blocksz;              /*  Size of a block on the device                        */
+static uint32 head;                 /*  Journal block the next transaction is written at     */
+static uint32 sequence;             /*  Number of the running transaction                    */
+static bcbuf_t** txn = NULL;        /*  Buffers pinned by the running transaction, up to     */
+static uint32 ntxn;                 /*  'txnmax' of them                                     */
+static uint32 txnmax;               /*                                                       */
+static bsvec_t* vec = NULL;         /*  Segments of a commit (one more than 'txnmax')        */
+static byte committing;             /*  Set while 'commit' adds the free bitmask             */
+static uint32 ops;                  /*  Operations between 'jnl_begin' and 'jnl_end'         */
+static uint32 txnops;               /*  Operations started since the last commit             */
+static byte pending;                /*  A commit waits for the running operations            */
+static jnldesc_t* desc = NULL;      /*  Block sized buffer for descriptor blocks             */
+static jnlstat_t stats;
+
+
+/*  Write the header of an empty journal starting at block 'first'  *
+ *  and make sure no descriptor follows it.                         */
+void jnl_format(uint32 first) {
+  jnlhdr_t hdr = { JNL_MAGIC, 1 };
+  jnldesc_t none;
+  memset(&none, 0, sizeof(jnldesc_t));
+  bs_write(first, 0, &hdr, sizeof(jnlhdr_t));
+  bs_write(first + 1, 0, &none, sizeof(jnldesc_t));
+}
+
+
+/*  Returns 1 if 'desc' read from journal block 'pos' starts the  *
+ *  transaction the journal expects next                          */
+static byte expected(uint32 pos) {
+  if (desc->magic != JNL_DESC || desc->sequence != sequence ||
+      desc->count == 0 || desc->count > txnmax || pos + 1 + desc->count > nblocks)
+    return 0;
+  for (uint32 i=0; i<desc->count; i++)
+    if (desc->blocks[i] >= fsd->device.nblocks)
+      return 0;
+  return 1;
+}
+
+/*  Copy the images of every complete transaction to their home  *
+ *  blocks.  Returns the number of transactions replayed.        */
+static int32 replay(void) {
+  char* img = malloc(blocksz);
+  uint32 pos = 1, sum;
+  int32 n = 0;
+
+  if (img == NULL)
+    return -1;
+  while (pos < nblocks) {
+    if (bs_read(start + pos, 0, desc, blocksz) != 0 || !expected(pos))
+      break;
+    sum = 0;
+    for (uint32 i=0; i<desc->count; i++) {
+      bs_read(start + pos + 1 + i, 0, img, blocksz);
+      sum += checksum(img, blocksz);
+    }
+    if (sum != desc->checksum)                        /*  Torn by a crash while it was written  */
+      break;
+    for (uint32 i=0; i<desc->count; i++) {
+      bs_read(start + pos + 1 + i, 0, img, blocksz);
+      bs_write(desc->blocks[i], 0, img, blocksz);
+    }
+    pos += desc->count + 1;
+    sequence++;
+    n++;
+  }
+  free(img);
+  return n;
+}
+
+
+/*  Write every dirty buffer home and empty the journal.  The block  *
+ *  store must not be plugged by the caller, the header may only be  *
+ *  written once the home blocks are on the device (the journal is   *
+ *  kept and -1 returned if they are not).                           */
+static int32 checkpoint(void) {
+  jnlhdr_t hdr = { JNL_MAGIC, sequence };
+  int32 result;
+  bs_plug();
+  result = bc_flush();
+  bs_unplug();
+  if (result != 0 || bs_write(start, 0, &hdr, sizeof(jnlhdr_t)) != 0)
+    return -1;
+  head = 1;
+  stats.checkpoints++;
+  return 0;
+}
+
+/*  Write the running transaction to the journal, after the file data  *
+ *  and earlier transactions have been written home, and unpin it.     *
+ *  The bitmask blocks that changed and the super block join it first  *
+ *  (there is room for them past JNL_TXN_LIMIT).                       */
+static int32 commit(void) {
+  int32 result;
+
+  committing = 1;
+  result = fs_flush_freemask();
+  committing = 0;
+  if (result != 0)
+    return -1;
+  if (ntxn == 0)
+    return 0;
+  if (head + ntxn + 1 > nblocks && checkpoint() != 0)  /*  Ran past JNL_TXN_MAX, which did not fit  */
+    return -1;
+  bs_plug();
+  result = bc_flush();
+  bs_unplug();
+  if (result != 0)                                  /*  The data it points at must be home first  */
+    return -1;
+
+  desc->magic = JNL_DESC;
+  desc->sequence = sequence;
+  desc->count = ntxn;
+  desc->checksum = 0;
+  vec[0].block = start + head;
+  vec[0].offset = 0;
+  vec[0].buf = desc;
+  vec[0].len = blocksz;
+  for (uint32 i=0; i<ntxn; i++) {
+    desc->blocks[i] = txn[i]->block;
+    desc->checksum += checksum(txn[i]->data, blocksz);
+    vec[i + 1].block = start + head + 1 + i;
+    vec[i + 1].offset = 0;
+    vec[i + 1].buf = txn[i]->data;
+    vec[i + 1].len = blocksz;
+  }
+  if (bs_writev(vec, ntxn + 1) != 0)                /*  Stays pinned, the next commit tries again  */
+    return -1;
+
+  for (uint32 i=0; i<ntxn; i++)
+    bc_pin(txn[i], 0);
+  head += ntxn + 1;
+  sequence++;
+  stats.commits++;
+  stats.logged += ntxn;
+  stats.ops += txnops;
+  ntxn = txnops = 0;
+  pending = 0;
+  if (head + JNL_TXN_MAX + 1 > nblocks)             /*  No room for the largest transaction  */
+    checkpoint();
+  return 0;
+}
+
+
+/*  Start logging to the journal of the mounted file system, once the  *
+ *  transactions it holds have been replayed.  Returns the number of   *
+ *  transactions replayed (the super block may be one of the blocks    *
+ *  rewritten), 0 if the file system has no journal or -1 if the       *
+ *  journal cannot be read or is too small for a transaction with      *
+ *  every block of the bitmask.                                        */
+int32 jnl_init(void) {
+  jnlhdr_t hdr;
+  int32 n;
+  char mask = disable_interrupts();
+
+  active = 0;
+  memset(&stats, 0, sizeof(stats));
+  if (fsd == NULL || fsd->jblocks == 0) {
+    restore_interrupts(mask);
+    return 0;
+  }
+  start = fsd->journal;
+  nblocks = fsd->jblocks;
+  blocksz = fsd->device.blocksz;
+  txnmax = JNL_TXN_LIMIT + fsd->maskblocks + 1;
+  if (nblocks < JNL_MIN || start + nblocks > fsd->device.nblocks || txnmax + 2 > nblocks ||
+      txnmax > (blocksz - sizeof(jnldesc_t)) / sizeof(uint32) ||
+      bs_read(start, 0, &hdr, sizeof(jnlhdr_t)) != 0 || hdr.magic != JNL_MAGIC) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  desc = malloc(blocksz);
+  txn = malloc(txnmax * sizeof(bcbuf_t*));
+  vec = malloc((txnmax + 1) * sizeof(bsvec_t));
+  if (desc == NULL || txn == NULL || vec == NULL) {
+    free(desc);
+    free(txn);
+    free(vec);
+    desc = NULL;
+    txn = NULL;
+    vec = NULL;
+    restore_interrupts(mask);
+    return -1;
+  }
+  heap_transfer(desc, M_KERNEL);
+  heap_transfer(txn, M_KERNEL);
+  heap_transfer(vec, M_KERNEL);
+
+  sequence = hdr.sequence;
+  if ((n = replay()) == -1) {
+    free(desc);
+    free(txn);
+    free(vec);
+    desc = NULL;
+    txn = NULL;
+    vec = NULL;
+    restore_interrupts(mask);
+    return -1;
+  }
+  if (n > 0) {
+    hdr.sequence = sequence;                        /*  Empty the journal  */
+    bs_write(start, 0, &hdr, sizeof(jnlhdr_t));
+  }
+  stats.replayed = (n > 0 ? n : 0);
+  head = 1;
+  ntxn = ops = txnops = 0;
+  pending = 0;
+  active = 1;
+  restore_interrupts(mask);
+  return n;
+}
+
+/*  Commit what is left, empty the journal and go back to writing  *
+ *  metadata in place.  Called before the block cache is released.  */
+void jnl_release(void) {
+  char mask = disable_interrupts();
+  if (active) {
+    commit();
+    for (uint32 i=0; i<ntxn; i++)                   /*  Only left if the commit failed  */
+      bc_pin(txn[i], 0);
+    ntxn = 0;
+    checkpoint();
+    free(desc);
+    free(txn);
+    free(vec);
+    desc = NULL;
+    txn = NULL;
+    vec = NULL;
+    active = 0;
+  }
+  restore_interrupts(mask);
+}
+
+byte jnl_active(void) {
+  return active;
+}
+
+
+/*  Operations that change metadata are bracketed by 'jnl_begin' and  *
+ *  'jnl_end'.  An operation starting while no other is running        *
+ *  commits first if its blocks might not fit in the transaction.      */
+void jnl_begin(void) {
+  char mask = disable_interrupts();
+  if (active) {
+    if (ops == 0 && ntxn > JNL_TXN_MAX - JNL_OP_MAX)
+      commit();
+    ops++;
+    txnops++;
+  }
+  restore_interrupts(mask);
+}
+
+void jnl_end(void) {
+  char mask = disable_interrupts();
+  if (active && ops > 0 && --ops == 0 && pending)
+    commit();
+  restore_interrupts(mask);
+}
+
+
+/*  Same contract as 'bc_write'.  While the journal is active the block  *
+ *  joins the running transaction and stays in the cache until it has    *
+ *  committed.  A transaction that is full commits on the spot, or once  *
+ *  the operations running have ended.  Returns -1 (and changes nothing) *
+ *  if they log more than JNL_TXN_LIMIT blocks.                          */
+int32 jnl_write(uint32 block, uint32 offset, void* buf, uint32 len) {
+  bcbuf_t* b;
+  char mask;
+
+  if (!active)
+    return bc_write(block, offset, buf, len);
+  if (offset + len > blocksz || block >= fsd->device.nblocks)
+    return -1;
+  mask = disable_interrupts();
+  if ((b = bc_get(block, offset != 0 || len != blocksz)) == NULL) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  if (!b->pinned) {
+    if ((!committing && ((ntxn >= JNL_TXN_MAX && ops == 0 && commit() != 0) || ntxn == JNL_TXN_LIMIT)) ||
+        ntxn == txnmax) {
+      bc_put(b, 0);
+      restore_interrupts(mask);
+      return -1;
+    }
+    bc_pin(b, 1);
+    txn[ntxn++] = b;
+    if (ntxn >= JNL_TXN_MAX)                        /*  Committed as the operations end  */
+      pending = 1;
+  }
+  memcpy(b->data + offset, buf, len);
+  bc_put(b, 1);
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Commit the running transaction, or once the operations running  *
+ *  now have ended.  Returns -1 if the journal could not be written. */
+int32 jnl_commit(void) {
+  int32 result = 0;
+  char mask = disable_interrupts();
+  if (active && ops > 0)
+    pending = 1;
+  else if (active)
+    result = commit();
+  restore_interrupts(mask);
+  return result;
+}
+
+jnlstat_t jnl_stats(void) {
+  return stats;
+}
@@ -3,9 +3,11 @@
 #include <interrupts.h>
 #include <syscall.h>
 #include <bareio.h>
+#include <malloc.h>
 
 /*  Takes an index into the thread_table.  If that thread is not free (in use),  *
- *  sets the thread to defunct and raises a RESCHED syscall.                     */
+ *  sets the thread to defunct and raises a RESCHED syscall.  Any heap memory    *
+ *  the thread or its reaped children still own is returned to the heap.        */
 int32 kill_thread(uint32 threadid) {
   char mask;
   if (threadid >= NTHREADS || thread_table[threadid].state == TH_FREE) /*                                                             */
@@ -13,9 +15,13 @@ int32 kill_thread(uint32 threadid) {
 
   mask = disable_interrupts();              /*  Ensure cleanup cannot be interrupted  */
   for (int i=0; i<NTHREADS; i++) {          /*                                        */
-    if (thread_table[i].parent == threadid) /*  Identify all children of the thread   */
+    if (thread_table[i].parent == threadid && /*  Identify all children of the thread   */
+        thread_table[i].state != TH_FREE) {   /*                                        */
       thread_table[i].state = TH_FREE;      /*  Reap running children threads         */
+      heap_reclaim(i);                      /*  and the heap memory they still own    */
+    }
   }
+  heap_reclaim(threadid);                   /*  Free memory that was not handed off   */
 
   thread_table[threadid].state = TH_DEFUNCT; /*  Set the thread's state to TH_DEFUNCT  */
   restore_interrupts(mask);                  /*  Restore the interrupt mask            */
@@ -0,0 +1,726 @@
+#include <barelib.h>
+#include <interrupts.h>
+#include <malloc.h>
+#include <thread.h>
+#include <sleep.h>
+#include <fs.h>
+#include <bcache.h>
+#include <lfs.h>
+
+/*
+ *  Log-structured layout of the file system.  A file system made with
+ *  'fs_log_segblocks' set (see 'fs_mkfs') does not write file data in
+ *  place.  Every block 'fs_write' touches, the indirect blocks it adds
+ *  and every inode written back go to the head of the log, so writes of
+ *  any pattern reach the device as long sequential runs.  The log is a
+ *  row of segments of 'segblocks' blocks, the first of which is the
+ *  summary of the segment (see 'lfssum_t').  The old copy of a rewritten
+ *  block is freed in the bitmask.  A segment without a used block is
+ *  clean, and the log moves on to the next clean segment once the one it
+ *  writes to is full.
+ *
+ *  Files are named by inode number instead of inode block.  The inode
+ *  map, kept after the bitmask, holds the block of the latest copy of
+ *  each inode.  It is written in place by the checkpoints of the log
+ *  ('lfs_checkpoint', called by 'fs_sync'), together with the bitmask and
+ *  the position of the log head in the super block, and mounting carries
+ *  on from the last checkpoint.  Directories keep their blocks in place,
+ *  above the log, and pointers are changed in place in the indirect
+ *  blocks.  Only the indirect blocks themselves move.
+ *
+ *  Nothing the last checkpoint refers to is written over, so mounting
+ *  after a crash finds the file system as it was then.  Indirect blocks
+ *  written before the checkpoint are copied to the log before a pointer
+ *  in them changes ('lfs_renew'), and the log only moves on to segments
+ *  that were already clean at the checkpoint.
+ *
+ *  The cleaner empties the segments with the fewest used blocks by
+ *  copying their live blocks to the head of the log.  It runs when the
+ *  log is down to LFS_CLEAN_RESERVE clean segments, and from the cleaner
+ *  thread while the system is idle.  Each run ends with a checkpoint,
+ *  after which the segments it emptied can be written again.
+ */
+
+static byte active = 0;             /*  Set while files are written to the log                */
+static uint32 blocksz;              /*  Size of a block on the device                         */
+static uint32 segblocks;            /*  Blocks in a segment, its summary included             */
+static uint32* imap = NULL;         /*  Block of the latest copy of each inode (or EMPTY)     */
+static uint32 ninodes;              /*  Entries in 'imap'                                     */
+static byte* imapdirty = NULL;      /*  Inode map blocks changed since the last checkpoint    */
+static char* segbuf = NULL;         /*  Segment sized buffer the cleaner reads a segment into */
+static uint32 seg;                  /*  Segment the log is written to                         */
+static uint32 head;                 /*  Block of that segment the log continues at            */
+static uint32 fresh;                /*  First block of it written since the last checkpoint   */
+static uint32 nextino;              /*  Inode number 'lfs_ialloc' starts looking at           */
+static byte cleaning;               /*  Set while the cleaner runs                            */
+static byte* reusable = NULL;       /*  Segments clean at the last checkpoint                 */
+static byte* young = NULL;          /*  Segments the log moved on to since then               */
+static char* segwbuf = NULL;        /*  File blocks of the current segment held back from the */
+static byte* held = NULL;           /*  device, and which of its blocks they are              */
+static uint32 nheld;                /*                                                        */
+static lfsstat_t stats;
+
+static inode_t* owner = NULL;       /*  Inode of the file the cleaner is moving blocks of     */
+static uint32 ownerino;             /*  and its number.  An open file's copy in the open      */
+static int32 ownerfd;               /*  file table is the one changed ('ownerfd'), otherwise  */
+static char ownerdirty;             /*  'ownerbuf' is appended to the log when done with it   */
+static inode_t ownerbuf;            /*                                                        */
+
+#define first(s) (fsd->log + (s) * segblocks)                  /*  Summary block of segment 's'    */
+#define end(s) (first(s) + segblocks)                          /*  Block after segment 's'         */
+#define clean(s) (bitmap_scan((byte*)fsd->freemask, first(s), end(s), 1) == -1)
+
+
+/*  Write an empty inode map for the file system described by 'fs'.  */
+void lfs_format(fsystem_t* fs) {
+  char* buf = malloc(fs->device.blocksz);
+  if (buf == NULL)
+    return;
+  memset(buf, 0xff, fs->device.blocksz);
+  for (uint32 b=0; b<fs->imapblocks; b++)
+    bs_write(fs->imap + b, 0, buf, fs->device.blocksz);
+  free(buf);
+}
+
+
+/*  Returns 1 if 'block' was written since the last checkpoint, which  *
+ *  can then be changed where it is                                    */
+static byte isfresh(uint32 block) {
+  uint32 s;
+  if (block < fsd->log || block >= first(fsd->nsegs))
+    return 0;
+  s = (block - fsd->log) / segblocks;
+  if (s == seg)
+    return block >= fresh && block < head;
+  return young[s] && block != first(s);
+}
+
+#define slot(b) ((b) - first(seg))                             /*  Position in the current segment */
+#define isheld(b) ((b) >= first(seg) && (b) < head && held[slot(b)])
+
+
+/*  Write the file blocks held back in 'segwbuf', along with the blocks  *
+ *  of the segment waiting in the cache (its summary, inodes and         *
+ *  indirect blocks), under a single plug.  Blocks that follow each      *
+ *  other on the disk reach it as one request.                           */
+static void drain(void) {
+  bsvec_t vec[FS_IOV_MAX];
+  uint32 n = 0, b;
+
+  if (nheld == 0)
+    return;
+  bs_plug();
+  for (b=first(seg); b<head; b++) {
+    if (!held[slot(b)]) {
+      bc_sync_block(b);
+      continue;
+    }
+    held[slot(b)] = 0;
+    if (n > 0 && vec[n - 1].block + vec[n - 1].len / blocksz == b) {
+      vec[n - 1].len += blocksz;
+      continue;
+    }
+    if (n == FS_IOV_MAX) {
+      bc_writev(vec, n);
+      n = 0;
+    }
+    vec[n].block = b;
+    vec[n].offset = 0;
+    vec[n].buf = segwbuf + slot(b) * blocksz;
+    vec[n].len = blocksz;
+    n++;
+  }
+  bc_writev(vec, n);
+  bs_unplug();
+  nheld = 0;
+}
+
+/*  Hold new log block 'block' back in 'segwbuf' and return its buffer  */
+static char* hold(uint32 block) {
+  held[slot(block)] = 1;
+  nheld++;
+  return segwbuf + slot(block) * blocksz;
+}
+
+/*  Write out the file blocks the log holds back, before they are read  */
+void lfs_flush(void) {
+  char mask = disable_interrupts();
+  if (active)
+    drain();
+  restore_interrupts(mask);
+}
+
+
+/*  Number of used blocks in segment 's', its summary included  */
+static uint32 used(uint32 s) {
+  uint32 n = 0;
+  for (uint32 b=first(s); b<end(s); b++)
+    n += fs_getmaskbit(b);
+  return n;
+}
+
+uint32 lfs_clean_segments(void) {
+  uint32 n = 0;
+  for (uint32 s=0; active && s<fsd->nsegs; s++)
+    n += clean(s);
+  return n;
+}
+
+/*  Number of clean segments the log may move on to before the next  *
+ *  checkpoint                                                        */
+static uint32 reusable_segments(void) {
+  uint32 n = 0;
+  for (uint32 s=0; s<fsd->nsegs; s++)
+    n += (reusable[s] && clean(s));
+  return n;
+}
+
+/*  Move the log on to the next segment after the current one that  *
+ *  was clean at the last checkpoint and start its summary.  Returns  *
+ *  -1 if there is none left.                                         */
+static int32 next_segment(void) {
+  uint32 s;
+  for (uint32 k=1; k<=fsd->nsegs; k++) {
+    s = (seg + k) % fsd->nsegs;
+    if (reusable[s] && clean(s)) {
+      reusable[s] = 0;
+      young[s] = 1;
+      seg = s;
+      bc_fill(first(s), 0xff);
+      fs_setmaskbit(first(s));
+      head = fresh = first(s) + 1;
+      stats.segments++;
+      return 0;
+    }
+  }
+  return -1;
+}
+
+/*  Make sure 'n' blocks are left in the segment the log writes to,   *
+ *  moving on to a clean one if not.  When the log is down to its     *
+ *  reserve of clean segments the cleaner runs first.  Returns -1 if  *
+ *  no more than 'keep' clean segments are left.                      */
+static int32 room(uint32 n, uint32 keep) {
+  if (head + n <= end(seg))
+    return 0;
+  drain();
+  if (!cleaning && reusable_segments() <= LFS_CLEAN_RESERVE) {
+    lfs_clean(LFS_CLEAN_RESERVE + LFS_CLEAN_BATCH);
+    if (head + n <= end(seg))                       /*  The cleaner moved the log on already  */
+      return 0;
+  }
+  if (reusable_segments() <= keep)
+    return -1;
+  return next_segment();
+}
+
+/*  Returns 1 if the cleaner can copy 'n' more blocks and still leave  *
+ *  LFS_CLEAN_SLACK blocks for the inodes of the files it changed.     */
+static byte spare(uint32 n) {
+  return end(seg) - head + reusable_segments() * (segblocks - 1) >= n + LFS_CLEAN_SLACK;
+}
+
+
+/*  Take the block at the head of the log for block 'index' of file  *
+ *  'ino' (or one of LFS_SUM_*) and note it in the segment summary.  *
+ *  Callers make room first, so the cleaner never runs while a       *
+ *  block is being mapped.  Returns the block or EMPTY.              */
+uint32 lfs_alloc(uint32 ino, uint32 index) {
+  lfssum_t entry = { ino, index };
+  uint32 block;
+  if (!active)
+    return EMPTY;
+  if (head == end(seg)) {
+    drain();
+    if (next_segment() == -1)
+      return EMPTY;
+  }
+  block = head++;
+  bc_write(first(seg), (block - first(seg)) * sizeof(lfssum_t), &entry, sizeof(lfssum_t));
+  fs_setmaskbit(block);
+  if (index != LFS_SUM_INODE && !cleaning)
+    stats.written++;
+  return block;
+}
+
+/*  Free the old copy of a block written again elsewhere.  A cached  *
+ *  copy must not reach the device once the block is reused.         */
+static void release(uint32 block) {
+  if (block == EMPTY)
+    return;
+  fs_clearmaskbit(block);
+  bc_discard(block);
+}
+
+/*  Copy indirect block 'block' of file 'ino' (noted as 'index' in the  *
+ *  summary) to the head of the log unless it was written since the     *
+ *  last checkpoint, which still needs the old copy.  Returns the block *
+ *  to change pointers in, or EMPTY if the log is full.                 */
+uint32 lfs_renew(uint32 block, uint32 ino, uint32 index) {
+  bcbuf_t *from, *to;
+  uint32 copy;
+  if (!active || isfresh(block))
+    return block;
+  if ((copy = lfs_alloc(ino, index)) == EMPTY)
+    return EMPTY;
+  if ((from = bc_get(block, 1)) == NULL || (to = bc_get(copy, 0)) == NULL) {
+    if (from != NULL)
+      bc_put(from, 0);
+    return EMPTY;
+  }
+  memcpy(to->data, from->data, blocksz);
+  bc_put(from, 0);
+  bc_put(to, 1);
+  release(block);
+  return copy;
+}
+
+
+/*  Find an inode number that is not in use.  It is taken by the  *
+ *  first 'lfs_iput' of an inode with that 'id'.                   */
+uint32 lfs_ialloc(void) {
+  uint32 ino;
+  for (uint32 k=0; active && k<ninodes; k++) {
+    ino = (nextino + k) % ninodes;
+    if (imap[ino] == EMPTY) {
+      nextino = ino;
+      return ino;
+    }
+  }
+  return EMPTY;
+}
+
+int32 lfs_iget(uint32 ino, inode_t* inode) {
+  if (!active || ino >= ninodes || imap[ino] == EMPTY)
+    return -1;
+  return bc_read(imap[ino], 0, inode, sizeof(inode_t));
+}
+
+/*  Append 'inode' to the log and point the inode map at the new copy.  *
+ *  An inode already written since the last checkpoint is rewritten     *
+ *  where it is.                                                        */
+int32 lfs_iput(inode_t* inode) {
+  uint32 ino = inode->id, block;
+  char mask;
+  if (!active || ino >= ninodes)
+    return -1;
+  mask = disable_interrupts();
+  if (imap[ino] != EMPTY && isfresh(imap[ino])) {
+    bc_write(imap[ino], 0, inode, sizeof(inode_t));
+    restore_interrupts(mask);
+    return 0;
+  }
+  if (room(1, 0) == -1 || (block = lfs_alloc(ino, LFS_SUM_INODE)) == EMPTY) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  bc_fill(block, 0);
+  bc_write(block, 0, inode, sizeof(inode_t));
+  release(imap[ino]);                               /*  Read after 'room', the cleaner may have moved it  */
+  imap[ino] = block;
+  imapdirty[ino * sizeof(uint32) / blocksz] = 1;
+  stats.inodes++;
+  restore_interrupts(mask);
+  return 0;
+}
+
+
+/*  Blocks 'fs_bmap' takes from the log to map block 'index' of the  *
+ *  file: the block itself and every indirect block on the way that  *
+ *  is missing or has to be renewed.                                 */
+static uint32 needed(inode_t* inode, uint32 index) {
+  uint32 ptr = EMPTY;
+  if (index < INODE_BLOCKS)
+    return 1;
+  index -= INODE_BLOCKS;
+  if (index < INODE_PTRS)
+    return 1 + !isfresh(inode->indirect);
+  if (inode->dindirect == EMPTY)
+    return 3;
+  index -= INODE_PTRS;
+  bc_read(inode->dindirect, index / INODE_PTRS * sizeof(uint32), &ptr, sizeof(uint32));
+  return 1 + !isfresh(inode->dindirect) + !isfresh(ptr);
+}
+
+/*  Make room for the blocks 'fs_bmap' takes to map block 'index' of   *
+ *  the file.  A checkpoint taken by the cleaner on the way leaves no   *
+ *  block fresh, so the count is made again.                            */
+static int32 room_map(inode_t* inode, uint32 index, uint32 keep) {
+  if (room(needed(inode, index), keep) == -1)
+    return -1;
+  return room(needed(inode, index), keep);
+}
+
+/*  Give block 'index' of the file a new block at the head of the log,  *
+ *  held back in 'segwbuf', and return it (EMPTY if the log is full).   *
+ *  With 'keep' set the old contents are carried over (zeros if there   *
+ *  were none), the caller rewrites only part of the block.  A block    *
+ *  written since the last checkpoint is reused where it is.            */
+static uint32 relocate(inode_t* inode, uint32 index, byte keep, char* dirty) {
+  uint32 old, block;
+  char* buf;
+  if (index >= INODE_MAX_BLOCKS || room_map(inode, index, LFS_CLEAN_RESERVE) == -1)
+    return EMPTY;
+  old = fs_bmap(inode, index, BMAP_LOOKUP, NULL);
+  if (old != EMPTY && isfresh(old))
+    return old;
+  if ((block = fs_bmap(inode, index, BMAP_LOG, dirty)) == EMPTY)
+    return EMPTY;
+  buf = hold(block);
+  if (keep && old != EMPTY)
+    bc_read(old, 0, buf, blocksz);
+  else if (keep)
+    memset(buf, 0, blocksz);
+  release(old);
+  return block;
+}
+
+/*  Write 'len' bytes of 'buff' to the file of 'inode' at byte 'offset',  *
+ *  every block at the head of the log.  The blocks are held back until   *
+ *  the segment is full (or a checkpoint or a read of the file), so the   *
+ *  writes of many calls reach the device together.  Returns the number   *
+ *  of bytes written, short if the log is full.                           */
+uint32 lfs_write(inode_t* inode, uint32 offset, char* buff, uint32 len, char* dirty) {
+  uint32 written = 0, n, block;
+  char mask = disable_interrupts();
+  while (written < len) {
+    n = blocksz - offset % blocksz;
+    n = (n < len - written ? n : len - written);
+    if ((block = relocate(inode, offset / blocksz, n < blocksz, dirty)) == EMPTY)
+      break;
+    if (isheld(block))
+      memcpy(segwbuf + slot(block) * blocksz + offset % blocksz, buff + written, n);
+    else
+      bc_write(block, offset % blocksz, buff + written, n);
+    offset += n;
+    written += n;
+  }
+  restore_interrupts(mask);
+  return written;
+}
+
+
+/*  Write back the inode of the file the cleaner was moving blocks of  */
+static void put_owner(void) {
+  if (owner != NULL && ownerdirty) {
+    if (ownerfd >= 0)
+      oft[ownerfd].dirty = 1;
+    else
+      lfs_iput(owner);
+  }
+  owner = NULL;
+  ownerdirty = 0;
+}
+
+/*  Get the inode of file 'ino' for the cleaner, or NULL  */
+static inode_t* get_owner(uint32 ino) {
+  if (owner != NULL && ownerino == ino)
+    return owner;
+  put_owner();
+  ownerino = ino;
+  for (ownerfd=0; ownerfd<NUM_FD; ownerfd++)
+    if (oft[ownerfd].state == FSTATE_OPEN && oft[ownerfd].inode.id == ino)
+      return (owner = &oft[ownerfd].inode);
+  ownerfd = -1;
+  if (lfs_iget(ino, &ownerbuf) == -1)
+    return NULL;
+  return (owner = &ownerbuf);
+}
+
+/*  Copy block 'k' of segment 's' (read into 'segbuf') to the head of  *
+ *  the log if its summary 'entry' shows it is still live, and point   *
+ *  its owner at the copy.  Inode and indirect blocks are copied       *
+ *  through the cache, which may hold pointers changed since the       *
+ *  segment was read.  Returns 1 if the block was moved, 0 if it was   *
+ *  not live and -1 if the log has no room left for it.                */
+static int32 move(uint32 s, uint32 k, lfssum_t* entry) {
+  uint32 block = first(s) + k, copy, slot, ptr, dind;
+  char* data = segbuf + k * blocksz;
+  inode_t* inode;
+
+  if (entry->ino >= ninodes)
+    return 0;
+  if (entry->index == LFS_SUM_INODE) {
+    if (imap[entry->ino] != block)
+      return 0;
+    if (!spare(1) || room(1, 0) == -1 || (copy = lfs_alloc(entry->ino, LFS_SUM_INODE)) == EMPTY)
+      return -1;
+    bc_write(copy, 0, data, blocksz);
+    imap[entry->ino] = copy;
+    imapdirty[entry->ino * sizeof(uint32) / blocksz] = 1;
+    return 1;
+  }
+  if ((inode = get_owner(entry->ino)) == NULL)
+    return 0;
+  if (entry->index == LFS_SUM_IND || entry->index == LFS_SUM_DIND) {
+    uint32* iptr = (entry->index == LFS_SUM_IND ? &inode->indirect : &inode->dindirect);
+    if (*iptr != block)
+      return 0;
+    if (!spare(1) || room(1, 0) == -1 || (copy = lfs_alloc(entry->ino, entry->index)) == EMPTY)
+      return -1;
+    bc_read(block, 0, data, blocksz);
+    bc_write(copy, 0, data, blocksz);
+    *iptr = copy;
+    ownerdirty = 1;
+  }
+  else if (entry->index & LFS_SUM_IND2) {
+    slot = entry->index & ~LFS_SUM_IND2;
+    if (inode->dindirect == EMPTY || slot >= INODE_PTRS ||
+        bc_read(inode->dindirect, slot * sizeof(uint32), &ptr, sizeof(uint32)) == -1 || ptr != block)
+      return 0;
+    if (!spare(2) || room(1 + !isfresh(inode->dindirect), 0) == -1 ||
+        (dind = lfs_renew(inode->dindirect, entry->ino, LFS_SUM_DIND)) == EMPTY ||
+        (copy = lfs_alloc(entry->ino, entry->index)) == EMPTY)
+      return -1;
+    if (dind != inode->dindirect) {
+      inode->dindirect = dind;
+      ownerdirty = 1;
+    }
+    bc_read(block, 0, data, blocksz);
+    bc_write(copy, 0, data, blocksz);
+    bc_write(dind, slot * sizeof(uint32), &copy, sizeof(uint32));
+  }
+  else {
+    if (fs_bmap(inode, entry->index, BMAP_LOOKUP, NULL) != block)
+      return 0;
+    if (!spare(3) || room_map(inode, entry->index, 0) == -1 ||
+        (copy = fs_bmap(inode, entry->index, BMAP_LOG, &ownerdirty)) == EMPTY)
+      return -1;
+    memcpy(hold(copy), data, blocksz);
+  }
+  return 1;
+}
+
+/*  Move the live blocks out of segment 's' and free the whole  *
+ *  segment.  Returns -1, leaving the segment as it is, if the   *
+ *  log ran out of room for them.                                */
+static int32 clean_segment(uint32 s) {
+  lfssum_t* sum = (lfssum_t*)segbuf;
+  int32 result = 0;
+
+  if (!spare(used(s) + 2))                          /*  Started only when it can be finished  */
+    return -1;
+  bc_read_blocks(first(s), segblocks, segbuf);
+  for (uint32 k=1; k<segblocks && result != -1; k++) {
+    if (fs_getmaskbit(first(s) + k) && (result = move(s, k, &sum[k])) == 1)
+      stats.moved++;
+  }
+  put_owner();
+  if (result == -1)                                 /*  Copies already made are live, the  */
+    return -1;                                      /*  blocks left behind are freed when  */
+  for (uint32 b=first(s); b<end(s); b++)           /*  the segment is cleaned again       */
+    if (fs_getmaskbit(b))
+      release(b);
+    else
+      bc_discard(b);
+  stats.cleaned++;
+  return 0;
+}
+
+/*  The segment with the fewest used blocks, other than the one the log  *
+ *  writes to, among those not clean with at least two blocks to gain.   *
+ *  Returns EMPTY if there is none.                                      */
+static uint32 victim(void) {
+  uint32 best = EMPTY, fewest = segblocks - 1, n;
+  for (uint32 s=0; s<fsd->nsegs; s++) {
+    if (s == seg || (n = used(s)) == 0)
+      continue;
+    if (n < fewest) {
+      best = s;
+      fewest = n;
+    }
+  }
+  return best;
+}
+
+/*  Clean segments, the emptiest first, until 'want' segments of the log  *
+ *  are clean or none is worth cleaning, then checkpoint.  The cleaner    *
+ *  checkpoints on the way when it runs out of room for its copies.       *
+ *  Returns the number of segments cleaned.                               */
+int32 lfs_clean(uint32 want) {
+  uint32 s, n = 0;
+  char mask;
+  if (!active || cleaning)
+    return 0;
+  mask = disable_interrupts();
+  cleaning = 1;
+  if (reusable_segments() < lfs_clean_segments())  /*  Segments emptied by writes since  */
+    lfs_checkpoint();                              /*  the checkpoint, for the copies    */
+  while (n < fsd->nsegs && lfs_clean_segments() < want && (s = victim()) != EMPTY) {
+    if (clean_segment(s) == 0)
+      n++;
+    else if (reusable_segments() < lfs_clean_segments())
+      lfs_checkpoint();                             /*  Lets the log reuse what was cleaned  */
+    else
+      break;
+  }
+  if (n > 0)
+    lfs_checkpoint();
+  cleaning = 0;
+  restore_interrupts(mask);
+  return n;
+}
+
+
+/*  Append the dirty inodes of open files to the log, write the log  *
+ *  out of the cache and then the inode map, the bitmask and the     *
+ *  super block (with the head of the log) in place.                 */
+int32 lfs_checkpoint(void) {
+  char mask;
+  if (!active)
+    return -1;
+  mask = disable_interrupts();
+  for (int i=0; i<NUM_FD; i++) {
+    if (oft[i].state == FSTATE_OPEN && oft[i].dirty) {
+      oft[i].dirty = 0;
+      if (lfs_iput(&oft[i].inode) == -1)
+        oft[i].dirty = 1;
+    }
+  }
+  drain();
+  bs_plug();                                        /*  The log first  */
+  bc_flush();
+  bs_unplug();
+  if (fsd->maskdirty) {
+    fsd->loghead = head;
+    bs_plug();
+    for (uint32 b=0; b<fsd->imapblocks; b++)
+      if (imapdirty[b]) {
+        bs_write(fsd->imap + b, 0, (char*)imap + b * blocksz, blocksz);
+        imapdirty[b] = 0;
+      }
+    for (uint32 b=0; b<fsd->maskblocks; b++)
+      if (fsd->maskstate[b] & MASK_DIRTY)
+        fs_maskio(b, 1);
+    bs_write(SB_BIT, 0, fsd, sizeof(fsystem_t));
+    fsd->maskdirty = 0;
+    bs_unplug();
+    stats.checkpoints++;
+  }
+  for (uint32 s=0; s<fsd->nsegs; s++) {
+    reusable[s] = clean(s);
+    young[s] = 0;
+  }
+  fresh = head;
+  restore_interrupts(mask);
+  return 0;
+}
+
+
+/*  Load the inode map of the mounted file system and carry on with  *
+ *  the log where the last checkpoint left it.  Returns 0, also when  *
+ *  the file system has no log, or -1 if it cannot be loaded.         */
+int32 lfs_init(void) {
+  char mask = disable_interrupts();
+
+  active = cleaning = 0;
+  nheld = 0;
+  owner = NULL;
+  ownerdirty = 0;
+  memset(&stats, 0, sizeof(stats));
+  if (fsd == NULL || fsd->imapblocks == 0) {
+    restore_interrupts(mask);
+    return 0;
+  }
+  blocksz = fsd->device.blocksz;
+  segblocks = fsd->segblocks;
+  ninodes = fsd->imapblocks * blocksz / sizeof(uint32);
+  if (segblocks < 4 || segblocks > blocksz / sizeof(lfssum_t) || fsd->nsegs < LFS_MIN_SEGS ||
+      fsd->log + fsd->nsegs * segblocks > fsd->device.nblocks ||
+      fsd->loghead < fsd->log || fsd->loghead > fsd->log + fsd->nsegs * segblocks) {
+    restore_interrupts(mask);
+    return -1;
+  }
+  imap = malloc(fsd->imapblocks * blocksz);
+  imapdirty = malloc(fsd->imapblocks);
+  segbuf = malloc(segblocks * blocksz);
+  segwbuf = malloc(segblocks * blocksz);
+  held = malloc(segblocks);
+  reusable = malloc(fsd->nsegs);
+  young = malloc(fsd->nsegs);
+  if (imap == NULL || imapdirty == NULL || segbuf == NULL || segwbuf == NULL || held == NULL ||
+      reusable == NULL || young == NULL) {
+    free(imap);
+    free(imapdirty);
+    free(segbuf);
+    free(segwbuf);
+    free(held);
+    free(reusable);
+    free(young);
+    restore_interrupts(mask);
+    return -1;
+  }
+  heap_transfer(imap, M_KERNEL);
+  heap_transfer(imapdirty, M_KERNEL);
+  heap_transfer(segbuf, M_KERNEL);
+  heap_transfer(segwbuf, M_KERNEL);
+  heap_transfer(held, M_KERNEL);
+  heap_transfer(reusable, M_KERNEL);
+  heap_transfer(young, M_KERNEL);
+  memset(imapdirty, 0, fsd->imapblocks);
+  memset(held, 0, segblocks);
+  memset(young, 0, fsd->nsegs);
+  bs_read_blocks(fsd->imap, fsd->imapblocks, imap);
+  for (uint32 b=0; b<fsd->maskblocks; b++)          /*  Clean segments are found in the bitmask  */
+    if (!(fsd->maskstate[b] & MASK_LOADED))
+      fs_maskio(b, 0);
+  for (uint32 s=0; s<fsd->nsegs; s++)
+    reusable[s] = clean(s);
+
+  if (fsd->loghead == fsd->log) {                   /*  Nothing written yet, the first write  */
+    seg = 0;                                        /*  moves on to a clean segment           */
+    head = end(0);
+  }
+  else {
+    head = fsd->loghead;
+    seg = (head - fsd->log - 1) / segblocks;
+  }
+  fresh = head;
+  nextino = 0;
+  active = 1;
+  restore_interrupts(mask);
+  return 0;
+}
+
+/*  Stop writing to the log and free the inode map.  Called once  *
+ *  'fs_sync' has taken the last checkpoint.                       */
+void lfs_release(void) {
+  char mask = disable_interrupts();
+  if (active) {
+    free(imap);
+    free(imapdirty);
+    free(segbuf);
+    free(segwbuf);
+    free(held);
+    free(reusable);
+    free(young);
+    imap = NULL;
+    imapdirty = NULL;
+    segbuf = segwbuf = NULL;
+    held = reusable = young = NULL;
+    active = 0;
+  }
+  restore_interrupts(mask);
+}
+
+byte lfs_active(void) {
+  return active;
+}
+
+lfsstat_t lfs_stats(void) {
+  return stats;
+}
+
+
+/*  Body of the cleaner thread started by the shell.  Every           *
+ *  FS_FLUSH_TICKS timer ticks it cleans segments of a mounted log    *
+ *  until 1/LFS_CLEAN_IDLE of them are clean, so a writer seldom has  *
+ *  to wait for the cleaner.                                          */
+byte lfs_cleaner(char* arg) {
+  while (1) {
+    sleep(current_thread, FS_FLUSH_TICKS);
+    if (lfs_active())
+      lfs_clean(fsd->nsegs / LFS_CLEAN_IDLE);
+  }
+  return 0;
+}
@@ -1,5 +1,6 @@
 #include <barelib.h>
 #include <fs.h>
+#include <bcache.h>
 
 #define TIMEOUT 0x5
 #define status_is(cond) (t__status & (0x1 << cond))
@@ -48,11 +49,19 @@ static const char* write_prompt[] = {
 				    "  Overwrite existing file:              ",
 				    "  Append to end of file <partial>:      ",
 				    "  Append to end of file <multi-block>:  ",
+				    "  Deferred writes reach disk on sync:   ",
+};
+static const char* layout_prompt[] = {
+				     "  Hole in a sparse file reads as zeros: ",
+				     "  Inline file promoted intact:          ",
+				     "  Held blocks written by fs_sync:       ",
+				     "  Held blocks survive close and mount:  ",
 };
 
 static char* general_t[test_count(general_prompt)];
 static char* read_t[test_count(read_prompt)];
 static char* write_t[test_count(write_prompt)];
+static char* layout_t[test_count(layout_prompt)];
 
 static void file_setup(void) {
   char block[1024];
@@ -271,6 +280,7 @@ static void write_tests(void) {
   
   file_setup();
   fs_write(1, block, 100);
+  fs_sync();
   newblock = oft[1].inode.blocks[0];
   assert(oft[1].inode.size == 100, write_t[0], "FAIL - Size of the file does not match write size");
   assert(newblock != 600, write_t[0], "FAIL - Block number not written to inode");
@@ -285,6 +295,7 @@ static void write_tests(void) {
 
   file_setup();
   fs_write(1, block, 512);
+  fs_sync();
   newblock = oft[1].inode.blocks[0];
   assert(oft[1].inode.size == 512, write_t[1], "FAIL - Size of the file does not match write size");
   assert(newblock != 600, write_t[1], "FAIL - Block index not written to inode");
@@ -300,6 +311,7 @@ static void write_tests(void) {
 
   file_setup();
   fs_write(1, block, 800);
+  fs_sync();
   newblock = oft[1].inode.blocks[0];
   assert(oft[1].inode.size == 800, write_t[2], "FAIL - Size of the file does not match write size");
   assert(newblock != 600, write_t[2], "FAIL - Block number not written to inode");
@@ -319,6 +331,7 @@ static void write_tests(void) {
 
   file_setup();
   fs_write(0, block, 300);
+  fs_sync();
   newblock = oft[0].inode.blocks[0];
   assert(oft[0].inode.size == 2300, write_t[3], "FAIL - Size of the file does not match original size");
   assert(newblock != 600, write_t[3], "FAIL - Block index not written to inode");
@@ -336,6 +349,7 @@ static void write_tests(void) {
   file_setup();
   oft[0].head = 2300;
   fs_write(0, block, 100);
+  fs_sync();
   newblock = oft[0].inode.blocks[4];
   assert(oft[0].inode.size == 2400, write_t[4], "FAIL - Size of the file does not match original size");
   assert(newblock != 600, write_t[4], "FAIL - Block index not written to inode");
@@ -352,6 +366,7 @@ static void write_tests(void) {
   file_setup();
   oft[0].head = 2300;
   fs_write(0, block, 512);
+  fs_sync();
   newblock = oft[0].inode.blocks[4];
   assert(oft[0].inode.size == 2812, write_t[5], "FAIL - Size of the file does not match original size");
   assert(newblock != 600, write_t[5], "FAIL - Block index not written to inode");
@@ -367,6 +382,121 @@ static void write_tests(void) {
   assert(oft[0].head == 2812, write_t[5], "FAIL - oft head was not changed to reflect the write");
   bs_read(oft[0].inode.id, 0, (char*)&inode, sizeof(inode_t));
   assert(inode.blocks[5] == oft[0].inode.blocks[5], write_t[5], "FAIL - inode was not written back to block store");
+
+  oft[0].head = 0;
+  fs_write(0, block, 10);
+  assert(bc_stats().dirty != 0, write_t[6], "FAIL - Data was written through instead of into the block cache");
+  oft[0].head = 2812;
+  fs_write(0, block, 10);
+  bs_read(oft[0].inode.id, 0, (char*)&inode, sizeof(inode_t));
+  assert(oft[0].dirty, write_t[6], "FAIL - inode was not marked dirty after growing the file");
+  assert(inode.size == 2812, write_t[6], "FAIL - inode was written back before a sync");
+  fs_sync();
+  bs_read(oft[0].inode.id, 0, (char*)&inode, sizeof(inode_t));
+  assert(inode.size == oft[0].inode.size, write_t[6], "FAIL - fs_sync did not write the dirty inode back");
+  assert(!oft[0].dirty && !fsd->maskdirty, write_t[6], "FAIL - Dirty flags were not cleared by fs_sync");
+  assert(bc_stats().dirty == 0, write_t[6], "FAIL - fs_sync left dirty buffers in the block cache");
+}
+
+static void layout_tests(void) {
+  char block[1024], cmp[1024];
+  uint32 rlen;
+  int32 fd;
+  inode_t inode;
+  for (int i=0; i<1024; i++)
+    block[i] = (char)(i + 1);
+
+  fs_umount();
+  fs_mkfs();
+  fs_mount();
+
+  fs_create("hole");
+  fd = fs_open("hole");
+  fs_write(fd, block, 100);
+  fs_seek(fd, 1044, SEEK_START);
+  fs_write(fd, block, 100);
+  assert(oft[fd].inode.size == 1144, layout_t[0], "FAIL - Size of the file does not end after the second write");
+  assert(oft[fd].inode.blocks[1] == EMPTY, layout_t[0], "FAIL - A block was allocated for the hole");
+  for (int i=0; i<1024; i++)
+    cmp[i] = 0x55;
+  fs_seek(fd, 0, SEEK_START);
+  rlen = fs_read(fd, cmp, 1024);
+  assert(rlen == 1024, layout_t[0], "FAIL - Returned length did not match read request length");
+  for (int i=0; i<100; i++)
+    assert(cmp[i] == block[i], layout_t[0], "FAIL - Read does not match written value");
+  for (int i=100; i<1024; i++)
+    assert(cmp[i] == 0, layout_t[0], "FAIL - Hole did not read as zeros");
+  fs_close(fd);
+
+  fs_inline_max = FS_INLINE_MAX;
+  fs_umount();
+  fs_mkfs();
+  fs_mount();
+  fs_inline_max = 0;
+
+  fs_create("inline");
+  fd = fs_open("inline");
+  fs_write(fd, block, 300);
+  assert(oft[fd].inode.blocks[0] == INLINE_DATA, layout_t[1], "FAIL - Small file was not kept in its inode block");
+  fs_write(fd, block + 300, 500);
+  assert(oft[fd].inode.blocks[0] != INLINE_DATA, layout_t[1], "FAIL - File was not moved to a block of its own");
+  assert(oft[fd].inode.size == 800, layout_t[1], "FAIL - Size of the file does not match write size");
+  for (int i=0; i<1024; i++)
+    cmp[i] = 0;
+  fs_seek(fd, 0, SEEK_START);
+  rlen = fs_read(fd, cmp, 1024);
+  assert(rlen == 800, layout_t[1], "FAIL - Returned length did not match the file size");
+  for (int i=0; i<800; i++)
+    assert(cmp[i] == block[i], layout_t[1], "FAIL - Promoted file does not match written value");
+  fs_sync();
+  if (oft[fd].inode.blocks[0] != INLINE_DATA && oft[fd].inode.blocks[0] != EMPTY) {
+    bs_read(oft[fd].inode.blocks[0], 0, cmp, 512);
+    for (int i=0; i<512; i++)
+      assert(cmp[i] == block[i], layout_t[1], "FAIL - Data inside block does not match file write");
+  }
+  fs_close(fd);
+
+  fs_umount();
+  fs_mkfs();
+  fs_mount();
+
+  fs_delay_alloc = 1;
+  fs_create("held");
+  fd = fs_open("held");
+  for (int i=0; i<2; i++)
+    fs_write(fd, block + i * 256, 256);
+  assert(oft[fd].hcount > 0, layout_t[2], "FAIL - Appended blocks were not held back");
+  assert(oft[fd].inode.blocks[0] == EMPTY, layout_t[2], "FAIL - Blocks were placed before they were written back");
+  fs_sync();
+  assert(oft[fd].hcount == 0, layout_t[2], "FAIL - fs_sync left blocks held back");
+  assert(oft[fd].inode.blocks[0] != EMPTY, layout_t[2], "FAIL - Block index not written to inode");
+  if (oft[fd].inode.blocks[0] != EMPTY) {
+    bs_read(oft[fd].inode.blocks[0], 0, cmp, 512);
+    for (int i=0; i<512; i++)
+      assert(cmp[i] == block[i], layout_t[2], "FAIL - Data inside block does not match file write");
+  }
+  bs_read(oft[fd].inode.id, 0, (char*)&inode, sizeof(inode_t));
+  assert(inode.size == 512, layout_t[2], "FAIL - inode was not written back to block store");
+
+  for (int i=2; i<4; i++)
+    fs_write(fd, block + i * 256, 256);
+  assert(oft[fd].hcount > 0, layout_t[3], "FAIL - Appended blocks were not held back");
+  assert(fs_close(fd) == 0, layout_t[3], "FAIL - fs_close did not write the blocks held back");
+  fs_umount();
+  fs_mount();
+  fs_delay_alloc = 0;
+  fd = fs_open("held");
+  assert(fd != -1, layout_t[3], "FAIL - File could not be opened after mounting again");
+  if (fd != -1) {
+    assert(oft[fd].inode.size == 1024, layout_t[3], "FAIL - Size of the file does not match write size");
+    for (int i=0; i<1024; i++)
+      cmp[i] = 0;
+    rlen = fs_read(fd, cmp, 1024);
+    assert(rlen == 1024, layout_t[3], "FAIL - Returned length did not match the file size");
+    for (int i=0; i<1024; i++)
+      assert(cmp[i] == block[i], layout_t[3], "FAIL - Read does not match written value");
+    fs_close(fd);
+  }
 }
 
 void t__ms10(uint32 idx) {
@@ -379,11 +509,14 @@ void t__ms10(uint32 idx) {
     runner("read", read);
   else if (idx == 2)
     runner("write", write);
+  else if (idx == 3)
+    runner("layout", layout);
   else {
     t__print("\n----------------------------\n");
     feedback("General", general);
     feedback("Read", read);
     feedback("Write", write);
+    feedback("Layout", layout);
     t__print("\n");
   }
 }
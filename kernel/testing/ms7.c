@@ -1,6 +1,7 @@
 #include <barelib.h>
 #include <thread.h>
 #include <malloc.h>
+#include <arena.h>
 
 #define TIMEOUT 0x5
 #define status_is(cond) (t__status & (0x1 << cond))
@@ -36,9 +37,43 @@ static const char* free_prompt[] = {
 				       "  Free first:          ",
 };
 
+static const char* arenas_prompt[] = {
+				       "  Allocations are aligned and disjoint:  ",
+				       "  Oversized allocation gets own chunk:   ",
+				       "  Reset reuses the first chunk:          ",
+				       "  Destroy returns chunks to the heap:    ",
+};
+
+static const char* realloc_prompt[] = {
+				       "  Grows in place into free neighbor:     ",
+				       "  Moves data when neighbor is in use:    ",
+				       "  Shrink returns tail to the freelist:   ",
+};
+static const char* calloc_prompt[] = {
+				       "  calloc clears the allocation:          ",
+				       "  calloc rejects overflowing sizes:      ",
+				       "  aligned_alloc honors alignment:        ",
+				       "  aligned_alloc head is freed:           ",
+};
+static const char* stats_prompt[] = {
+				       "  Tracks bytes in use and peak:          ",
+				       "  Counts free blocks and largest block:  ",
+				       "  Reports external fragmentation:        ",
+};
+static const char* owner_prompt[] = {
+				       "  Per-thread byte counter is updated:    ",
+				       "  Reclaim frees a thread's allocations:  ",
+				       "  Transferred allocations survive:       ",
+};
+
 static char* general_t[test_count(general_prompt)];
 static char* malloc_t[test_count(malloc_prompt)];
 static char* free_t[test_count(free_prompt)];
+static char* arenas_t[test_count(arenas_prompt)];
+static char* realloc_t[test_count(realloc_prompt)];
+static char* calloc_t[test_count(calloc_prompt)];
+static char* stats_t[test_count(stats_prompt)];
+static char* owner_t[test_count(owner_prompt)];
 
 static void mem_reset(uint32 sz) {
   heap_init();
@@ -169,6 +204,160 @@ static void free_tests(void) {
   assert(freelist->size == 46, free_t[4], "FAIL - Freed block was not coalesced into free list");
 }
 
+static void arena_tests(void) {
+  arena_t arena;
+  char *a, *b, *c, *big;
+  heap_init();
+  freelist = (alloc_t*)mem_start;
+  uint64 heapsz = freelist->size;
+
+  arena_init(&arena, 256);
+  a = arena_alloc(&arena, 3);
+  b = arena_alloc(&arena, 13);
+  c = arena_alloc(&arena, 8);
+  assert(a != NULL && b != NULL && c != NULL,     arenas_t[0], "FAIL - Arena returned NULL for a small allocation");
+  assert(((uint64)a % ARENA_ALIGN) == 0,          arenas_t[0], "FAIL - First allocation is not aligned");
+  assert(((uint64)b % ARENA_ALIGN) == 0,          arenas_t[0], "FAIL - Second allocation is not aligned");
+  assert(b >= a + 3 && c >= b + 13,               arenas_t[0], "FAIL - Allocations overlap");
+  assert(c - a < 32,                              arenas_t[0], "FAIL - Small allocations were not bumped from one chunk");
+
+  big = arena_alloc(&arena, 1000);
+  assert(big != NULL,                             arenas_t[1], "FAIL - Arena returned NULL for an oversized allocation");
+  assert(arena.curr != arena.head,                arenas_t[1], "FAIL - Oversized allocation was not given a new chunk");
+  assert(arena.curr->size >= 1000,                arenas_t[1], "FAIL - New chunk is smaller than the request");
+
+  arena_reset(&arena);
+  assert(arena.curr == arena.head,                arenas_t[2], "FAIL - Reset did not rewind to the first chunk");
+  assert(arena_alloc(&arena, 3) == a,             arenas_t[2], "FAIL - Reset did not reuse the first chunk");
+  assert(arena_alloc(&arena, 900) == big,         arenas_t[2], "FAIL - Reset did not reuse the retained chunk");
+
+  arena_destroy(&arena);
+  freelist = (alloc_t*)mem_start;
+  assert(arena.head == NULL,                      arenas_t[3], "FAIL - Arena still references chunks");
+  assert(freelist->state == M_FREE,               arenas_t[3], "FAIL - Chunks were not freed");
+  assert(freelist->size == heapsz,                arenas_t[3], "FAIL - Heap did not coalesce after destroy");
+}
+
+static void realloc_tests(void) {
+  char *a, *b, *c;
+  alloc_t* header;
+  int ok;
+  heap_init();
+
+  a = malloc(40);
+  b = malloc(40);
+  c = malloc(40);
+  for (int i=0; i<40; i++) a[i] = i;
+  free(b);
+  header = (alloc_t*)a - 1;
+  b = realloc(a, 80);
+  assert(b == a,               realloc_t[0], "FAIL - Allocation was moved despite a free neighbor");
+  assert(header->size >= 80,   realloc_t[0], "FAIL - Block was not grown to the requested size");
+  assert(header->size < 80 + sizeof(alloc_t) + 40, realloc_t[0], "FAIL - Grown block swallowed more than it needed");
+
+  b = realloc(a, 200);
+  ok = 1;
+  for (int i=0; i<40; i++) ok &= (b[i] == i);
+  assert(b != a,               realloc_t[1], "FAIL - Allocation grew over a used neighbor");
+  assert(ok,                   realloc_t[1], "FAIL - Data was not preserved when moved");
+  assert(((alloc_t*)a - 1)->state == M_FREE, realloc_t[1], "FAIL - Old allocation was not freed");
+
+  a = realloc(b, 60);
+  header = (alloc_t*)b - 1;
+  assert(a == b,               realloc_t[2], "FAIL - Shrinking moved the allocation");
+  assert(header->size == 60,   realloc_t[2], "FAIL - Block was not shrunk to the requested size");
+  assert(((alloc_t*)(b + 60))->state == M_FREE, realloc_t[2], "FAIL - Tail was not returned as a free block");
+  free(a);
+  free(c);
+}
+
+static void calloc_tests(void) {
+  char *a, *b;
+  uint64 heapsz;
+  heap_init();
+  freelist = (alloc_t*)mem_start;
+  heapsz = freelist->size;
+
+  a = malloc(64);
+  for (int i=0; i<64; i++) a[i] = 0x5a;
+  free(a);
+  b = calloc(8, 8);
+  for (int i=0; i<64; i++)
+    assert(b[i] == 0,          calloc_t[0], "FAIL - calloc returned memory that was not cleared");
+  free(b);
+  assert(calloc(0x100000000, 0x100000000) == NULL, calloc_t[1], "FAIL - Overflowing calloc did not return NULL");
+
+  a = malloc(3);
+  b = aligned_alloc(64, 100);
+  assert(((uint64)b % 64) == 0, calloc_t[2], "FAIL - Allocation is not 64 byte aligned");
+  free(b);
+  b = aligned_alloc(4096, 10);
+  assert(((uint64)b % 4096) == 0, calloc_t[2], "FAIL - Allocation is not page aligned");
+  assert(((alloc_t*)b - 1)->size == 10, calloc_t[2], "FAIL - Aligned allocation kept its padding");
+  free(b);
+  free(a);
+  freelist = (alloc_t*)mem_start;
+  assert(freelist->size == heapsz, calloc_t[3], "FAIL - Heap did not coalesce after freeing aligned blocks");
+}
+
+static void stats_tests(void) {
+  heapstat_t stats;
+  char *a, *b, *c;
+  heap_init();
+
+  heap_stats(&stats);
+  assert(stats.used == 0 && stats.allocs == 0, stats_t[0], "FAIL - Fresh heap reports memory in use");
+  a = malloc(100);
+  b = malloc(200);
+  c = malloc(100);
+  heap_stats(&stats);
+  assert(stats.used == 400,                    stats_t[0], "FAIL - Bytes in use do not match allocations");
+  assert(stats.allocs == 3,                    stats_t[0], "FAIL - Allocation count does not match");
+  free(b);
+  heap_stats(&stats);
+  assert(stats.used == 200,                    stats_t[0], "FAIL - Bytes in use were not reduced by free");
+  assert(stats.peak == 400,                    stats_t[0], "FAIL - Peak did not keep the highest usage");
+
+  assert(stats.freeblocks == 2,                stats_t[1], "FAIL - Free block count is wrong");
+  assert(stats.largest == stats.free - 200,    stats_t[1], "FAIL - Largest free block is wrong");
+  assert(stats.size == stats.used + stats.free + sizeof(alloc_t) * 4, stats_t[1], "FAIL - Heap size does not add up");
+
+  assert(stats.frag == 0,                      stats_t[2], "FAIL - Nearly empty heap reported as fragmented");
+  free(a);
+  free(c);
+  heap_stats(&stats);
+  assert(stats.freeblocks == 1 && stats.frag == 0, stats_t[2], "FAIL - Heap did not return to one unfragmented block");
+}
+
+static void owner_tests(void) {
+  heapstat_t stats;
+  char *a, *b, *c;
+  uint64 used;
+  heap_init();
+
+  a = malloc(100);
+  b = malloc(50);
+  c = malloc(30);
+  used = thread_table[5].memused;
+  heap_transfer(a, 5);
+  heap_transfer(b, 5);
+  heap_transfer(c, 5);
+  assert(thread_table[5].memused == used + 180, owner_t[0], "FAIL - Thread byte counter does not match its allocations");
+  assert(((alloc_t*)a - 1)->owner == 5,          owner_t[0], "FAIL - Allocation owner was not updated");
+
+  heap_transfer(b, M_KERNEL);
+  assert(thread_table[5].memused == used + 130, owner_t[2], "FAIL - Transfer did not move the byte count");
+  heap_reclaim(5);
+  heap_stats(&stats);
+  assert(thread_table[5].memused == 0,           owner_t[1], "FAIL - Thread still owns memory after reclaim");
+  assert(((alloc_t*)a - 1)->state == M_FREE,     owner_t[1], "FAIL - First allocation was not reclaimed");
+  assert(((alloc_t*)c - 1)->state == M_FREE,     owner_t[1], "FAIL - Last allocation was not reclaimed");
+  assert(((alloc_t*)b - 1)->state == M_USED,     owner_t[2], "FAIL - Transferred allocation was reclaimed");
+  assert(stats.used == 50 && stats.allocs == 1,  owner_t[2], "FAIL - Heap usage does not match after reclaim");
+  assert(stats.kernel == 50,                     owner_t[2], "FAIL - Kernel byte counter does not match its allocations");
+  free(b);
+}
+
 void t__ms7(uint32 idx) {
   
   if (idx == 0) {
@@ -184,11 +373,36 @@ void t__ms7(uint32 idx) {
     init_tests(free_t, test_count(free_prompt));
     t__runner("free", test_count(free_prompt), free_tests);
   }
+  else if (idx == 3) {
+    init_tests(arenas_t, test_count(arenas_prompt));
+    t__runner("arena", test_count(arenas_prompt), arena_tests);
+  }
+  else if (idx == 4) {
+    init_tests(realloc_t, test_count(realloc_prompt));
+    t__runner("realloc", test_count(realloc_prompt), realloc_tests);
+  }
+  else if (idx == 5) {
+    init_tests(calloc_t, test_count(calloc_prompt));
+    t__runner("calloc", test_count(calloc_prompt), calloc_tests);
+  }
+  else if (idx == 6) {
+    init_tests(stats_t, test_count(stats_prompt));
+    t__runner("stats", test_count(stats_prompt), stats_tests);
+  }
+  else if (idx == 7) {
+    init_tests(owner_t, test_count(owner_prompt));
+    t__runner("ownership", test_count(owner_prompt), owner_tests);
+  }
   else {
     t__print("\n----------------------------\n");
     t__printer("\nGeneral Tests:", general_t, general_prompt, test_count(general_prompt));
     t__printer("\nMalloc Tests:", malloc_t, malloc_prompt, test_count(malloc_prompt));
     t__printer("\nFree Tests:", free_t, free_prompt, test_count(free_prompt));
+    t__printer("\nArena Tests:", arenas_t, arenas_prompt, test_count(arenas_prompt));
+    t__printer("\nRealloc Tests:", realloc_t, realloc_prompt, test_count(realloc_prompt));
+    t__printer("\nCalloc/Aligned Tests:", calloc_t, calloc_prompt, test_count(calloc_prompt));
+    t__printer("\nStats Tests:", stats_t, stats_prompt, test_count(stats_prompt));
+    t__printer("\nOwnership Tests:", owner_t, owner_prompt, test_count(owner_prompt));
     t__print("\n");
   }
 }
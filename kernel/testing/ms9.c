@@ -72,11 +72,15 @@ static void create_tests(void) {
   char name[FILENAME_LEN];
   char bitmap[fsd->freemasksz];
   inode_t inode;
+  dirent_t entry;
 
   fsd->root_dir.numentries = DIR_SIZE;
   assert(fs_create("test") == -1, create_t[0], "FAIL - Return code was incorrect");
 
-  memcpy(fsd->root_dir.entry[3].name, "example", 7);
+  memset(&entry, 0, sizeof(dirent_t));
+  entry.inode_block = EMPTY;
+  memcpy(entry.name, "example", 7);
+  fs_dir_put(&fsd->root_dir.inode, 3, &entry);
   fsd->root_dir.numentries = 4;
   assert(fs_create("example") == -1, create_t[1], "FAIL - Return code was incorrect");
 
@@ -91,9 +95,10 @@ static void create_tests(void) {
   fsd->root_dir.numentries = 0;
   fs_create("other_thing");
   
-  memcpy(name, fsd->root_dir.entry[0].name, FILENAME_LEN);
+  fs_dir_get(&fsd->root_dir.inode, 0, &entry);
+  memcpy(name, entry.name, FILENAME_LEN);
   assert(t__strcmp(name, "other_thing") == 0, create_t[3], "FAIL - Filename does not match requested file name");
-  assert(fsd->root_dir.entry[0].inode_block == 2, create_t[4], "FAIL - Inode block number does not match expected value for new file");
+  assert(entry.inode_block == 2, create_t[4], "FAIL - Inode block number does not match expected value for new file");
   assert(fs_getmaskbit(2), create_t[5], "FAIL - Freemask was not updated to reflect reserved block for inode");
 
   bs_read(2, 0, &inode, sizeof(inode_t));
@@ -106,9 +111,10 @@ static void create_tests(void) {
   
   fs_create("HELLOWORLDER");
 
-  memcpy(name, fsd->root_dir.entry[1].name, FILENAME_LEN);
+  fs_dir_get(&fsd->root_dir.inode, 1, &entry);
+  memcpy(name, entry.name, FILENAME_LEN);
   assert(t__strcmp(name, "HELLOWORLDER") == 0, create_t[3], "FAIL - Second filename does not match requested file name");
-  assert(fsd->root_dir.entry[1].inode_block == 3, create_t[4], "FAIL - Second inode block number does not match expected block number");
+  assert(entry.inode_block == 3, create_t[4], "FAIL - Second inode block number does not match expected block number");
   assert(fs_getmaskbit(3), create_t[5], "FAIL - Freemask was not updated to reflect second requested inode");
   bs_read(1, 0, bitmap, fsd->freemasksz);
   for (int i=0; i<fsd->freemasksz; i++)
@@ -117,20 +123,25 @@ static void create_tests(void) {
 
 static void open_tests(void) {
   inode_t inode;
+  dirent_t entry;
   for (int i=2; i<fsd->device.nblocks; i++)
     fs_clearmaskbit(i);
   
   inode.id = 2;
   inode.size = 0;
   fsd->root_dir.numentries = 4;
-  memcpy(fsd->root_dir.entry[0].name, "test 001.xz", 12);
-  fsd->root_dir.entry[0].inode_block = 2;
+  memset(&entry, 0, sizeof(dirent_t));
+  memcpy(entry.name, "test 001.xz", 12);
+  entry.inode_block = 2;
+  fs_dir_put(&fsd->root_dir.inode, 0, &entry);
   bs_write(2, 0, &inode, sizeof(inode_t));
   fs_setmaskbit(2);
   inode.id = 4;
   inode.size = 0;
-  memcpy(fsd->root_dir.entry[2].name, "test 002.cat", 13);
-  fsd->root_dir.entry[2].inode_block = 4;
+  memset(&entry, 0, sizeof(dirent_t));
+  memcpy(entry.name, "test 002.cat", 13);
+  entry.inode_block = 4;
+  fs_dir_put(&fsd->root_dir.inode, 2, &entry);
   bs_write(4, 0, &inode, sizeof(inode_t));
   fs_setmaskbit(4);
   bs_write(1, 0, fsd->freemask, fsd->freemasksz);